@@ -0,0 +1,16 @@
+
+#include "active_notes.h"
+
+namespace midiaud {
+
+ActiveNotes::ActiveNotes()
+    : sustained_(0) {
+  notes_.fill(0);
+}
+
+void ActiveNotes::Clear() noexcept {
+  notes_.fill(0);
+  sustained_ = 0;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef ACTIVE_NOTES_H_
+#define ACTIVE_NOTES_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace midiaud {
+
+/**
+ * Tracks the sounding notes and the held sustain pedals of all 16
+ * MIDI channels, so that stopping only has to release what is
+ * actually sounding.
+ */
+class ActiveNotes {
+ public:
+  static constexpr int kWordsPerChannel = 2;
+
+  ActiveNotes();
+
+  /**
+   * Updates the state with a message that was sent out. Everything
+   * but note ons, note offs and sustain pedal changes is ignored.
+   */
+  void Update(const uint8_t *data, size_t size) noexcept {
+    if (size != 3) return;
+    // Avoid branches on the message contents, this runs for every
+    // outgoing event.
+    uint32_t type = data[0] & 0xf0;
+    uint32_t channel = data[0] & 0x0f;
+    uint32_t key = data[1] & 0x7f;
+    uint64_t note_on = (type == 0x90) & (data[2] != 0);
+    uint64_t note_off = (type == 0x80) | ((type == 0x90) & (data[2] == 0));
+    uint64_t bit = UINT64_C(1) << (key & 63);
+    uint64_t &word = notes_[channel * kWordsPerChannel + (key >> 6)];
+    word = (word | (bit & -note_on)) & ~(bit & -note_off);
+
+    uint32_t is_sustain = (type == 0xb0) & (data[1] == 0x40);
+    uint32_t pedal_down = is_sustain & (data[2] >= 0x40);
+    uint32_t channel_bit = UINT32_C(1) << channel;
+    sustained_ = (sustained_ & ~(channel_bit & -is_sustain))
+        | (channel_bit & -pedal_down);
+  }
+
+  void Clear() noexcept;
+
+  /**
+   * Returns the notes of `channel` from `64 * word` to `64 * word + 63`
+   * as a bitmask.
+   */
+  uint64_t notes(uint8_t channel, int word) const {
+    return notes_[channel * kWordsPerChannel + word];
+  }
+  /**
+   * Returns the channels with their sustain pedal held as a bitmask.
+   */
+  uint32_t sustained() const { return sustained_; }
+
+ private:
+  std::array<uint64_t, 16 * kWordsPerChannel> notes_;
+  uint32_t sustained_;
+};
+
+}
+
+#endif // ACTIVE_NOTES_H_
@@ -0,0 +1,152 @@
+
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "benchmark.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options] input-file...\n";
+}
+
+/**
+ * Parses a comma separated list of buffer sizes.
+ */
+std::vector<jack_nframes_t> parse_buffer_sizes(const std::string &list) {
+  std::vector<jack_nframes_t> buffer_sizes;
+  std::istringstream list_stream(list);
+  std::string buffer_size;
+  while (std::getline(list_stream, buffer_size, ',')) {
+    unsigned long value = std::stoul(buffer_size);
+    if (value == 0)
+      throw std::invalid_argument("buffer sizes must be positive");
+    buffer_sizes.push_back(static_cast<jack_nframes_t>(value));
+  }
+  return buffer_sizes;
+}
+
+void print_result(const std::string &input_file,
+                  const midiaud::BenchmarkResult &result) {
+  std::cout << std::left << std::setw(24) << input_file << std::right
+            << std::setw(7) << result.buffer_size
+            << std::setw(11)
+            << (result.prerendered ? "prerender" : "tempo-map")
+            << std::setw(9) << result.cycles << std::setw(9) << result.events
+            << std::fixed << std::setprecision(1)
+            << std::setw(9) << result.IdleCycleSeconds() * 1e9
+            << std::setw(10) << result.EventSeconds() * 1e9 << "\n";
+}
+
+void print_clock_result(const std::string &input_file,
+                        const midiaud::ClockBenchmarkResult &result) {
+  std::cout << std::left << std::setw(24) << input_file << std::right
+            << std::setw(7) << result.buffer_size
+            << std::setw(9) << result.clocks
+            << std::setw(9) << result.missing_clocks
+            << std::setw(7) << result.extra_clocks
+            << std::setw(11) << result.max_deviation_frames
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << result.ClockSeconds() * 1e9 << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("buffer-sizes", po::value<std::string>()->default_value(
+           "16,32,64,128,256"),
+       "comma separated list of Jack buffer sizes to play the files at")
+      ("sample-rate", po::value<jack_nframes_t>()->default_value(48000),
+       "simulated Jack sample rate")
+      ("repeat,r", po::value<int>()->default_value(5),
+       "play every file this many times and keep the fastest run")
+      ;
+
+  po::options_description hidden_options_desc;
+  hidden_options_desc.add_options()
+      ("input-file", po::value<std::vector<std::string>>()->required(),
+       "input file")
+      ;
+
+  po::options_description options_desc;
+  options_desc.add(generic_options_desc).add(hidden_options_desc);
+
+  po::positional_options_description positional_options_desc;
+  positional_options_desc.add("input-file", -1);
+
+  po::variables_map vm;
+  midiaud::BenchmarkSettings settings;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(options_desc)
+              .positional(positional_options_desc)
+              .run(), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+    settings.sample_rate = vm["sample-rate"].as<jack_nframes_t>();
+    settings.buffer_sizes =
+        parse_buffer_sizes(vm["buffer-sizes"].as<std::string>());
+    settings.repeat = vm["repeat"].as<int>();
+    if (settings.sample_rate == 0 || settings.repeat < 1)
+      throw std::invalid_argument("sample rate and repeat must be positive");
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  std::cout << std::left << std::setw(24) << "FILE" << std::right
+            << std::setw(7) << "PERIOD" << std::setw(11) << "PATH"
+            << std::setw(9) << "CYCLES" << std::setw(9) << "EVENTS"
+            << std::setw(9) << "NS/IDLE" << std::setw(10) << "NS/EVENT"
+            << "\n";
+  int status = 0;
+  const std::vector<std::string> &input_files =
+      vm["input-file"].as<std::vector<std::string>>();
+  for (const std::string &input_file : input_files) {
+    try {
+      for (const midiaud::BenchmarkResult &result
+               : midiaud::BenchmarkFile(input_file, settings))
+        print_result(input_file, result);
+    } catch (std::exception &e) {
+      std::cerr << input_file << ": " << e.what() << "\n";
+      status = 1;
+    }
+  }
+
+  // The clock is checked under tempo scale changes, every clock off
+  // its frame fails the run.
+  std::cout << "\n" << std::left << std::setw(24) << "FILE" << std::right
+            << std::setw(7) << "PERIOD" << std::setw(9) << "CLOCKS"
+            << std::setw(9) << "MISSING" << std::setw(7) << "EXTRA"
+            << std::setw(11) << "MAXDEV/FR" << std::setw(10) << "NS/CLOCK"
+            << "\n";
+  for (const std::string &input_file : input_files) {
+    try {
+      for (const midiaud::ClockBenchmarkResult &result
+               : midiaud::BenchmarkClock(input_file, settings)) {
+        print_clock_result(input_file, result);
+        if (result.missing_clocks != 0 || result.extra_clocks != 0
+            || result.max_deviation_frames != 0)
+          status = 1;
+      }
+    } catch (std::exception &e) {
+      std::cerr << input_file << ": " << e.what() << "\n";
+      status = 1;
+    }
+  }
+  return status;
+}
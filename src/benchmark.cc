@@ -0,0 +1,316 @@
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#include "active_notes.h"
+#include "event.h"
+#include "midi_clock.h"
+#include "midi_sink.h"
+#include "playback_control.h"
+#include "smf_reader-inl.h"
+#include "smf_streamer.h"
+#include "timebase/tempo_map.h"
+#include "timebase/time_scale.h"
+
+namespace midiaud {
+
+namespace {
+
+/**
+ * Tempo scales the clock benchmark cycles through, one every
+ * kScaleChangeSeconds of transport time.
+ */
+constexpr double kClockScales[] = {1.13, 0.87, 0.5, 1.71, 1};
+constexpr double kScaleChangeSeconds = 2;
+
+/**
+ * Stores the events of a cycle like the buffer of a Jack MIDI port:
+ * headers from the front, bytes from the back. Events that are out of
+ * order, past the end of the period or do not fit are rejected.
+ */
+class PortBufferSink : public MidiSink {
+ public:
+  /**
+   * Size of a MIDI port buffer of Jack 2.
+   */
+  static constexpr size_t kBufferBytes = 32768;
+
+  PortBufferSink(jack_nframes_t nframes, jack_nframes_t framerate,
+                 ActiveNotes &active_notes) noexcept
+      : MidiSink(framerate, active_notes), nframes_(nframes),
+        header_end_(0), data_begin_(kBufferBytes), last_time_(0) {
+  }
+
+ protected:
+  RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                      size_t size) noexcept override {
+    uint8_t *destination = Reserve(offset, size);
+    if (destination == nullptr) return RtStatus::kPortBufferFull;
+    std::memcpy(destination, data, size);
+    return RtStatus::kOk;
+  }
+
+  size_t WriteEvents(const jack_nframes_t *offsets,
+                     const uint32_t *data_offsets, const uint8_t *bytes,
+                     size_t count, RtStatus &status) noexcept override {
+    for (size_t i = 0; i < count; ++i) {
+      size_t size = data_offsets[i + 1] - data_offsets[i];
+      uint8_t *destination = Reserve(offsets[i], size);
+      if (destination == nullptr) {
+        status = RtStatus::kPortBufferFull;
+        return i;
+      }
+      std::memcpy(destination, bytes + data_offsets[i], size);
+    }
+    return count;
+  }
+
+ private:
+  struct Header {
+    uint32_t time;
+    uint32_t size;
+    uint32_t data_offset;
+  };
+
+  uint8_t *Reserve(jack_nframes_t time, size_t size) noexcept {
+    if (time >= nframes_ || time < last_time_) return nullptr;
+    if (data_begin_ - header_end_ < sizeof(Header) + size) return nullptr;
+    data_begin_ -= size;
+    Header header{time, static_cast<uint32_t>(size),
+                  static_cast<uint32_t>(data_begin_)};
+    std::memcpy(buffer_ + header_end_, &header, sizeof(header));
+    header_end_ += sizeof(header);
+    last_time_ = time;
+    return buffer_ + data_begin_;
+  }
+
+  jack_nframes_t nframes_;
+  size_t header_end_;
+  size_t data_begin_;
+  jack_nframes_t last_time_;
+  uint8_t buffer_[kBufferBytes];
+};
+
+/**
+ * Collects the transport frames of the MIDI clocks of a cycle.
+ */
+class ClockSink : public MidiSink {
+ public:
+  ClockSink(jack_nframes_t cycle_start, jack_nframes_t framerate,
+            ActiveNotes &active_notes,
+            std::vector<long long> &clock_frames) noexcept
+      : MidiSink(framerate, active_notes), cycle_start_(cycle_start),
+        clock_frames_(clock_frames) {
+  }
+
+ protected:
+  RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                      size_t size) noexcept override {
+    if (size == 1 && data[0] == 0xf8)
+      clock_frames_.push_back(static_cast<long long>(cycle_start_) + offset);
+    return RtStatus::kOk;
+  }
+
+ private:
+  jack_nframes_t cycle_start_;
+  std::vector<long long> &clock_frames_;
+};
+
+/**
+ * A stretch of transport time played at one tempo scale.
+ */
+struct ScaleSegment {
+  double transport_seconds;
+  double file_seconds;
+  double scale;
+};
+
+/**
+ * Plays the clock of `tempo_map` until the transport reaches
+ * `file_end_seconds` of file time, changing the scale at the first
+ * cycle after every kScaleChangeSeconds. Returns the frames the clocks
+ * were written at, the segments of the scales in `segments` and the
+ * frame after the last cycle in `end_frame`.
+ */
+std::vector<long long> PlayClock(const timebase::TempoMap &tempo_map,
+                                 double file_end_seconds,
+                                 jack_nframes_t buffer_size,
+                                 jack_nframes_t sample_rate,
+                                 size_t expected_clocks,
+                                 std::vector<ScaleSegment> &segments,
+                                 long long &end_frame, double &seconds) {
+  MidiClock midi_clock;
+  timebase::TimeScale time_scale;
+  ActiveNotes active_notes;
+  std::vector<long long> clock_frames;
+  // Room for the clocks of the last cycle and a few strays, so that
+  // the vector does not grow while the clock is timed.
+  clock_frames.reserve(expected_clocks + 1024);
+  segments.assign(1, ScaleSegment{0, 0, 1});
+  size_t scale_changes = 0;
+  seconds = 0;
+  double framerate = sample_rate;
+
+  for (jack_nframes_t frame = 0; ; frame += buffer_size) {
+    double start_seconds = frame / framerate;
+    const ScaleSegment &segment = segments.back();
+    double file_seconds = segment.file_seconds
+        + (start_seconds - segment.transport_seconds) * segment.scale;
+    end_frame = frame;
+    if (file_seconds >= file_end_seconds) break;
+    // Like a "tempo" command, applied at the start of a cycle.
+    if (start_seconds >= (scale_changes + 1) * kScaleChangeSeconds) {
+      double scale = kClockScales[scale_changes
+          % (sizeof(kClockScales) / sizeof(kClockScales[0]))];
+      ++scale_changes;
+      time_scale.SetScale(scale, start_seconds);
+      segments.push_back({start_seconds, file_seconds, scale});
+    }
+    ClockSink sink(frame, sample_rate, active_notes, clock_frames);
+    auto cycle_start = std::chrono::steady_clock::now();
+    midi_clock.Process(true, frame, buffer_size, tempo_map, time_scale,
+                       sink);
+    std::chrono::duration<double> cycle_duration =
+        std::chrono::steady_clock::now() - cycle_start;
+    seconds += cycle_duration.count();
+  }
+  return clock_frames;
+}
+
+/**
+ * Plays a copy of `smf_streamer` from the start to the end, like
+ * RenderFile() does.
+ */
+BenchmarkResult PlayFile(SmfStreamer smf_streamer,
+                         jack_nframes_t buffer_size,
+                         jack_nframes_t sample_rate) {
+  timebase::TimeScale time_scale;
+  PlaybackControls controls;
+  ActiveNotes active_notes;
+  BenchmarkResult result{buffer_size, false, 0, 0, 0, 0, 0};
+  double framerate = sample_rate;
+
+  smf_streamer.Reposition(0, time_scale);
+  for (jack_nframes_t frame = 0; !smf_streamer.finished();
+       frame += buffer_size) {
+    auto cycle_start = std::chrono::steady_clock::now();
+    PortBufferSink sink(buffer_size, sample_rate, active_notes);
+    smf_streamer.StopIfNeeded(true, sink);
+    smf_streamer.CopyToSink(frame / framerate,
+                            (frame + buffer_size) / framerate,
+                            time_scale, controls, sink);
+    std::chrono::duration<double> cycle_duration =
+        std::chrono::steady_clock::now() - cycle_start;
+    ++result.cycles;
+    result.events += sink.events_written();
+    result.total_seconds += cycle_duration.count();
+    if (sink.events_written() == 0) {
+      ++result.idle_cycles;
+      result.idle_seconds += cycle_duration.count();
+    }
+  }
+  return result;
+}
+
+}
+
+std::vector<BenchmarkResult> BenchmarkFile(
+    const std::string &input_file, const BenchmarkSettings &settings) {
+  SmfStreamer tempo_map_streamer(input_file);
+  // Copies share the events, only this one gets the frame layout.
+  SmfStreamer prerendered_streamer = tempo_map_streamer;
+  prerendered_streamer.Prerender(settings.sample_rate);
+
+  std::vector<BenchmarkResult> results;
+  for (jack_nframes_t buffer_size : settings.buffer_sizes) {
+    for (const SmfStreamer *smf_streamer
+             : {&tempo_map_streamer, &prerendered_streamer}) {
+      BenchmarkResult best{};
+      for (int i = 0; i < settings.repeat; ++i) {
+        BenchmarkResult run = PlayFile(*smf_streamer, buffer_size,
+                                       settings.sample_rate);
+        if (i == 0 || run.total_seconds < best.total_seconds) best = run;
+      }
+      best.prerendered = smf_streamer == &prerendered_streamer;
+      results.push_back(best);
+    }
+  }
+  return results;
+}
+
+std::vector<ClockBenchmarkResult> BenchmarkClock(
+    const std::string &input_file, const BenchmarkSettings &settings) {
+  timebase::TimeDivision division;
+  std::vector<Event> events;
+  ReadStandardMidiFile(input_file, std::back_inserter(events), division);
+  timebase::TempoMap tempo_map(division);
+  for (const Event &event : events) {
+    if (timebase::TempoMap::IsTempoEvent(event))
+      tempo_map.AcknowledgeEvent(event);
+  }
+  double file_end_seconds = 0;
+  for (const Event &event : events) {
+    file_end_seconds = std::max(
+        file_end_seconds, tempo_map.GetTicks(event.ticks()).seconds());
+  }
+  double ticks_per_clock = tempo_map.ppqn() / MidiClock::kClocksPerQuarter;
+  size_t file_clocks = static_cast<size_t>(
+      tempo_map.GetSeconds(file_end_seconds).ticks() / ticks_per_clock);
+
+  std::vector<ClockBenchmarkResult> results;
+  for (jack_nframes_t buffer_size : settings.buffer_sizes) {
+    ClockBenchmarkResult best{};
+    for (int i = 0; i < settings.repeat; ++i) {
+      std::vector<ScaleSegment> segments;
+      long long end_frame;
+      double seconds;
+      std::vector<long long> clock_frames = PlayClock(
+          tempo_map, file_end_seconds, buffer_size, settings.sample_rate,
+          file_clocks, segments, end_frame, seconds);
+      if (i > 0 && seconds >= best.total_seconds) continue;
+
+      ClockBenchmarkResult run{buffer_size, clock_frames.size(), 0, 0, 0,
+                               seconds};
+      // Every clock is due where its file time falls in the stretch
+      // of transport time that played it.
+      size_t segment = 0;
+      size_t due_clocks = 0;
+      for (uint64_t clock = 0; ; ++clock) {
+        double file_seconds =
+            tempo_map.GetTicks(clock * ticks_per_clock).seconds();
+        while (segment + 1 < segments.size()
+               && segments[segment + 1].file_seconds <= file_seconds)
+          ++segment;
+        const ScaleSegment &scale_segment = segments[segment];
+        double transport_seconds = scale_segment.transport_seconds
+            + (file_seconds - scale_segment.file_seconds)
+            / scale_segment.scale;
+        long long due_frame = std::llround(transport_seconds
+                                           * settings.sample_rate);
+        if (due_frame >= end_frame) break;
+        if (due_clocks < clock_frames.size()) {
+          run.max_deviation_frames = std::max(
+              run.max_deviation_frames,
+              std::llabs(clock_frames[due_clocks] - due_frame));
+        }
+        ++due_clocks;
+      }
+      if (clock_frames.size() < due_clocks)
+        run.missing_clocks = due_clocks - clock_frames.size();
+      else
+        run.extra_clocks = clock_frames.size() - due_clocks;
+      best = run;
+    }
+    results.push_back(best);
+  }
+  return results;
+}
+
+}
@@ -0,0 +1,120 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+
+namespace midiaud {
+
+/**
+ * Periods and repetitions to time a file with.
+ */
+struct BenchmarkSettings {
+  jack_nframes_t sample_rate;
+  std::vector<jack_nframes_t> buffer_sizes;
+  /**
+   * Every measurement is repeated this many times and the fastest run
+   * is kept.
+   */
+  int repeat;
+};
+
+/**
+ * Cost of playing a file through one way of copying events at one
+ * buffer size.
+ */
+struct BenchmarkResult {
+  jack_nframes_t buffer_size;
+  /**
+   * Whether the file was played from its prerendered frames instead
+   * of through the tempo map.
+   */
+  bool prerendered;
+  size_t cycles;
+  size_t events;
+  double total_seconds;
+  /**
+   * Cycles that wrote no events and the time they took, which is the
+   * fixed cost of a cycle.
+   */
+  size_t idle_cycles;
+  double idle_seconds;
+
+  /**
+   * Mean time of a cycle that writes no events.
+   */
+  double IdleCycleSeconds() const {
+    return idle_cycles > 0 ? idle_seconds / idle_cycles : 0;
+  }
+  /**
+   * Time every written event adds to its cycle, on average. Without
+   * idle cycles, the fixed cost is counted with the events.
+   */
+  double EventSeconds() const {
+    return events > 0
+        ? (total_seconds - cycles * IdleCycleSeconds()) / events : 0;
+  }
+};
+
+/**
+ * Plays `input_file` from start to end through the same SmfStreamer
+ * calls as the process callback, once through the tempo map and once
+ * prerendered for every buffer size, and times the cycles.
+ *
+ * Events are stored into a buffer laid out and checked like the
+ * buffer of a Jack MIDI port, thus the results include the cost of
+ * the sink but not that of the Jack server.
+ *
+ * @throws std::runtime_error if the file cannot be read.
+ */
+std::vector<BenchmarkResult> BenchmarkFile(
+    const std::string &input_file, const BenchmarkSettings &settings);
+
+/**
+ * Timing of the MIDI clock generated over the tempo map of a file at
+ * one buffer size.
+ */
+struct ClockBenchmarkResult {
+  jack_nframes_t buffer_size;
+  size_t clocks;
+  /**
+   * Clocks that were due but not written, or written but not due.
+   */
+  size_t missing_clocks;
+  size_t extra_clocks;
+  /**
+   * Largest distance of a clock from the frame its musical position
+   * falls on, rounded to the nearest frame. Anything but 0 is jitter.
+   */
+  long long max_deviation_frames;
+  /**
+   * Time spent in MidiClock::Process().
+   */
+  double total_seconds;
+
+  /**
+   * Mean time of a clock, including the cycles without one.
+   */
+  double ClockSeconds() const {
+    return clocks > 0 ? total_seconds / clocks : 0;
+  }
+};
+
+/**
+ * Runs MidiClock::Process() over the tempo map of `input_file` from
+ * the start to the end of the file for every buffer size, while the
+ * tempo scale is changed every few seconds like by the "tempo"
+ * control command, and compares the frames of the clocks with the
+ * frames their musical positions fall on.
+ *
+ * @throws std::runtime_error if the file cannot be read.
+ */
+std::vector<ClockBenchmarkResult> BenchmarkClock(
+    const std::string &input_file, const BenchmarkSettings &settings);
+
+}
+
+#endif // BENCHMARK_H_
@@ -0,0 +1,72 @@
+
+#include "chase_state.h"
+
+namespace midiaud {
+
+namespace {
+
+constexpr uint8_t kResetAllControllers = 121;
+
+}
+
+constexpr uint8_t ChaseState::kUnset;
+constexpr uint16_t ChaseState::kUnsetPitch;
+
+void ChaseState::Clear() noexcept {
+  for (auto &channel_controls : controls_) channel_controls.fill(kUnset);
+  programs_.fill(kUnset);
+  pressures_.fill(kUnset);
+  pitches_.fill(kUnsetPitch);
+}
+
+void ChaseState::Acknowledge(const uint8_t *data, size_t size) noexcept {
+  if (size < 2) return;
+  uint8_t type = data[0] & 0xf0;
+  uint8_t channel = data[0] & 0x0f;
+  switch (type) {
+    case 0xb0:
+      if (size < 3) return;
+      if (data[1] == kResetAllControllers) {
+        controls_[channel].fill(kUnset);
+        pressures_[channel] = kUnset;
+        pitches_[channel] = kUnsetPitch;
+      } else if (IsChased(data[1])) {
+        controls_[channel][data[1]] = data[2] & 0x7f;
+      }
+      break;
+    case 0xc0:
+      programs_[channel] = data[1] & 0x7f;
+      break;
+    case 0xd0:
+      pressures_[channel] = data[1] & 0x7f;
+      break;
+    case 0xe0:
+      if (size < 3) return;
+      pitches_[channel] = (data[1] & 0x7f) | ((data[2] & 0x7f) << 7);
+      break;
+    default:
+      break;
+  }
+}
+
+RtStatus ChaseState::WriteToSink(const PlaybackControls &controls,
+                                 MidiSink &sink) const noexcept {
+  RtStatus status = RtStatus::kOk;
+  ForEachMessage([&](const uint8_t *data, size_t size) {
+    uint8_t scratch[3];
+    const uint8_t *filtered = controls.Filter(data, size, scratch);
+    if (filtered == nullptr) return;
+    RtStatus write_status = sink.WriteMidi(0, filtered, size);
+    if (status == RtStatus::kOk) status = write_status;
+  });
+  return status;
+}
+
+bool ChaseState::IsChased(uint8_t control) noexcept {
+  // Data entry MSB/LSB, increment/decrement and (N)RPN numbers, then
+  // the channel mode messages.
+  return control != 6 && control != 38 && (control < 96 || control > 101)
+      && control < 120;
+}
+
+}
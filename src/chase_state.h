@@ -0,0 +1,88 @@
+#ifndef CHASE_STATE_H_
+#define CHASE_STATE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "midi_sink.h"
+#include "playback_control.h"
+#include "rt_status.h"
+
+namespace midiaud {
+
+/**
+ * The controllers, programs, channel pressures and pitch wheels set
+ * by the events before a position of the file, so that they can be
+ * restored when playback starts there.
+ *
+ * Data entry, increment, decrement and (N)RPN selection controllers
+ * are not chased, because their meaning depends on the order they
+ * were sent in. Neither are the channel mode messages.
+ */
+class ChaseState {
+ public:
+  ChaseState() { Clear(); }
+
+  void Clear() noexcept;
+  /**
+   * Updates the state with a message of the file. Everything but the
+   * chased channel messages is ignored.
+   */
+  void Acknowledge(const uint8_t *data, size_t size) noexcept;
+  /**
+   * Calls `function(data, size)` with a message for every value that
+   * was set. Controllers go first, so that bank selects precede the
+   * program changes.
+   */
+  template <typename Function>
+  void ForEachMessage(Function function) const {
+    for (uint8_t channel = 0; channel < 16; ++channel) {
+      for (uint8_t control = 0; control < 128; ++control) {
+        uint8_t value = controls_[channel][control];
+        if (value == kUnset) continue;
+        uint8_t message[3] = {static_cast<uint8_t>(0xb0 | channel),
+                              control, value};
+        function(message, 3);
+      }
+      if (programs_[channel] != kUnset) {
+        uint8_t message[2] = {static_cast<uint8_t>(0xc0 | channel),
+                              programs_[channel]};
+        function(message, 2);
+      }
+      if (pressures_[channel] != kUnset) {
+        uint8_t message[2] = {static_cast<uint8_t>(0xd0 | channel),
+                              pressures_[channel]};
+        function(message, 2);
+      }
+      if (pitches_[channel] != kUnsetPitch) {
+        uint8_t message[3] = {
+          static_cast<uint8_t>(0xe0 | channel),
+          static_cast<uint8_t>(pitches_[channel] & 0x7f),
+          static_cast<uint8_t>((pitches_[channel] >> 7) & 0x7f)};
+        function(message, 3);
+      }
+    }
+  }
+  /**
+   * Writes every value that was set at the start of the cycle, passing
+   * them through `controls` like the events of the file.
+   */
+  RtStatus WriteToSink(const PlaybackControls &controls,
+                       MidiSink &sink) const noexcept;
+
+ private:
+  static constexpr uint8_t kUnset = 0xff;
+  static constexpr uint16_t kUnsetPitch = 0xffff;
+
+  static bool IsChased(uint8_t control) noexcept;
+
+  std::array<std::array<uint8_t, 128>, 16> controls_;
+  std::array<uint8_t, 16> programs_;
+  std::array<uint8_t, 16> pressures_;
+  std::array<uint16_t, 16> pitches_;
+};
+
+}
+
+#endif // CHASE_STATE_H_
@@ -0,0 +1,52 @@
+
+#include "control_benchmark.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "control_socket.h"
+
+namespace midiaud {
+
+LatencySummary BenchmarkControlSocket(size_t pings) {
+  std::string socket_path = "/tmp/midiaud-stress-"
+      + std::to_string(getpid()) + ".sock";
+  ControlServer server(socket_path, [](const std::string &command) {
+    return command == "ping" ? std::string("ok")
+                             : "error unknown command " + command;
+  });
+  std::atomic<bool> done{false};
+  std::thread server_thread([&]() {
+    // The same timeout as the main loop of midiaud.
+    while (!done.load()) server.Poll(10);
+  });
+
+  std::vector<double> seconds;
+  seconds.reserve(pings);
+  try {
+    for (size_t i = 0; i < pings; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      std::string reply = SendControlCommand(socket_path, "ping");
+      std::chrono::duration<double> round_trip =
+          std::chrono::steady_clock::now() - start;
+      if (reply != "ok")
+        throw std::runtime_error("unexpected reply " + reply);
+      seconds.push_back(round_trip.count());
+    }
+  } catch (...) {
+    done.store(true);
+    server_thread.join();
+    throw;
+  }
+  done.store(true);
+  server_thread.join();
+  return SummarizeLatencies(seconds);
+}
+
+}
@@ -0,0 +1,23 @@
+#ifndef CONTROL_BENCHMARK_H_
+#define CONTROL_BENCHMARK_H_
+
+#include <cstddef>
+
+#include "lockfree_stress.h"
+
+namespace midiaud {
+
+/**
+ * Starts a ControlServer in this process, polled from a thread of its
+ * own like the main loop of midiaud polls it, and measures the time
+ * SendControlCommand() takes for `pings` pings, each on a connection
+ * of its own like midiaud-ctl makes.
+ *
+ * @throws std::runtime_error if the socket cannot be created or a ping
+ *         fails.
+ */
+LatencySummary BenchmarkControlSocket(size_t pings);
+
+}
+
+#endif // CONTROL_BENCHMARK_H_
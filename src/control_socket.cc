@@ -0,0 +1,186 @@
+
+#include "control_socket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace midiaud {
+
+namespace {
+
+constexpr size_t kMaxCommandLength = 4096;
+
+sockaddr_un MakeAddress(const std::string &socket_path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("control socket path is too long");
+  std::strncpy(address.sun_path, socket_path.c_str(),
+               sizeof(address.sun_path) - 1);
+  return address;
+}
+
+bool WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = send(fd, data.data() + written,
+                          data.size() - written, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+}
+
+ControlServer::ControlServer(const std::string &socket_path,
+                             Handler handler)
+    : socket_path_(socket_path), handler_(std::move(handler)),
+      listen_fd_(-1) {
+  sockaddr_un address = MakeAddress(socket_path_);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      0);
+  if (listen_fd_ < 0)
+    throw std::runtime_error("socket failed");
+  // A stale socket left behind by a crashed instance would make bind
+  // fail. Anything else at the path is not ours to remove.
+  struct stat status;
+  if (lstat(socket_path_.c_str(), &status) == 0) {
+    if (!S_ISSOCK(status.st_mode)) {
+      close(listen_fd_);
+      throw std::runtime_error(socket_path_ + " exists and is not a socket");
+    }
+    unlink(socket_path_.c_str());
+  }
+  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0) {
+    close(listen_fd_);
+    throw std::runtime_error("bind failed for control socket");
+  }
+  if (listen(listen_fd_, 8) != 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+    throw std::runtime_error("listen failed for control socket");
+  }
+}
+
+ControlServer::~ControlServer() {
+  for (Client &client : clients_)
+    close(client.fd);
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void ControlServer::Poll(int timeout_milliseconds) {
+  std::vector<pollfd> fds;
+  fds.reserve(clients_.size() + 1);
+  fds.push_back({listen_fd_, POLLIN, 0});
+  for (const Client &client : clients_)
+    fds.push_back({client.fd, POLLIN, 0});
+
+  int ready = poll(fds.data(), fds.size(), timeout_milliseconds);
+  if (ready < 0) {
+    if (errno == EINTR) return;
+    throw std::runtime_error("poll failed on control socket");
+  }
+  if (ready == 0) return;
+
+  // Serve existing clients before accepting new ones, so that fds
+  // and clients_ stay in sync.
+  size_t kept = 0;
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    bool keep = true;
+    if (fds[i + 1].revents != 0) keep = Serve(clients_[i]);
+    if (keep) {
+      clients_[kept++] = std::move(clients_[i]);
+    } else {
+      close(clients_[i].fd);
+    }
+  }
+  clients_.resize(kept);
+
+  if (fds[0].revents & POLLIN) Accept();
+}
+
+void ControlServer::Accept() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    clients_.push_back({fd, std::string()});
+  }
+}
+
+bool ControlServer::Serve(Client &client) {
+  char chunk[512];
+  for (;;) {
+    ssize_t result = recv(client.fd, chunk, sizeof(chunk), 0);
+    if (result == 0) return false;
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    client.buffer.append(chunk, result);
+  }
+
+  std::string::size_type newline;
+  while ((newline = client.buffer.find('\n')) != std::string::npos) {
+    std::string command(client.buffer, 0, newline);
+    client.buffer.erase(0, newline + 1);
+    std::string reply;
+    try {
+      reply = handler_(command);
+    } catch (std::exception &e) {
+      reply = std::string("error ") + e.what();
+    }
+    if (!WriteAll(client.fd, reply + "\n")) return false;
+  }
+  return client.buffer.size() <= kMaxCommandLength;
+}
+
+std::string SendControlCommand(const std::string &socket_path,
+                               const std::string &command) {
+  sockaddr_un address = MakeAddress(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    throw std::runtime_error("socket failed");
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    throw std::runtime_error("cannot connect to " + socket_path);
+  }
+  if (!WriteAll(fd, command + "\n")) {
+    close(fd);
+    throw std::runtime_error("cannot send command");
+  }
+  std::string reply;
+  char chunk[512];
+  while (reply.find('\n') == std::string::npos) {
+    ssize_t result = recv(fd, chunk, sizeof(chunk), 0);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) {
+      close(fd);
+      throw std::runtime_error("connection closed before reply");
+    }
+    reply.append(chunk, result);
+  }
+  close(fd);
+  reply.erase(reply.find('\n'));
+  return reply;
+}
+
+}
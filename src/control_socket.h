@@ -0,0 +1,65 @@
+#ifndef CONTROL_SOCKET_H_
+#define CONTROL_SOCKET_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace midiaud {
+
+/**
+ * Line-based command server on a Unix domain socket.
+ *
+ * Every line received from a client is a command. It is passed to the
+ * handler, and the handler's return value is sent back as a single
+ * line. Exceptions thrown by the handler are reported to the client
+ * as "error <message>" instead of being propagated.
+ *
+ * The server is meant to be polled from the main thread, it never
+ * starts threads on its own.
+ */
+class ControlServer {
+ public:
+  typedef std::function<std::string(const std::string &)> Handler;
+
+  ControlServer(const std::string &socket_path, Handler handler);
+  ControlServer(const ControlServer &) = delete;
+  ~ControlServer();
+  ControlServer &operator=(const ControlServer &) = delete;
+
+  /**
+   * Waits at most `timeout_milliseconds` for commands and serves the
+   * ones that have arrived.
+   */
+  void Poll(int timeout_milliseconds);
+
+  const std::string &socket_path() const { return socket_path_; }
+
+ private:
+  struct Client {
+    int fd;
+    std::string buffer;
+  };
+
+  void Accept();
+  /**
+   * Returns false if the client has to be dropped.
+   */
+  bool Serve(Client &client);
+
+  std::string socket_path_;
+  Handler handler_;
+  int listen_fd_;
+  std::vector<Client> clients_;
+};
+
+/**
+ * Sends `command` to the server listening on `socket_path` and
+ * returns its reply without the trailing newline.
+ */
+std::string SendControlCommand(const std::string &socket_path,
+                               const std::string &command);
+
+}
+
+#endif // CONTROL_SOCKET_H_
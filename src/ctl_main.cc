@@ -0,0 +1,95 @@
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "control_socket.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options] command [arguments]\n"
+            << "\n"
+            << "Commands:\n"
+            << "  ping\n"
+            << "  load FILE\n"
+            << "  unload\n"
+            << "  seek FRAME\n"
+            << "  cue NAME|NUMBER\n"
+            << "  connect PORT\n"
+            << "  disconnect PORT\n"
+            << "  master on|conditional|off\n"
+            << "  mute CHANNELS|all|none\n"
+            << "  solo CHANNELS|all|none\n"
+            << "  loop on|off\n"
+            << "  gain FACTOR\n"
+            << "  tempo FACTOR\n"
+            << "  panic\n"
+            << "  stats\n\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("socket,s", po::value<std::string>()->required(),
+       "control socket of the midiaud instance")
+      ("time,t", "print the command round-trip time")
+      ;
+
+  po::options_description hidden_options_desc;
+  hidden_options_desc.add_options()
+      ("command", po::value<std::vector<std::string>>()->required(),
+       "command")
+      ;
+
+  po::options_description options_desc;
+  options_desc.add(generic_options_desc).add(hidden_options_desc);
+
+  po::positional_options_description positional_options_desc;
+  positional_options_desc.add("command", -1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(options_desc)
+              .positional(positional_options_desc)
+              .run(), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  std::string command;
+  for (const std::string &word : vm["command"].as<std::vector<std::string>>()) {
+    if (!command.empty()) command += ' ';
+    command += word;
+  }
+
+  try {
+    auto start = std::chrono::steady_clock::now();
+    std::string reply = midiaud::SendControlCommand(
+        vm["socket"].as<std::string>(), command);
+    std::chrono::duration<double, std::micro> round_trip =
+        std::chrono::steady_clock::now() - start;
+    std::cout << reply << "\n";
+    if (vm.count("time") > 0)
+      std::cerr << "Round trip: " << round_trip.count() << " us\n";
+    return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return -1;
+  }
+}
@@ -0,0 +1,167 @@
+
+#include "cycle_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace midiaud {
+
+namespace {
+
+constexpr char kTraceMagic[8] = {'M', 'I', 'D', 'I', 'A', 'U', 'D', 'T'};
+
+}
+
+CycleTraceWriter::CycleTraceWriter(const std::string &filename)
+    : output_(filename, std::ios::binary | std::ios::trunc),
+      lost_records_(0), stop_(false), last_load_id_(0) {
+  if (!output_)
+    throw std::runtime_error("cannot open " + filename);
+  output_.write(kTraceMagic, sizeof(kTraceMagic));
+  thread_ = std::thread(&CycleTraceWriter::Run, this);
+}
+
+CycleTraceWriter::~CycleTraceWriter() {
+  try {
+    Close();
+  } catch (...) {
+  }
+}
+
+void CycleTraceWriter::Close() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_one();
+  thread_.join();
+
+  TraceRecord lost{TraceRecordType::kLost, 0, 0, 0, 0, 0,
+                   lost_records_.load(std::memory_order_relaxed)};
+  output_.write(reinterpret_cast<const char *>(&lost), sizeof(lost));
+  output_.close();
+  if (!output_)
+    throw std::runtime_error("cannot write cycle trace");
+}
+
+uint32_t CycleTraceWriter::RecordLoad(const std::string &filename,
+                                      bool streaming,
+                                      jack_nframes_t prerendered_rate) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t load_id = ++last_load_id_;
+  pending_loads_.push_back({load_id, filename, streaming, prerendered_rate});
+  return load_id;
+}
+
+void CycleTraceWriter::RecordProcess(jack_transport_state_t state,
+                                     jack_nframes_t frame,
+                                     jack_nframes_t nframes,
+                                     jack_nframes_t frame_rate,
+                                     jack_nframes_t latency,
+                                     size_t setup_budget) noexcept {
+  Push({TraceRecordType::kProcess, static_cast<uint8_t>(state),
+        static_cast<uint16_t>(std::min<size_t>(setup_budget, UINT16_MAX)),
+        frame, nframes, frame_rate, latency});
+}
+
+void CycleTraceWriter::RecordSync(jack_transport_state_t state,
+                                  jack_nframes_t frame,
+                                  jack_nframes_t frame_rate,
+                                  bool ready) noexcept {
+  Push({TraceRecordType::kSync, static_cast<uint8_t>(state),
+        static_cast<uint16_t>(ready ? 1 : 0), frame, 0, frame_rate, 0});
+}
+
+void CycleTraceWriter::RecordReload(uint32_t load_id) noexcept {
+  Push({TraceRecordType::kReload, 0, 0, 0, 0, 0, load_id});
+}
+
+void CycleTraceWriter::RecordCommand(const PlaybackCommand &command) noexcept {
+  uint64_t value_bits;
+  std::memcpy(&value_bits, &command.value, sizeof(value_bits));
+  Push({TraceRecordType::kCommand, command.type, command.channels,
+        0, 0, 0, value_bits});
+}
+
+void CycleTraceWriter::RecordEvent(jack_nframes_t offset,
+                                   const uint8_t *data,
+                                   size_t size) noexcept {
+  uint64_t prefix = 0;
+  std::memcpy(&prefix, data, std::min(size, sizeof(prefix)));
+  Push({TraceRecordType::kEvent, 0,
+        static_cast<uint16_t>(std::min<size_t>(size, UINT16_MAX)),
+        offset, 0, 0, prefix});
+}
+
+void CycleTraceWriter::Push(const TraceRecord &record) noexcept {
+  if (!ring_.Push(record))
+    lost_records_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CycleTraceWriter::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    stop_condition_.wait_for(lock, std::chrono::milliseconds{20});
+    lock.unlock();
+    Flush();
+    lock.lock();
+  }
+  lock.unlock();
+  Flush();
+}
+
+void CycleTraceWriter::Flush() {
+  std::vector<TracedLoad> loads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loads.swap(pending_loads_);
+  }
+  for (const auto &load : loads) {
+    TraceRecord record{TraceRecordType::kLoad,
+                       static_cast<uint8_t>(load.streaming ? 1 : 0),
+                       static_cast<uint16_t>(load.filename.size()),
+                       0, 0, load.prerendered_rate, load.load_id};
+    output_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    output_.write(load.filename.data(), record.size);
+  }
+  TraceRecord record;
+  while (ring_.Pop(record))
+    output_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  output_.flush();
+}
+
+CycleTrace ReadCycleTrace(const std::string &filename) {
+  std::ifstream input(filename, std::ios::binary);
+  if (!input)
+    throw std::runtime_error("cannot open " + filename);
+  char magic[sizeof(kTraceMagic)];
+  if (!input.read(magic, sizeof(magic))
+      || std::memcmp(magic, kTraceMagic, sizeof(magic)) != 0)
+    throw std::runtime_error(filename + " is not a cycle trace");
+
+  CycleTrace trace{{}, {}, 0};
+  TraceRecord record;
+  while (input.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    if (record.type == TraceRecordType::kLoad) {
+      std::string load_filename(record.size, '\0');
+      if (!input.read(&load_filename[0], record.size)) break;
+      trace.loads.push_back({static_cast<uint32_t>(record.data),
+                             load_filename, record.state != 0,
+                             record.frame_rate});
+    } else if (record.type == TraceRecordType::kLost) {
+      trace.lost_records += record.data;
+    } else if (record.type <= TraceRecordType::kEvent) {
+      trace.records.push_back(record);
+    } else {
+      throw std::runtime_error(filename + " contains an unknown record");
+    }
+  }
+  if (input.gcount() != 0)
+    throw std::runtime_error(filename + " is truncated");
+  return trace;
+}
+
+}
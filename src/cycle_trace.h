@@ -0,0 +1,177 @@
+#ifndef CYCLE_TRACE_H_
+#define CYCLE_TRACE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <jack/jack.h>
+
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
+#include "playback_control.h"
+
+namespace midiaud {
+
+enum class TraceRecordType : uint8_t {
+  /**
+   * Start of a process cycle: transport state, frame, nframes and
+   * frame rate as returned by jack_transport_query(). `data` is the
+   * latency the output was compensated for, `size` the setup data
+   * budget.
+   */
+  kProcess,
+  /**
+   * Sync callback call: transport state, frame and frame rate. `size`
+   * is 1 if the client was ready to roll.
+   */
+  kSync,
+  /**
+   * The RT thread picked up a new SmfStreamer, `data` is its load id.
+   */
+  kReload,
+  /**
+   * A PlaybackCommand applied in the current cycle: type in `state`,
+   * channels in `size`, the bits of the value in `data`.
+   */
+  kCommand,
+  /**
+   * A MIDI event written to the output: offset in the cycle in
+   * `frame`, full size in `size`, the first 8 bytes in `data`.
+   */
+  kEvent,
+  /**
+   * Main thread loaded a file: load id in `data`, 1 in `state` if it
+   * is streamed, the frame rate it was prerendered for in
+   * `frame_rate` (0 if none), followed by `size` bytes of path in the
+   * trace file.
+   */
+  kLoad,
+  /**
+   * Written at the end of the trace, `data` counts the records that
+   * did not fit into the ring.
+   */
+  kLost
+};
+
+/**
+ * Fixed-size record of the trace, stored in host byte order.
+ */
+struct TraceRecord {
+  TraceRecordType type;
+  uint8_t state;
+  uint16_t size;
+  jack_nframes_t frame;
+  jack_nframes_t nframes;
+  jack_nframes_t frame_rate;
+  uint64_t data;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "unexpected TraceRecord padding");
+
+/**
+ * A file loaded by the main thread.
+ */
+struct TracedLoad {
+  uint32_t load_id;
+  std::string filename; // Empty for unloading.
+  bool streaming;
+  jack_nframes_t prerendered_rate; // 0 if not prerendered.
+};
+
+/**
+ * Captures what the RT thread saw and did in every cycle, so that
+ * the cycles can be replayed offline (see ReplayCycleTrace()).
+ *
+ * The RT thread pushes records into a preallocated lock-free ring
+ * without blocking, a background thread flushes them to the file.
+ * Records that do not fit into the ring are counted and lost.
+ */
+class CycleTraceWriter {
+ public:
+  static constexpr size_t kRingCapacity = 8192;
+
+  /**
+   * Creates the trace file and starts the flushing thread.
+   */
+  explicit CycleTraceWriter(const std::string &filename);
+  CycleTraceWriter(const CycleTraceWriter &) = delete;
+  ~CycleTraceWriter();
+  CycleTraceWriter &operator=(const CycleTraceWriter &) = delete;
+
+  /**
+   * Flushes the remaining records and stops the flushing thread.
+   *
+   * @throws std::runtime_error if the trace could not be written.
+   */
+  void Close();
+
+  /**
+   * Records that `filename` was loaded by the main thread. An empty
+   * name stands for unloading, a `prerendered_rate` of 0 for no
+   * prerendering.
+   *
+   * @returns the load id to be given to the SmfStreamer.
+   */
+  uint32_t RecordLoad(const std::string &filename, bool streaming,
+                      jack_nframes_t prerendered_rate);
+
+  void RecordProcess(jack_transport_state_t state, jack_nframes_t frame,
+                     jack_nframes_t nframes, jack_nframes_t frame_rate,
+                     jack_nframes_t latency, size_t setup_budget) noexcept;
+  void RecordSync(jack_transport_state_t state, jack_nframes_t frame,
+                  jack_nframes_t frame_rate, bool ready) noexcept;
+  void RecordReload(uint32_t load_id) noexcept;
+  void RecordCommand(const PlaybackCommand &command) noexcept;
+  void RecordEvent(jack_nframes_t offset, const uint8_t *data,
+                   size_t size) noexcept;
+
+ private:
+  void Push(const TraceRecord &record) noexcept;
+  void Run();
+  /**
+   * Writes pending loads and records. For the flushing thread.
+   */
+  void Flush();
+
+  std::ofstream output_; // For flushing thread after construction.
+  LockfreeQueue<TraceRecord, kRingCapacity> ring_;
+  std::atomic<size_t> lost_records_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_; // Guarded by mutex_.
+  uint32_t last_load_id_; // Guarded by mutex_.
+  std::vector<TracedLoad> pending_loads_; // Guarded by mutex_.
+  std::thread thread_;
+};
+
+/**
+ * Contents of a trace file.
+ */
+struct CycleTrace {
+  /**
+   * Every record written by the RT thread, in order.
+   */
+  std::vector<TraceRecord> records;
+  /**
+   * Loaded files in the order of their load ids.
+   */
+  std::vector<TracedLoad> loads;
+  size_t lost_records;
+};
+
+/**
+ * @throws std::runtime_error if the file is not a valid trace.
+ */
+CycleTrace ReadCycleTrace(const std::string &filename);
+
+}
+
+#endif // CYCLE_TRACE_H_
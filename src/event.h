@@ -21,6 +21,14 @@ class Event {
     return midi_.size() > 0 && midi_[0] == 0xff;
   }
 
+  bool operator==(const Event &rhs) const {
+    return ticks_ == rhs.ticks_ && midi_ == rhs.midi_;
+  }
+
+  bool operator!=(const Event &rhs) const {
+    return !(*this == rhs);
+  }
+
  private:
   double ticks_;
   MidiBuffer midi_;
@@ -0,0 +1,235 @@
+
+#include "event_prefetcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include "event.h"
+
+namespace midiaud {
+
+namespace {
+
+constexpr size_t kEventHeaderSize = sizeof(double) + sizeof(uint16_t);
+
+}
+
+EventPrefetcher::EventPrefetcher(const std::string &filename)
+    : event_count_(0), decoder_(filename), seek_seconds_(0),
+      seek_generation_(0), stop_(false), oversized_events_(0),
+      generation_(0), requested_seconds_(0), consumed_(false),
+      finished_(false), block_valid_(false), read_offset_(0) {
+  auto tempo_map = std::make_shared<timebase::TempoMap>(
+      decoder_.division());
+  std::vector<Event> markers;
+  ChaseState chase;
+  for (;;) {
+    bool at_checkpoint = event_count_ % kCheckpointInterval == 0;
+    SmfDecoder::Checkpoint checkpoint;
+    if (at_checkpoint) checkpoint = decoder_.Save();
+    if (!decoder_.Next()) break;
+    if (decoder_.is_metadata()) {
+      Event event(decoder_.ticks(), decoder_.data().begin(),
+                  decoder_.data().end());
+      if (timebase::TempoMap::IsTempoEvent(event))
+        tempo_map->AcknowledgeEvent(event);
+      if (MarkerIndex::IsMarkerEvent(event)) markers.push_back(event);
+    }
+    if (at_checkpoint) {
+      index_.push_back({tempo_map->GetTicks(decoder_.ticks()).seconds(),
+                        std::move(checkpoint), chase});
+    }
+    chase.Acknowledge(decoder_.data().data(), decoder_.data().size());
+    ++event_count_;
+  }
+  marker_index_ = std::make_shared<MarkerIndex>(markers, *tempo_map);
+  tempo_map_ = std::move(tempo_map);
+  if (!index_.empty()) decoder_.Restore(index_.front().checkpoint);
+  thread_ = std::thread(&EventPrefetcher::Run, this);
+}
+
+EventPrefetcher::~EventPrefetcher() {
+  stop_.store(true, std::memory_order_relaxed);
+  thread_.join();
+}
+
+void EventPrefetcher::Seek(double file_seconds) noexcept {
+  if (!consumed_ && file_seconds == requested_seconds_) return;
+  requested_seconds_ = file_seconds;
+  consumed_ = false;
+  finished_ = false;
+  block_valid_ = false;
+  ++generation_;
+  seek_seconds_.store(file_seconds, std::memory_order_relaxed);
+  seek_generation_.store(generation_, std::memory_order_release);
+}
+
+bool EventPrefetcher::Peek(PrefetchedEvent &event) noexcept {
+  while (!block_valid_ || read_offset_ >= block_.used) {
+    if (block_valid_ && block_.last) {
+      finished_ = true;
+      return false;
+    }
+    if (!ring_.Pop(block_)) {
+      block_valid_ = false;
+      return false;
+    }
+    // Blocks decoded for an earlier seek are thrown away.
+    block_valid_ = (block_.generation == generation_);
+    read_offset_ = 0;
+  }
+  uint16_t size;
+  std::memcpy(&event.file_seconds, block_.bytes + read_offset_,
+              sizeof(double));
+  std::memcpy(&size, block_.bytes + read_offset_ + sizeof(double),
+              sizeof(size));
+  event.data = block_.bytes + read_offset_ + kEventHeaderSize;
+  event.size = size;
+  return true;
+}
+
+void EventPrefetcher::Pop() noexcept {
+  uint16_t size;
+  std::memcpy(&size, block_.bytes + read_offset_ + sizeof(double),
+              sizeof(size));
+  read_offset_ += kEventHeaderSize + size;
+  consumed_ = true;
+}
+
+bool EventPrefetcher::ready() noexcept {
+  PrefetchedEvent event;
+  return Peek(event) || finished_;
+}
+
+void EventPrefetcher::Run() {
+  uint32_t generation = 0;
+  PrefetchBlock block{generation, 0, false, {}};
+  // The event to be appended next, if it did not fit into the block
+  // yet.
+  bool have_event = false;
+  double event_seconds = 0;
+  const std::vector<uint8_t> *event_data = nullptr;
+  // An event of `decoder_` that is due after the chased messages.
+  bool have_decoded = false;
+  double decoded_seconds = 0;
+  bool at_end = index_.empty();
+  bool sent_last = false;
+  // Events before the sought position are decoded but not streamed,
+  // only chased.
+  double skip_before = 0;
+  ChaseState chase;
+  bool chase_due = false;
+  std::vector<std::vector<uint8_t>> chase_messages;
+  size_t next_chase_message = 0;
+
+  while (!stop_.load(std::memory_order_relaxed)) {
+    uint32_t requested = seek_generation_.load(std::memory_order_acquire);
+    if (requested != generation) {
+      generation = requested;
+      block = PrefetchBlock{generation, 0, false, {}};
+      have_event = false;
+      have_decoded = false;
+      at_end = index_.empty();
+      sent_last = false;
+      skip_before = seek_seconds_.load(std::memory_order_relaxed);
+      chase_messages.clear();
+      next_chase_message = 0;
+      chase_due = !at_end;
+      if (!at_end) {
+        try {
+          SeekDecoder(skip_before, chase);
+        } catch (std::exception &e) {
+          std::cerr << "Warning: prefetching failed: " << e.what()
+                    << std::endl;
+          at_end = true;
+        }
+      }
+    }
+
+    try {
+      while (!at_end) {
+        if (!have_event) {
+          if (next_chase_message < chase_messages.size()) {
+            event_seconds = skip_before;
+            event_data = &chase_messages[next_chase_message++];
+          } else if (have_decoded) {
+            event_seconds = decoded_seconds;
+            event_data = &decoder_.data();
+            have_decoded = false;
+          } else {
+            if (!decoder_.Next()) {
+              at_end = true;
+              break;
+            }
+            if (decoder_.is_metadata()) continue;
+            const std::vector<uint8_t> &data = decoder_.data();
+            decoded_seconds =
+                tempo_map_->GetTicks(decoder_.ticks()).seconds();
+            if (decoded_seconds < skip_before) {
+              chase.Acknowledge(data.data(), data.size());
+              continue;
+            }
+            have_decoded = true;
+            if (chase_due) {
+              chase.ForEachMessage([&](const uint8_t *message, size_t size) {
+                chase_messages.emplace_back(message, message + size);
+              });
+              chase_due = false;
+            }
+            continue;
+          }
+          have_event = true;
+        }
+        if (!Append(block, event_seconds, *event_data)) {
+          if (block.used > 0) break;
+          oversized_events_.fetch_add(1, std::memory_order_relaxed);
+        }
+        have_event = false;
+      }
+    } catch (std::exception &e) {
+      std::cerr << "Warning: prefetching failed: " << e.what() << std::endl;
+      at_end = true;
+      have_event = false;
+    }
+    block.last = at_end && !have_event;
+
+    if ((block.used > 0 || block.last) && !sent_last) {
+      if (ring_.Push(block)) {
+        sent_last = block.last;
+        block = PrefetchBlock{generation, 0, false, {}};
+        continue;
+      }
+    }
+    // The ring is full or everything was sent, the RT thread cannot
+    // signal without risking a block, so poll.
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+}
+
+void EventPrefetcher::SeekDecoder(double file_seconds, ChaseState &chase) {
+  auto entry = std::upper_bound(
+      index_.cbegin() + 1, index_.cend(), file_seconds,
+      [](double seconds, const IndexEntry &entry) {
+        return seconds <= entry.file_seconds;
+      });
+  decoder_.Restore((entry - 1)->checkpoint);
+  chase = (entry - 1)->chase;
+}
+
+bool EventPrefetcher::Append(PrefetchBlock &block, double file_seconds,
+                             const std::vector<uint8_t> &data) noexcept {
+  size_t size = kEventHeaderSize + data.size();
+  if (size > PrefetchBlock::kBytes - block.used) return false;
+  uint16_t data_size = static_cast<uint16_t>(data.size());
+  uint8_t *destination = block.bytes + block.used;
+  std::memcpy(destination, &file_seconds, sizeof(double));
+  std::memcpy(destination + sizeof(double), &data_size, sizeof(data_size));
+  std::memcpy(destination + kEventHeaderSize, data.data(), data.size());
+  block.used += size;
+  return true;
+}
+
+}
@@ -0,0 +1,167 @@
+#ifndef EVENT_PREFETCHER_H_
+#define EVENT_PREFETCHER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chase_state.h"
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
+#include "marker_index.h"
+#include "smf_decoder.h"
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * Events packed back to back, each as file seconds (double), size
+ * (uint16_t) and MIDI bytes.
+ */
+struct PrefetchBlock {
+  static constexpr size_t kBytes = 4096 - 8;
+
+  /**
+   * Seek request this block was decoded for.
+   */
+  uint32_t generation;
+  uint16_t used;
+  /**
+   * Whether the file ends after this block.
+   */
+  bool last;
+  uint8_t bytes[kBytes];
+};
+
+/**
+ * A prefetched event, pointing into the block being consumed.
+ */
+struct PrefetchedEvent {
+  double file_seconds;
+  const uint8_t *data;
+  size_t size;
+};
+
+/**
+ * Streams the events of a Standard MIDI File with constant memory.
+ *
+ * The file is scanned once on construction to build the tempo map
+ * and a coarse index of decoder checkpoints. Then a background thread
+ * decodes ahead of the playhead into a fixed-size lock-free ring of
+ * blocks, which the RT thread consumes. After a seek, the background
+ * thread restarts from the nearest checkpoint before the new
+ * position. The state to chase at each checkpoint is kept in the
+ * index, and the chased messages are streamed at the sought position
+ * before its first event.
+ *
+ * Metaevents are not streamed, and events that do not fit into a
+ * block are dropped.
+ */
+class EventPrefetcher {
+ public:
+  static constexpr size_t kRingBlocks = 32;
+  static constexpr size_t kCheckpointInterval = 4096;
+
+  /**
+   * Indexes `filename` and starts prefetching from its start.
+   *
+   * @throws std::runtime_error if the file cannot be decoded.
+   */
+  explicit EventPrefetcher(const std::string &filename);
+  EventPrefetcher(const EventPrefetcher &) = delete;
+  ~EventPrefetcher();
+  EventPrefetcher &operator=(const EventPrefetcher &) = delete;
+
+  /**
+   * Restarts prefetching from `file_seconds`, unless it is already
+   * being prefetched from there and nothing was consumed since. For RT
+   * thread.
+   */
+  void Seek(double file_seconds) noexcept;
+  /**
+   * Looks at the next event without consuming it. For RT thread.
+   *
+   * @returns false if the file has ended or the ring underran, which
+   *          finished() tells apart.
+   */
+  bool Peek(PrefetchedEvent &event) noexcept;
+  /**
+   * Consumes the event returned by the last successful Peek(). For RT
+   * thread.
+   */
+  void Pop() noexcept;
+  /**
+   * Returns whether the next event or the end of the file is
+   * available. For RT thread.
+   */
+  bool ready() noexcept;
+  bool finished() const { return finished_; }
+
+  const std::shared_ptr<const timebase::TempoMap> &tempo_map() const {
+    return tempo_map_;
+  }
+  const std::shared_ptr<const MarkerIndex> &marker_index() const {
+    return marker_index_;
+  }
+  size_t event_count() const { return event_count_; }
+  /**
+   * Number of events dropped because they did not fit into a block.
+   */
+  size_t oversized_events() const {
+    return oversized_events_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct IndexEntry {
+    double file_seconds;
+    SmfDecoder::Checkpoint checkpoint;
+    /**
+     * State set by the events before the checkpoint.
+     */
+    ChaseState chase;
+  };
+
+  void Run();
+  /**
+   * Positions `decoder_` at the checkpoint before `file_seconds` and
+   * sets `chase` to the state there. For background thread.
+   */
+  void SeekDecoder(double file_seconds, ChaseState &chase);
+  /**
+   * Returns whether the event was appended to `block`. For background
+   * thread.
+   */
+  bool Append(PrefetchBlock &block, double file_seconds,
+              const std::vector<uint8_t> &data) noexcept;
+
+  // Immutable after construction.
+  std::shared_ptr<const timebase::TempoMap> tempo_map_;
+  std::shared_ptr<const MarkerIndex> marker_index_;
+  std::vector<IndexEntry> index_;
+  size_t event_count_;
+
+  SmfDecoder decoder_; // For background thread after construction.
+  LockfreeQueue<PrefetchBlock, kRingBlocks> ring_;
+  std::atomic<double> seek_seconds_;
+  std::atomic<uint32_t> seek_generation_;
+  std::atomic<bool> stop_;
+  std::atomic<size_t> oversized_events_;
+
+  uint32_t generation_; // For RT thread.
+  double requested_seconds_; // For RT thread.
+  bool consumed_; // For RT thread.
+  bool finished_; // For RT thread.
+  bool block_valid_; // For RT thread.
+  size_t read_offset_; // For RT thread.
+  PrefetchBlock block_; // For RT thread.
+
+  std::thread thread_;
+};
+
+}
+
+#endif // EVENT_PREFETCHER_H_
@@ -0,0 +1,145 @@
+
+#include "file_inspector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iterator>
+
+#include "event.h"
+#include "parallel.h"
+#include "smf_reader-inl.h"
+
+namespace midiaud {
+
+namespace {
+
+void WriteJsonString(std::ostream &output, const std::string &value) {
+  output << '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      output << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x",
+                    static_cast<unsigned>(c));
+      output << escaped;
+    } else {
+      output << c;
+    }
+  }
+  output << '"';
+}
+
+}
+
+FileReport InspectFile(const std::string &input_file,
+                       const InspectionSettings &settings) {
+  FileReport report{input_file, std::string(), {0, 0, 0}, 0, 0, 0, 0, 0,
+                    0, 0, 0, 0, 0, 0, {}};
+  std::vector<Event> events;
+  ReadStandardMidiFile(input_file, std::back_inserter(events),
+                       report.division);
+  timebase::TempoMap tempo_map(report.division);
+  for (const Event &event : events) {
+    if (timebase::TempoMap::IsTempoEvent(event))
+      tempo_map.AcknowledgeEvent(event);
+  }
+
+  uint64_t period = 0;
+  size_t period_events = 0;
+  size_t period_bytes = 0;
+  report.events = events.size();
+  for (const Event &event : events) {
+    const MidiBuffer &midi = event.midi();
+    double seconds = tempo_map.GetTicks(event.ticks()).seconds();
+    report.duration_seconds = std::max(report.duration_seconds, seconds);
+    if (event.is_metadata()) {
+      ++report.metaevents;
+      if (midi.size() > 1 && midi[1] == 0x51) ++report.tempo_changes;
+      if (midi.size() > 1 && midi[1] == 0x58) ++report.meter_changes;
+      continue;
+    }
+    if (!midi.empty() && (midi[0] == 0xf0 || midi[0] == 0xf7)) {
+      ++report.sysex_events;
+      report.max_sysex_size = std::max(report.max_sysex_size, midi.size());
+    } else {
+      ++report.channel_events;
+    }
+    // The same frame the sink computes for the event when the
+    // transport started at frame zero, rounded to the nearest one.
+    uint64_t frame = static_cast<uint64_t>(
+        std::llround(seconds * settings.sample_rate));
+    uint64_t event_period = frame / settings.buffer_size;
+    if (event_period != period) {
+      period = event_period;
+      period_events = 0;
+      period_bytes = 0;
+    }
+    ++period_events;
+    period_bytes += midi.size();
+    if (period_events > report.peak_period_events) {
+      report.peak_period_events = period_events;
+      report.peak_period_frame =
+          static_cast<jack_nframes_t>(period * settings.buffer_size);
+    }
+    report.peak_period_bytes = std::max(report.peak_period_bytes,
+                                        period_bytes);
+  }
+  report.diagnostics = tempo_map.diagnostics();
+  return report;
+}
+
+void InspectInParallel(std::vector<FileReport> &reports,
+                       const InspectionSettings &settings,
+                       unsigned threads) {
+  RunInParallel(reports.size(), threads, [&](size_t i) {
+    FileReport &report = reports[i];
+    try {
+      report = InspectFile(report.input_file, settings);
+    } catch (std::exception &e) {
+      report.error = e.what();
+    }
+  });
+}
+
+void WriteReportJson(std::ostream &output, const FileReport &report) {
+  output << "{\"file\":";
+  WriteJsonString(output, report.input_file);
+  if (!report.error.empty()) {
+    output << ",\"error\":";
+    WriteJsonString(output, report.error);
+    output << "}\n";
+    return;
+  }
+  if (report.division.smpte()) {
+    output << ",\"smpte_fps\":" << report.division.frames_per_second
+           << ",\"ticks_per_frame\":" << report.division.ticks_per_frame;
+  } else {
+    output << ",\"ppqn\":" << report.division.ppqn;
+  }
+  output << ",\"events\":" << report.events
+         << ",\"channel_events\":" << report.channel_events
+         << ",\"metaevents\":" << report.metaevents
+         << ",\"sysex_events\":" << report.sysex_events
+         << ",\"max_sysex_size\":" << report.max_sysex_size
+         << ",\"tempo_changes\":" << report.tempo_changes
+         << ",\"meter_changes\":" << report.meter_changes
+         << ",\"duration_seconds\":" << report.duration_seconds
+         << ",\"peak_period_events\":" << report.peak_period_events
+         << ",\"peak_period_bytes\":" << report.peak_period_bytes
+         << ",\"peak_period_frame\":" << report.peak_period_frame
+         << ",\"diagnostics\":[";
+  for (size_t i = 0; i < report.diagnostics.size(); ++i) {
+    if (i > 0) output << ",";
+    output << "{\"tick\":" << report.diagnostics[i].ticks
+           << ",\"message\":";
+    WriteJsonString(output, report.diagnostics[i].message);
+    output << "}";
+  }
+  output << "]}\n";
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef FILE_INSPECTOR_H_
+#define FILE_INSPECTOR_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * Jack settings the files are checked against.
+ */
+struct InspectionSettings {
+  jack_nframes_t buffer_size;
+  jack_nframes_t sample_rate;
+};
+
+/**
+ * What a file would do to the player, collected without playing it.
+ */
+struct FileReport {
+  std::string input_file;
+  /**
+   * Empty if the file could be read.
+   */
+  std::string error;
+  timebase::TimeDivision division;
+  size_t events;
+  size_t channel_events;
+  size_t metaevents;
+  size_t sysex_events;
+  size_t max_sysex_size;
+  size_t tempo_changes;
+  size_t meter_changes;
+  double duration_seconds;
+  /**
+   * The busiest period when played from the start of the transport:
+   * the events and MIDI bytes it has to carry and its first frame.
+   */
+  size_t peak_period_events;
+  size_t peak_period_bytes;
+  jack_nframes_t peak_period_frame;
+  std::vector<timebase::TempoMapDiagnostic> diagnostics;
+};
+
+/**
+ * Reads `input_file` with the same reader and tempo map as the player
+ * and reports on its contents.
+ *
+ * @throws std::runtime_error if the file cannot be read.
+ */
+FileReport InspectFile(const std::string &input_file,
+                       const InspectionSettings &settings);
+
+/**
+ * Runs InspectFile() for the `input_file` of every report on a pool
+ * of `threads` threads. Failures are stored in the reports instead of
+ * being thrown.
+ */
+void InspectInParallel(std::vector<FileReport> &reports,
+                       const InspectionSettings &settings,
+                       unsigned threads);
+
+/**
+ * Writes `report` as a single line JSON object.
+ */
+void WriteReportJson(std::ostream &output, const FileReport &report);
+
+}
+
+#endif // FILE_INSPECTOR_H_
@@ -0,0 +1,87 @@
+
+#include "frame_timeline.h"
+
+#include <climits>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace midiaud {
+
+FrameTimeline::Segment::Segment(SegmentedEvents::SegmentPtr events,
+                                const timebase::TempoMap &tempo_map,
+                                jack_nframes_t frame_rate)
+    : events_(std::move(events)) {
+  frames_.reserve(events_->size());
+  data_offsets_.reserve(events_->size() + 1);
+  for (const Event &event : *events_) {
+    double seconds = tempo_map.GetTicks(event.ticks()).seconds();
+    // Rounded just like the frames computed by the RT thread.
+    frames_.push_back(
+        static_cast<jack_nframes_t>(std::llround(seconds * frame_rate)));
+    data_offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+    bytes_.insert(bytes_.end(), event.midi().begin(), event.midi().end());
+  }
+  data_offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+}
+
+FrameTimeline::FrameTimeline(const SegmentedEvents &events,
+                             const timebase::TempoMap &tempo_map,
+                             jack_nframes_t frame_rate,
+                             const FrameTimeline *previous,
+                             double retimed_ticks)
+    : frame_rate_(frame_rate) {
+  if (previous != nullptr && previous->frame_rate_ != frame_rate)
+    previous = nullptr;
+  segments_.reserve(events.segment_count());
+  // Shared segments of events keep their order, thus the segments of
+  // `previous` are walked along.
+  size_t previous_segment = 0;
+  for (size_t i = 0; i < events.segment_count(); ++i) {
+    const SegmentedEvents::SegmentPtr &segment = events.segment(i);
+    double ticks = segment->front().ticks();
+    if (previous != nullptr) {
+      while (previous_segment < previous->segments_.size()
+             && previous->segment(previous_segment).events()->front().ticks()
+                 < ticks)
+        ++previous_segment;
+      if (previous_segment < previous->segments_.size()
+          && previous->segment(previous_segment).events() == segment
+          && segment->back().ticks() < retimed_ticks) {
+        segments_.push_back(previous->segments_[previous_segment]);
+        continue;
+      }
+    }
+    segments_.push_back(
+        std::make_shared<Segment>(segment, tempo_map, frame_rate));
+  }
+}
+
+size_t FrameTimeline::Segment::FindDueEnd(
+    size_t index, long long end_frame) const noexcept {
+  if (end_frame <= 0) return index;
+  if (end_frame > UINT32_MAX) return frames_.size();
+  jack_nframes_t end = static_cast<jack_nframes_t>(end_frame);
+  size_t size = frames_.size();
+#ifdef __SSE2__
+  // SSE2 only compares signed integers. Flipping the sign bit of both
+  // sides gives the unsigned order.
+  const __m128i sign = _mm_set1_epi32(INT_MIN);
+  const __m128i limit = _mm_xor_si128(
+      _mm_set1_epi32(static_cast<int>(end)), sign);
+  for (; index + 4 <= size; index += 4) {
+    __m128i frames = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(frames_.data() + index));
+    __m128i due = _mm_cmplt_epi32(_mm_xor_si128(frames, sign), limit);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(due));
+    // Frames are sorted, so the due ones come first.
+    if (mask != 0xf) return index + __builtin_popcount(mask);
+  }
+#endif
+  while (index < size && frames_[index] < end) ++index;
+  return index;
+}
+
+}
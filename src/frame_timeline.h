@@ -0,0 +1,112 @@
+#ifndef FRAME_TIMELINE_H_
+#define FRAME_TIMELINE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <jack/jack.h>
+
+#include "event.h"
+#include "segmented_events.h"
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * The events of a file laid out at the transport frames they are due
+ * at, when played at the notated tempo and a given frame rate.
+ *
+ * Frames and message bytes are kept in flat arrays, so a cycle only
+ * reads the run of entries up to its end frame, without converting
+ * ticks to seconds and seconds to frames on the way. Frames are
+ * absolute, thus the runs can be cut at any period size and phase.
+ *
+ * The timeline is laid out in segments, one for every segment of the
+ * events with an entry for every event in the same order, so that the
+ * position in the timeline is the position of the next event. The
+ * layout of a reloaded file reuses the segments that did not change.
+ */
+class FrameTimeline {
+ public:
+  /**
+   * The entries of a segment of the events.
+   */
+  class Segment {
+   public:
+    Segment(SegmentedEvents::SegmentPtr events,
+            const timebase::TempoMap &tempo_map, jack_nframes_t frame_rate);
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+
+    /**
+     * The events laid out.
+     */
+    const SegmentedEvents::SegmentPtr &events() const { return events_; }
+    size_t size() const { return frames_.size(); }
+    jack_nframes_t frame(size_t index) const { return frames_[index]; }
+    const uint8_t *data(size_t index) const {
+      return bytes_.data() + data_offsets_[index];
+    }
+    size_t data_size(size_t index) const {
+      return data_offsets_[index + 1] - data_offsets_[index];
+    }
+    /**
+     * Offsets of the bytes of the entries from `index` on in bytes(),
+     * for writing a run of entries at once.
+     */
+    const uint32_t *data_offsets(size_t index) const {
+      return data_offsets_.data() + index;
+    }
+    const uint8_t *bytes() const { return bytes_.data(); }
+
+    /**
+     * Returns the index of the first entry at or after `index` whose
+     * frame is not before `end_frame`, i.e. the end of the run due in
+     * a cycle ending at `end_frame`. For RT thread.
+     *
+     * The frames are compared several at a time with SIMD
+     * instructions where available, as dense passages have long runs.
+     */
+    size_t FindDueEnd(size_t index, long long end_frame) const noexcept;
+
+   private:
+    SegmentedEvents::SegmentPtr events_;
+    std::vector<jack_nframes_t> frames_;
+    /**
+     * Start of the bytes of every entry in `bytes_`, followed by the
+     * total size.
+     */
+    std::vector<uint32_t> data_offsets_;
+    std::vector<uint8_t> bytes_;
+  };
+
+  /**
+   * Lays out `events`. The segments of `previous`, if any, laid out
+   * for the same segment of events at the same frame rate are shared
+   * instead, as long as they end before `retimed_ticks`, where the
+   * tempo map starts to differ from the one of `previous`.
+   */
+  FrameTimeline(const SegmentedEvents &events,
+                const timebase::TempoMap &tempo_map,
+                jack_nframes_t frame_rate,
+                const FrameTimeline *previous = nullptr,
+                double retimed_ticks = 0);
+  FrameTimeline(const FrameTimeline &) = delete;
+  FrameTimeline &operator=(const FrameTimeline &) = delete;
+
+  jack_nframes_t frame_rate() const { return frame_rate_; }
+  size_t segment_count() const { return segments_.size(); }
+  const Segment &segment(size_t segment) const {
+    return *segments_[segment];
+  }
+
+ private:
+  jack_nframes_t frame_rate_;
+  std::vector<std::shared_ptr<const Segment>> segments_;
+};
+
+}
+
+#endif // FRAME_TIMELINE_H_
@@ -0,0 +1,93 @@
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "file_inspector.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options] input-file...\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("buffer-size", po::value<jack_nframes_t>()->default_value(256),
+       "Jack buffer size to find the busiest period for")
+      ("sample-rate", po::value<jack_nframes_t>()->default_value(48000),
+       "Jack sample rate to find the busiest period for")
+      ("max-period-events", po::value<size_t>()->default_value(0),
+       "fail if a period carries more events than this, 0 for no limit")
+      ("jobs,j", po::value<unsigned>()->default_value(0),
+       "number of files to inspect in parallel, 0 for one per core")
+      ;
+
+  po::options_description hidden_options_desc;
+  hidden_options_desc.add_options()
+      ("input-file", po::value<std::vector<std::string>>()->required(),
+       "input file")
+      ;
+
+  po::options_description options_desc;
+  options_desc.add(generic_options_desc).add(hidden_options_desc);
+
+  po::positional_options_description positional_options_desc;
+  positional_options_desc.add("input-file", -1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(options_desc)
+              .positional(positional_options_desc)
+              .run(), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  midiaud::InspectionSettings settings{
+    vm["buffer-size"].as<jack_nframes_t>(),
+    vm["sample-rate"].as<jack_nframes_t>()};
+  if (settings.buffer_size == 0 || settings.sample_rate == 0) {
+    std::cerr << "buffer size and sample rate must be positive\n";
+    return -1;
+  }
+  size_t max_period_events = vm["max-period-events"].as<size_t>();
+  unsigned threads = vm["jobs"].as<unsigned>();
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+
+  std::vector<midiaud::FileReport> reports;
+  for (const std::string &input_file
+           : vm["input-file"].as<std::vector<std::string>>()) {
+    midiaud::FileReport report{};
+    report.input_file = input_file;
+    reports.push_back(report);
+  }
+  midiaud::InspectInParallel(reports, settings, threads);
+
+  // One JSON object per line, in the order of the arguments.
+  int status = 0;
+  for (const midiaud::FileReport &report : reports) {
+    midiaud::WriteReportJson(std::cout, report);
+    if (!report.error.empty()
+        || (max_period_events > 0
+            && report.peak_period_events > max_period_events))
+      status = 1;
+  }
+  return status;
+}
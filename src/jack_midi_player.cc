@@ -1,7 +1,9 @@
 
 #include "jack_midi_player.h"
 
+#include <chrono>
 #include <stdexcept>
+#include <string>
 #include <iostream>
 
 namespace midiaud {
@@ -9,7 +11,15 @@ namespace midiaud {
 JackMidiPlayer::JackMidiPlayer(std::string client_name,
                                std::string port_name)
     : client_name_(client_name), port_name_(port_name), activated_(false),
-      timebase_master_(false), keep_running_(true) {
+      timebase_master_(false), keep_running_(true), failed_(false),
+      server_shutdown_(false), lost_errors_(0),
+      first_fatal_error_{RtStatus::kOk, 0}, input_port_(nullptr),
+      clock_port_(nullptr),
+      thru_remapped_(false), loop_located_(false), loop_pending_(false),
+      loop_frame_(0), output_latency_(0), clock_latency_(0),
+      expected_frame_(0), cycle_trace_(nullptr),
+      setup_budget_(kDefaultSetupBudget), recorder_(nullptr),
+      stats_page_(nullptr), follow_bbt_(false), traced_streamer_(nullptr) {
   jack_client_ = jack_client_open(client_name_.c_str(),
                                   JackNullOption, nullptr);
   if (jack_client_ == nullptr)
@@ -20,6 +30,9 @@ JackMidiPlayer::JackMidiPlayer(std::string client_name,
   if (jack_set_process_callback(
           jack_client_, &JackMidiPlayer::StaticProcessCallback, this) != 0)
     throw std::runtime_error("jack_set_process_callback failed");
+  if (jack_set_latency_callback(
+          jack_client_, &JackMidiPlayer::StaticLatencyCallback, this) != 0)
+    throw std::runtime_error("jack_set_latency_callback failed");
   jack_on_shutdown(jack_client_,
                    &JackMidiPlayer::StaticShutdownCallback, this);
   midi_port_ = jack_port_register(jack_client_, port_name_.c_str(),
@@ -27,6 +40,8 @@ JackMidiPlayer::JackMidiPlayer(std::string client_name,
                                   JackPortIsOutput, 0);
   if (midi_port_ == nullptr)
     throw std::runtime_error("jack_port_register failed");
+  for (uint8_t channel = 0; channel < 16; ++channel)
+    thru_channel_map_[channel] = channel;
 }
 
 JackMidiPlayer::~JackMidiPlayer() {
@@ -34,6 +49,10 @@ JackMidiPlayer::~JackMidiPlayer() {
     if (activated_) jack_deactivate(jack_client_);
     if (midi_port_ != nullptr)
       jack_port_unregister(jack_client_, midi_port_);
+    if (input_port_ != nullptr)
+      jack_port_unregister(jack_client_, input_port_);
+    if (clock_port_ != nullptr)
+      jack_port_unregister(jack_client_, clock_port_);
     jack_client_close(jack_client_);
   }
 }
@@ -49,23 +68,52 @@ void JackMidiPlayer::Deactivate() {
   if (!activated_) return;
   keep_running_.store(false, std::memory_order_relaxed);
 
+  bool had_fatal_error = failed_.load(std::memory_order_acquire)
+      || server_shutdown_.load(std::memory_order_acquire);
   if (jack_deactivate(jack_client_) == 0) {
-    // If there was already a pending exception and thus we don't
-    // throw because of the deactivation failure, activated() will
-    // still signal about it.
+    // If there was already a fatal error and thus we don't throw
+    // because of the deactivation failure, activated() will still
+    // signal about it.
     activated_ = false;
-  } else if (!pending_exception_) {
-    // If an exception was already thrown in the RT thread,
+  } else if (!had_fatal_error) {
+    // If a fatal error already happened in the RT thread,
     // jack_deactivate might also potentially fail (e.g. server was
-    // shut down), however, the first exception is more important to
-    // be thrown.
+    // shut down), however, the first error is more important to be
+    // thrown.
     throw std::runtime_error("jack_deactivate failed");
   }
 
-  if (pending_exception_) {
-    auto the_exception = pending_exception_;
-    pending_exception_ = nullptr;
-    std::rethrow_exception(the_exception);
+  DrainErrors();
+  if (server_shutdown_.exchange(false, std::memory_order_acquire))
+    throw std::runtime_error("Jack server shutdown");
+  if (first_fatal_error_.status != RtStatus::kOk) {
+    RtError the_error = first_fatal_error_;
+    first_fatal_error_.status = RtStatus::kOk;
+    failed_.store(false, std::memory_order_relaxed);
+    throw std::runtime_error(
+        std::string(RtStatusDescription(the_error.status))
+        + " at frame " + std::to_string(the_error.frame));
+  }
+}
+
+void JackMidiPlayer::DrainErrors() {
+  RtError error;
+  size_t lost_errors = lost_errors_.exchange(0, std::memory_order_relaxed);
+  if (lost_errors > 0) {
+    std::cerr << "Warning: " << lost_errors << " RT errors were lost"
+              << std::endl;
+    if (error_policy_.IsFatal(RtStatus::kErrorQueueOverflow)
+        && first_fatal_error_.status == RtStatus::kOk)
+      first_fatal_error_ = {RtStatus::kErrorQueueOverflow, 0};
+  }
+  while (error_queue_.Pop(error)) {
+    if (error_policy_.IsFatal(error.status)) {
+      if (first_fatal_error_.status == RtStatus::kOk)
+        first_fatal_error_ = error;
+    } else {
+      std::cerr << "Warning: " << RtStatusDescription(error.status)
+                << " at frame " << error.frame << std::endl;
+    }
   }
 }
 
@@ -88,57 +136,245 @@ void JackMidiPlayer::ReleaseTimebaseMaster() {
 }
 
 int JackMidiPlayer::SyncCallback(jack_transport_state_t state,
-                                 jack_position_t *pos) {
-  if (state == JackTransportStarting) {
-    SmfStreamer *smf_streamer = smf_streamer_container_.Fetch();
-    double pos_seconds = static_cast<double>(pos->frame)
-        / pos->frame_rate;
-    smf_streamer->Reposition(pos_seconds);
+                                 jack_position_t *pos) noexcept {
+  if (failed_.load(std::memory_order_relaxed)) return false;
+  if (state != JackTransportStarting) {
+    if (cycle_trace_ != nullptr)
+      cycle_trace_->RecordSync(state, pos->frame, pos->frame_rate, true);
+    return true;
   }
-  return true;
+  SmfStreamer *smf_streamer = smf_streamer_container_.Fetch();
+  double pos_seconds = static_cast<double>(pos->frame)
+      / pos->frame_rate;
+  // Starting again where we stopped keeps the tempo scale anchor,
+  // an actual relocation drops it.
+  if (pos->frame != expected_frame_) time_scale_.ResetAnchor();
+  // The transport is held until the new position is prepared by a
+  // background thread, however expensive that is.
+  smf_streamer->RequestReposition(
+      pos_seconds, CycleTimeScale(*pos, 1, smf_streamer->tempo_map()));
+  bool ready = smf_streamer->ready();
+  if (cycle_trace_ != nullptr) {
+    cycle_trace_->RecordSync(state, pos->frame, pos->frame_rate, ready);
+    TraceReloadIfNeeded(smf_streamer);
+  }
+  return ready;
 }
 
-int JackMidiPlayer::ProcessCallback(jack_nframes_t nframes) {
+int JackMidiPlayer::ProcessCallback(jack_nframes_t nframes) noexcept {
+  if (failed_.load(std::memory_order_relaxed)) return -1;
+  auto cycle_start = std::chrono::steady_clock::now();
   jack_position_t pos;
   jack_transport_state_t state = jack_transport_query(
       jack_client_, &pos);
+  jack_nframes_t latency = output_latency_.load(std::memory_order_relaxed);
+  size_t events_written = 0;
+  size_t bytes_written = 0;
+  if (cycle_trace_ != nullptr) {
+    cycle_trace_->RecordProcess(state, pos.frame, nframes,
+                                pos.frame_rate, latency, setup_budget_);
+  }
 
-  JackMidiSink midi_sink(midi_port_, nframes, pos.frame_rate);
+  JackMidiSink midi_sink(midi_port_, nframes, pos.frame_rate,
+                         active_notes_);
+  midi_sink.set_trace(cycle_trace_);
+  if (!midi_sink.valid()) {
+    PostError(RtStatus::kNoPortBuffer, pos.frame);
+    return failed_.load(std::memory_order_relaxed) ? -1 : 0;
+  }
+
+  void *input_buffer = nullptr;
+  if (input_port_ != nullptr) {
+    input_buffer = jack_port_get_buffer(input_port_, nframes);
+    if (input_buffer == nullptr) {
+      PostError(RtStatus::kNoPortBuffer, pos.frame);
+    } else {
+      midi_sink.SetThruSource(
+          input_buffer, thru_remapped_ ? thru_channel_map_.data() : nullptr);
+    }
+  }
 
   bool now_playing = (state == JackTransportRolling);
-  double start_seconds = static_cast<double>(pos.frame)
+  // Events are written ahead by the latency of the downstream chain.
+  // After a relocation, the ones due before that lookahead are
+  // written at the start of the cycle.
+  double start_seconds = static_cast<double>(pos.frame + latency)
       / pos.frame_rate;
-  double end_seconds = static_cast<double>(pos.frame + nframes)
+  double end_seconds = static_cast<double>(pos.frame + latency + nframes)
       / pos.frame_rate;
+  expected_frame_ = now_playing ? pos.frame + nframes : pos.frame;
+
+  RtStatus status = ApplyCommands(start_seconds, midi_sink);
+  if (status != RtStatus::kOk) PostError(status, pos.frame);
 
   SmfStreamer *smf_streamer = smf_streamer_container_.Fetch();
+  TraceReloadIfNeeded(smf_streamer);
+  const timebase::TimeScale &time_scale = CycleTimeScale(
+      pos, latency + nframes, smf_streamer->tempo_map());
+  if (recorder_ != nullptr && now_playing && input_buffer != nullptr)
+    RecordInput(input_buffer, pos, time_scale);
   if (!smf_streamer->initialized())
-    smf_streamer->Reposition(start_seconds);
-  smf_streamer->StopIfNeeded(now_playing, midi_sink);
-  if (now_playing) smf_streamer->CopyToSink(start_seconds,
-                                            end_seconds,
-                                            midi_sink);
-  return 0;
+    smf_streamer->RequestReposition(start_seconds, time_scale);
+  status = smf_streamer->StopIfNeeded(now_playing, midi_sink);
+  if (status != RtStatus::kOk) PostError(status, pos.frame);
+  // Setup data is spread over the cycles the transport waits for us.
+  status = smf_streamer->WriteSetup(setup_budget_, midi_sink);
+  if (status != RtStatus::kOk) PostError(status, pos.frame);
+  if (now_playing) {
+    status = smf_streamer->CopyToSink(start_seconds, end_seconds,
+                                      time_scale, playback_controls_,
+                                      midi_sink);
+    if (status != RtStatus::kOk) PostError(status, pos.frame);
+  }
+  status = midi_sink.FlushThru();
+  if (status != RtStatus::kOk) PostError(status, pos.frame);
+  if (clock_port_ != nullptr) {
+    // While rolling, the clock is written ahead like the events.
+    jack_nframes_t clock_frame = now_playing
+        ? pos.frame + clock_latency_.load(std::memory_order_relaxed)
+        : pos.frame;
+    JackMidiSink clock_sink(clock_port_, nframes, pos.frame_rate,
+                            clock_active_notes_);
+    status = clock_sink.valid()
+        ? midi_clock_.Process(now_playing, clock_frame, nframes,
+                              smf_streamer->tempo_map(), time_scale,
+                              clock_sink)
+        : RtStatus::kNoPortBuffer;
+    if (status != RtStatus::kOk) PostError(status, pos.frame);
+    events_written += clock_sink.events_written();
+    bytes_written += clock_sink.bytes_written();
+  }
+  LoopIfNeeded(now_playing, pos.frame, latency, *smf_streamer);
+  if (stats_page_ != nullptr) {
+    std::chrono::duration<double, std::micro> cycle_duration =
+        std::chrono::steady_clock::now() - cycle_start;
+    stats_page_->PublishCycle(
+        state, pos.frame, pos.frame_rate, nframes,
+        events_written + midi_sink.events_written(),
+        bytes_written + midi_sink.bytes_written(),
+        static_cast<uint32_t>(cycle_duration.count()));
+  }
+  return failed_.load(std::memory_order_relaxed) ? -1 : 0;
 }
 
 void JackMidiPlayer::TimebaseCallback(jack_transport_state_t state,
                                       jack_nframes_t nframes,
                                       jack_position_t *pos,
-                                      int new_pos) {
+                                      int new_pos) noexcept {
   (void) state;
   (void) nframes;
   (void) new_pos;
+  if (failed_.load(std::memory_order_relaxed)) return;
   SmfStreamer *smf_streamer = smf_streamer_container_.Fetch();
-  smf_streamer->tempo_map().FillBBT(pos);
+  smf_streamer->tempo_map().FillBBT(pos, time_scale_);
+}
+
+void JackMidiPlayer::LatencyCallback(
+    jack_latency_callback_mode_t mode) noexcept {
+  if (mode != JackPlaybackLatency) return;
+  jack_latency_range_t range;
+  jack_port_get_latency_range(midi_port_, JackPlaybackLatency, &range);
+  output_latency_.store(range.max, std::memory_order_relaxed);
+  if (clock_port_ != nullptr) {
+    jack_port_get_latency_range(clock_port_, JackPlaybackLatency, &range);
+    clock_latency_.store(range.max, std::memory_order_relaxed);
+  }
 }
 
-void JackMidiPlayer::ShutdownCallback() {
-  throw std::runtime_error("Jack server shutdown");
+void JackMidiPlayer::ShutdownCallback() noexcept {
+  server_shutdown_.store(true, std::memory_order_relaxed);
+  RequestDeactivate();
+}
+
+RtStatus JackMidiPlayer::ApplyCommands(double start_seconds,
+                                       MidiSink &sink) noexcept {
+  RtStatus status = RtStatus::kOk;
+  PlaybackCommand command;
+  for (int i = 0; i < kMaxCommandsPerCycle && command_queue_.Pop(command);
+       ++i) {
+    if (cycle_trace_ != nullptr) cycle_trace_->RecordCommand(command);
+    if (command.type == PlaybackCommand::kPanic) {
+      RtStatus panic_status = sink.WriteGlobalSoundOff(0);
+      if (panic_status == RtStatus::kOk)
+        panic_status = sink.WriteGlobalResetControllers(0);
+      active_notes_.Clear();
+      if (status == RtStatus::kOk) status = panic_status;
+    } else if (command.type == PlaybackCommand::kSetTempoScale) {
+      time_scale_.SetScale(command.value, start_seconds);
+    } else {
+      playback_controls_.Apply(command);
+    }
+  }
+  return status;
+}
+
+const timebase::TimeScale &JackMidiPlayer::CycleTimeScale(
+    const jack_position_t &pos, jack_nframes_t window_frames,
+    const timebase::TempoMap &tempo_map) noexcept {
+  if (follow_bbt_
+      && bbt_follower_.Follow(pos, window_frames, tempo_map,
+                              &followed_time_scale_))
+    return followed_time_scale_;
+  return time_scale_;
+}
+
+void JackMidiPlayer::RecordInput(
+    void *input_buffer, const jack_position_t &pos,
+    const timebase::TimeScale &time_scale) noexcept {
+  jack_nframes_t event_count = jack_midi_get_event_count(input_buffer);
+  jack_midi_event_t event;
+  for (jack_nframes_t i = 0; i < event_count; ++i) {
+    if (jack_midi_event_get(&event, input_buffer, i) != 0) continue;
+    double seconds = static_cast<double>(pos.frame + event.time)
+        / pos.frame_rate;
+    recorder_->Record(time_scale.ToFileSeconds(seconds), event.buffer,
+                      event.size);
+  }
+}
+
+void JackMidiPlayer::LoopIfNeeded(bool now_playing, jack_nframes_t frame,
+                                  jack_nframes_t latency,
+                                  const SmfStreamer &smf_streamer) noexcept {
+  if (!smf_streamer.finished() || smf_streamer.event_count() == 0) {
+    loop_located_ = false;
+    loop_pending_ = false;
+  } else if (now_playing && playback_controls_.loop() && !loop_located_) {
+    if (!loop_pending_) {
+      loop_pending_ = true;
+      loop_frame_ = frame + latency;
+    }
+    if (frame >= loop_frame_) {
+      // The relocation only happens in a later cycle, do not request
+      // it over and over again until then.
+      jack_transport_locate(jack_client_, 0);
+      loop_located_ = true;
+    }
+  }
+}
+
+void JackMidiPlayer::TraceReloadIfNeeded(
+    const SmfStreamer *smf_streamer) noexcept {
+  // The slot of the current streamer is never overwritten while it is
+  // in use, so a different address means a different streamer.
+  if (cycle_trace_ == nullptr || smf_streamer == traced_streamer_) return;
+  cycle_trace_->RecordReload(smf_streamer->load_id());
+  traced_streamer_ = smf_streamer;
+}
+
+void JackMidiPlayer::PostError(RtStatus status,
+                               jack_nframes_t frame) noexcept {
+  if (stats_page_ != nullptr) stats_page_->CountError(status);
+  if (!error_queue_.Push({status, frame}))
+    lost_errors_.fetch_add(1, std::memory_order_relaxed);
+  if (error_policy_.IsFatal(status)) {
+    failed_.store(true, std::memory_order_relaxed);
+    RequestDeactivate();
+  }
 }
 
 void JackMidiPlayer::RequestDeactivate(std::memory_order order) noexcept {
-  // Changes to pending_exception_ will be released to the main
-  // thread.
+  // Changes to failed_ and server_shutdown_ will be released to the
+  // main thread.
   keep_running_.store(false, order);
 }
 
@@ -152,21 +388,87 @@ void JackMidiPlayer::ConnectPort(const std::string &destination) {
     throw std::runtime_error("jack_connect failure");
 }
 
+void JackMidiPlayer::RegisterInputPort(const std::string &input_port_name) {
+  if (activated_)
+    throw std::logic_error("input port must be registered before activation");
+  if (input_port_ != nullptr) return;
+  input_port_ = jack_port_register(jack_client_, input_port_name.c_str(),
+                                   JACK_DEFAULT_MIDI_TYPE,
+                                   JackPortIsInput, 0);
+  if (input_port_ == nullptr)
+    throw std::runtime_error("jack_port_register failed");
+}
+
+void JackMidiPlayer::RegisterClockPort(const std::string &clock_port_name) {
+  if (activated_)
+    throw std::logic_error("clock port must be registered before activation");
+  if (clock_port_ != nullptr) return;
+  clock_port_ = jack_port_register(jack_client_, clock_port_name.c_str(),
+                                   JACK_DEFAULT_MIDI_TYPE,
+                                   JackPortIsOutput, 0);
+  if (clock_port_ == nullptr)
+    throw std::runtime_error("jack_port_register failed");
+}
+
+void JackMidiPlayer::SetThruChannel(uint8_t channel) {
+  if (activated_)
+    throw std::logic_error("thru channel must be set before activation");
+  thru_channel_map_.fill(channel & 0x0f);
+  thru_remapped_ = true;
+}
+
+void JackMidiPlayer::ConnectInputPort(const std::string &source) {
+  if (input_port_ == nullptr)
+    throw std::logic_error("no input port was registered");
+  const char *own_port_name = jack_port_name(input_port_);
+  if (own_port_name == nullptr)
+    throw std::runtime_error("jack_port_name failure");
+  int result = jack_connect(jack_client_, source.c_str(), own_port_name);
+  if (result != 0 && result != EEXIST)
+    throw std::runtime_error("jack_connect failure");
+}
+
+void JackMidiPlayer::ConnectClockPort(const std::string &destination) {
+  if (clock_port_ == nullptr)
+    throw std::logic_error("no clock port was registered");
+  const char *own_port_name = jack_port_name(clock_port_);
+  if (own_port_name == nullptr)
+    throw std::runtime_error("jack_port_name failure");
+  int result = jack_connect(jack_client_, own_port_name,
+                            destination.c_str());
+  if (result != 0 && result != EEXIST)
+    throw std::runtime_error("jack_connect failure");
+}
+
+void JackMidiPlayer::DisconnectPort(const std::string &destination) {
+  const char *own_port_name = jack_port_name(midi_port_);
+  if (own_port_name == nullptr)
+    throw std::runtime_error("jack_port_name failure");
+  if (jack_disconnect(jack_client_, own_port_name,
+                      destination.c_str()) != 0)
+    throw std::runtime_error("jack_disconnect failure");
+}
+
+void JackMidiPlayer::Locate(jack_nframes_t frame) {
+  if (jack_transport_locate(jack_client_, frame) != 0)
+    throw std::runtime_error("jack_transport_locate failure");
+}
+
+jack_transport_state_t JackMidiPlayer::QueryTransport(jack_position_t *pos) {
+  return jack_transport_query(jack_client_, pos);
+}
+
 int JackMidiPlayer::StaticSyncCallback(jack_transport_state_t state,
                                        jack_position_t *pos,
                                        void *arg) noexcept {
   JackMidiPlayer *midi_player = static_cast<JackMidiPlayer *>(arg);
-  return midi_player->RunAndPropagateException([=]() {
-      return midi_player->SyncCallback(state, pos);
-    }, false);
+  return midi_player->SyncCallback(state, pos);
 }
 
 int JackMidiPlayer::StaticProcessCallback(jack_nframes_t nframes,
                                           void *arg) noexcept {
   JackMidiPlayer *midi_player = static_cast<JackMidiPlayer *>(arg);
-  return midi_player->RunAndPropagateException([=]() {
-      return midi_player->ProcessCallback(nframes);
-    }, -1);
+  return midi_player->ProcessCallback(nframes);
 }
 
 void JackMidiPlayer::StaticTimebaseCallback(jack_transport_state_t state,
@@ -175,16 +477,18 @@ void JackMidiPlayer::StaticTimebaseCallback(jack_transport_state_t state,
                                             int new_pos,
                                             void *arg) noexcept {
   JackMidiPlayer *midi_player = static_cast<JackMidiPlayer *>(arg);
-  midi_player->RunAndPropagateException([=]() {
-      midi_player->TimebaseCallback(state, nframes, pos, new_pos);
-    });
+  midi_player->TimebaseCallback(state, nframes, pos, new_pos);
+}
+
+void JackMidiPlayer::StaticLatencyCallback(
+    jack_latency_callback_mode_t mode, void *arg) noexcept {
+  JackMidiPlayer *midi_player = static_cast<JackMidiPlayer *>(arg);
+  midi_player->LatencyCallback(mode);
 }
 
 void JackMidiPlayer::StaticShutdownCallback(void *arg) noexcept {
   JackMidiPlayer *midi_player = static_cast<JackMidiPlayer *>(arg);
-  midi_player->RunAndPropagateException([=]() {
-      midi_player->ShutdownCallback();
-    });
+  midi_player->ShutdownCallback();
 }
 
 }
@@ -1,21 +1,35 @@
 #ifndef JACK_MIDI_PLAYER_H_
 #define JACK_MIDI_PLAYER_H_
 
+#include <array>
 #include <string>
 #include <atomic>
-#include <exception>
-#include <type_traits>
 
 #include <jack/jack.h>
 
+#include "active_notes.h"
+#include "cycle_trace.h"
+#include "jack_midi_sink.h"
+#include "midi_clock.h"
+#include "midi_recorder.h"
 #include "smf_streamer.h"
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
 #include "lockfree_resource.h"
 #include "lockfree_resource-inl.h"
+#include "playback_control.h"
+#include "rt_status.h"
+#include "stats_page.h"
+#include "timebase/bbt_follower.h"
 
 namespace midiaud {
 
 class JackMidiPlayer {
  public:
+  static constexpr int kMaxCommandsPerCycle = 16;
+  static constexpr size_t kCommandQueueCapacity = 64;
+  static constexpr size_t kDefaultSetupBudget = 512;
+
   JackMidiPlayer(std::string client_name, std::string port_name);
   JackMidiPlayer(const JackMidiPlayer &) = delete;
   JackMidiPlayer(JackMidiPlayer &&) = delete;
@@ -24,15 +38,75 @@ class JackMidiPlayer {
 
   void Activate();
   /**
-   * Deactivate client then rethrown the first pending exception from
-   * the main thread (if any).
+   * Deactivate client then throw the first fatal error from the RT
+   * thread (if any).
    */
   void Deactivate();
+  /**
+   * Logs the recoverable errors reported by the RT thread since the
+   * last call. Fatal errors are kept until Deactivate() is called.
+   */
+  void DrainErrors();
+  /**
+   * Must not be called while the client is activated.
+   */
+  void set_error_policy(const RtErrorPolicy &error_policy) {
+    error_policy_ = error_policy;
+  }
   void RequestDeactivate(std::memory_order order =
                          std::memory_order_release) noexcept;
   void SetTimebaseMaster(bool conditional);
   void ReleaseTimebaseMaster();
 
+  /**
+   * Records every cycle into `cycle_trace` (nullptr to disable). The
+   * trace must outlive the activation.
+   *
+   * Must not be called while the client is activated.
+   */
+  void set_cycle_trace(CycleTraceWriter *cycle_trace) {
+    cycle_trace_ = cycle_trace;
+  }
+  /**
+   * Records the input port into `recorder` (nullptr to disable) while
+   * the transport is rolling. The recorder must outlive the
+   * activation.
+   *
+   * Must not be called while the client is activated.
+   */
+  void set_recorder(MidiRecorder *recorder) {
+    recorder_ = recorder;
+  }
+  /**
+   * Publishes the transport state, the output and the timing of every
+   * cycle into `stats_page` (nullptr to disable). The page must
+   * outlive the activation.
+   *
+   * Must not be called while the client is activated.
+   */
+  void set_stats_page(StatsPage *stats_page) {
+    stats_page_ = stats_page;
+  }
+  /**
+   * Plays the file in the bars and beats published by the timebase
+   * master instead of by the tempo of the file, whenever the master
+   * publishes them. The tempo scale has no effect meanwhile.
+   *
+   * Must not be called while the client is activated.
+   */
+  void set_follow_bbt(bool follow_bbt) {
+    follow_bbt_ = follow_bbt;
+  }
+  /**
+   * Limits the setup data of the file written per cycle while the
+   * transport is starting to `setup_budget` bytes.
+   *
+   * Must not be called while the client is activated.
+   */
+  void set_setup_budget(size_t setup_budget) {
+    setup_budget_ = setup_budget;
+  }
+
   /**
    * Emplaces a new SmfStreamer into the resource container.
    *
@@ -43,11 +117,55 @@ class JackMidiPlayer {
     smf_streamer_container_.Emplace(std::forward<Args>(args)...);
   }
 
+  /**
+   * Queues a command for the RT thread.
+   *
+   * @returns false if the command queue is full.
+   */
+  bool PostCommand(const PlaybackCommand &command) {
+    return command_queue_.Push(command);
+  }
+
+  /**
+   * Registers a MIDI input port whose events are passed through to the
+   * output, merged with the events of the file.
+   *
+   * Must be called before Activate().
+   */
+  void RegisterInputPort(const std::string &input_port_name);
+  /**
+   * Sends every channel message from the input port to `channel`
+   * (0-15). Must be called before Activate().
+   */
+  void SetThruChannel(uint8_t channel);
+
+  /**
+   * Registers a MIDI output port for 24 PPQN clock, Song Position
+   * Pointer and transport messages following the tempo map of the
+   * file.
+   *
+   * Must be called before Activate().
+   */
+  void RegisterClockPort(const std::string &clock_port_name);
+
   void ConnectPort(const std::string &destination);
+  void ConnectClockPort(const std::string &destination);
+  void DisconnectPort(const std::string &destination);
+  void ConnectInputPort(const std::string &source);
+  /**
+   * Asks the Jack transport to relocate to `frame`.
+   *
+   * The RT thread will be notified through SyncCallback() just like
+   * when any other client relocates the transport.
+   */
+  void Locate(jack_nframes_t frame);
+  jack_transport_state_t QueryTransport(jack_position_t *pos);
+  jack_nframes_t sample_rate() { return jack_get_sample_rate(jack_client_); }
 
   const std::string &client_name() { return client_name_; }
   const std::string &port_name() { return port_name_; }
   bool activated() { return activated_; }
+  bool timebase_master() { return timebase_master_; }
   /**
    * Check in main thread whether the client wants to remain active.
    */
@@ -56,13 +174,19 @@ class JackMidiPlayer {
   }
 
  protected:
-  int SyncCallback(jack_transport_state_t , jack_position_t *pos);
-  int ProcessCallback(jack_nframes_t nframes);
+  int SyncCallback(jack_transport_state_t , jack_position_t *pos) noexcept;
+  int ProcessCallback(jack_nframes_t nframes) noexcept;
+  /**
+   * Measures how far ahead of the transport the output ports have to
+   * be written, so that the events come out of the downstream chain
+   * on time.
+   */
+  void LatencyCallback(jack_latency_callback_mode_t mode) noexcept;
   void TimebaseCallback(jack_transport_state_t state,
                         jack_nframes_t nframes,
                         jack_position_t *pos,
-                        int new_pos);
-  void ShutdownCallback();
+                        int new_pos) noexcept;
+  void ShutdownCallback() noexcept;
 
  private:
   static int StaticSyncCallback(jack_transport_state_t state,
@@ -75,50 +199,49 @@ class JackMidiPlayer {
                                      jack_position_t *pos,
                                      int new_pos,
                                      void *arg) noexcept;
+  static void StaticLatencyCallback(jack_latency_callback_mode_t mode,
+                                    void *arg) noexcept;
   static void StaticShutdownCallback(void *arg) noexcept;
 
   /**
-   * Runs the functor and propagates any exception to the main thread.
-   *
-   * The functor will not be run if there is pending exception from
-   * the RT thread. If the functor throws, the exception is saved and
-   * deactivation is requested. Upon deactivation, the exception will
-   * be rethrown.
-   *
-   * @tparam Functor the type of the functor to call.
-   * @param functor the functor to call.
-   * @param on_error the value to return on error.
-   * @returns the return value of the functor, or on_error if there was
-   *          an exception.
-   */
-  template <typename Functor>
-  auto RunAndPropagateException(const Functor &functor,
-                                decltype(functor()) on_error = decltype(functor())())
-      noexcept -> decltype(functor()) {
-    if (pending_exception_) return on_error;
-    try {
-      return functor();
-    } catch (...) {
-      pending_exception_ = std::current_exception();
-      RequestDeactivate();
-      return on_error;
-    }
-  }
-
+   * Applies at most kMaxCommandsPerCycle queued commands, so that a
+   * burst of commands cannot make the cycle overrun.
+   */
+  RtStatus ApplyCommands(double start_seconds, MidiSink &sink) noexcept;
   /**
-   * RunAndPropagateException without value to return on error.
+   * Hands the messages of the input port to the recorder, timed on
+   * the timeline of the played file.
    */
-  template <typename Functor>
-  auto RunAndPropagateException(const Functor &functor) noexcept
-      -> typename std::enable_if<std::is_void<decltype(functor())>::value, void>::type {
-    if (pending_exception_) return;
-    try {
-      functor();
-    } catch (...) {
-      pending_exception_ = std::current_exception();
-      RequestDeactivate();
-    }
-  }
+  void RecordInput(void *input_buffer, const jack_position_t &pos,
+                   const timebase::TimeScale &time_scale) noexcept;
+  /**
+   * Returns the mapping from transport time to file time for the
+   * `window_frames` frames from the frame of `pos`: the one following
+   * the BBT of the timebase master if enabled and available, the tempo
+   * scale otherwise.
+   */
+  const timebase::TimeScale &CycleTimeScale(
+      const jack_position_t &pos, jack_nframes_t window_frames,
+      const timebase::TempoMap &tempo_map) noexcept;
+  /**
+   * Relocates the transport to the start when the end of the file is
+   * reached and looping is enabled. Events are written `latency`
+   * frames ahead of the transport, so they are given that long to
+   * play out first.
+   */
+  void LoopIfNeeded(bool now_playing, jack_nframes_t frame,
+                    jack_nframes_t latency,
+                    const SmfStreamer &smf_streamer) noexcept;
+  /**
+   * Records a kReload into the cycle trace when the RT thread picks up
+   * a new streamer.
+   */
+  void TraceReloadIfNeeded(const SmfStreamer *smf_streamer) noexcept;
+  /**
+   * Reports an error to the main thread, requesting deactivation if
+   * it is fatal.
+   */
+  void PostError(RtStatus status, jack_nframes_t frame) noexcept;
 
   std::string client_name_; // For main thread.
   std::string port_name_; // For main thread.
@@ -133,13 +256,62 @@ class JackMidiPlayer {
    */
   std::atomic<bool> keep_running_;
   /**
-   * Carries exceptions from the RT thread to be rethrown in the main
-   * thread when Deactivate() is called.
+   * Set by the RT thread after a fatal error. No more work is done in
+   * the callbacks once it is set.
+   */
+  std::atomic<bool> failed_;
+  /**
+   * Set when the Jack server shuts down. The shutdown callback does
+   * not run in the RT thread, so it cannot use the error queue.
    */
-  std::exception_ptr pending_exception_;
+  std::atomic<bool> server_shutdown_;
+  /**
+   * Number of errors that did not fit into the error queue.
+   */
+  std::atomic<size_t> lost_errors_;
+  /**
+   * Carries errors from the RT thread to be logged or thrown in the
+   * main thread.
+   */
+  LockfreeQueue<RtError, 64> error_queue_;
+  RtErrorPolicy error_policy_; // Read by RT thread, set before activation.
+  RtError first_fatal_error_; // For main thread.
   jack_client_t *jack_client_; // For RT thread (initialized in main thread).
   jack_port_t *midi_port_; // For RT thread (initialized in main thread).
+  jack_port_t *input_port_; // For RT thread (initialized in main thread).
+  jack_port_t *clock_port_; // For RT thread (initialized in main thread).
+  // For RT thread (initialized in main thread).
+  std::array<uint8_t, 16> thru_channel_map_;
+  bool thru_remapped_; // For RT thread (initialized in main thread).
   LockfreeResource<SmfStreamer> smf_streamer_container_;
+  LockfreeQueue<PlaybackCommand, kCommandQueueCapacity> command_queue_;
+  PlaybackControls playback_controls_; // For RT thread.
+  ActiveNotes active_notes_; // For RT thread.
+  MidiClock midi_clock_; // For RT thread.
+  ActiveNotes clock_active_notes_; // For RT thread, always empty.
+  bool loop_located_; // For RT thread.
+  bool loop_pending_; // For RT thread.
+  jack_nframes_t loop_frame_; // For RT thread.
+  /**
+   * Playback latency of the downstream chain of the output port,
+   * updated by the latency callback.
+   */
+  std::atomic<jack_nframes_t> output_latency_;
+  std::atomic<jack_nframes_t> clock_latency_; // Ditto for the clock port.
+  timebase::TimeScale time_scale_; // For RT thread.
+  /**
+   * Frame where the transport will be in the next cycle if it is not
+   * relocated. For RT thread.
+   */
+  jack_nframes_t expected_frame_;
+  CycleTraceWriter *cycle_trace_; // For RT thread, set before activation.
+  size_t setup_budget_; // Read by RT thread, set before activation.
+  MidiRecorder *recorder_; // For RT thread, set before activation.
+  StatsPage *stats_page_; // For RT thread, set before activation.
+  bool follow_bbt_; // Read by RT thread, set before activation.
+  timebase::BBTFollower bbt_follower_; // For RT thread.
+  timebase::TimeScale followed_time_scale_; // For RT thread.
+  const SmfStreamer *traced_streamer_; // For RT thread.
 };
 
 }
@@ -1,83 +1,102 @@
 
 #include "jack_midi_sink.h"
 
-#include <stdexcept>
+#include <cstring>
 
 namespace midiaud {
 
 JackMidiSink::JackMidiSink(jack_port_t *port, jack_nframes_t nframes,
-                           jack_nframes_t framerate) 
-    : buffer_(jack_port_get_buffer(port, nframes)),
-      framerate_(framerate) {
-  if (buffer_ == nullptr)
-    throw std::runtime_error("jack_port_get_buffer failed");
-  jack_midi_clear_buffer(buffer_);
+                           jack_nframes_t framerate,
+                           ActiveNotes &active_notes) noexcept
+    : MidiSink(framerate, active_notes),
+      buffer_(jack_port_get_buffer(port, nframes)), nframes_(nframes),
+      thru_buffer_(nullptr), thru_channel_map_(nullptr),
+      thru_event_count_(0), next_thru_event_(0),
+      thru_status_(RtStatus::kOk) {
+  if (buffer_ != nullptr)
+    jack_midi_clear_buffer(buffer_);
 }
 
-void JackMidiSink::WriteMidi(double offset_seconds,
-                             const jack_midi_data_t *data,
-                             size_t size) {
-  jack_nframes_t offset =
-      static_cast<jack_nframes_t>(offset_seconds * framerate_);
+RtStatus JackMidiSink::WriteEvent(jack_nframes_t offset,
+                                  const uint8_t *data,
+                                  size_t size) noexcept {
+  if (buffer_ == nullptr) return RtStatus::kNoPortBuffer;
+  if (next_thru_event_ < thru_event_count_) WriteThruBefore(offset);
   if (jack_midi_event_write(buffer_, offset, data, size) != 0)
-    throw std::runtime_error("jack_midi_event_write failure");
+    return RtStatus::kPortBufferFull;
+  return RtStatus::kOk;
 }
 
-void JackMidiSink::WriteProgramChange(double offset_seconds,
-                                      uint8_t channel,
-                                      uint8_t program) {
-  jack_midi_data_t buffer[] = {
-    static_cast<jack_midi_data_t>(0xc0 | channel), program
-  };
-  WriteMidi(offset_seconds, buffer, sizeof(buffer));
+size_t JackMidiSink::WriteEvents(const jack_nframes_t *offsets,
+                                 const uint32_t *data_offsets,
+                                 const uint8_t *bytes, size_t count,
+                                 RtStatus &status) noexcept {
+  if (buffer_ == nullptr) {
+    status = RtStatus::kNoPortBuffer;
+    return 0;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (next_thru_event_ < thru_event_count_) WriteThruBefore(offsets[i]);
+    size_t size = data_offsets[i + 1] - data_offsets[i];
+    jack_midi_data_t *data = jack_midi_event_reserve(buffer_, offsets[i],
+                                                     size);
+    if (data == nullptr) {
+      status = RtStatus::kPortBufferFull;
+      return i;
+    }
+    std::memcpy(data, bytes + data_offsets[i], size);
+  }
+  return count;
 }
 
-void JackMidiSink::WriteNoteOn(double offset_seconds, uint8_t channel,
-                               uint8_t note, uint8_t velocity) {
-  jack_midi_data_t buffer[] = {
-    static_cast<jack_midi_data_t>(0x90 | channel), note, velocity
-  };
-  WriteMidi(offset_seconds, buffer, sizeof(buffer));
+void JackMidiSink::SetThruSource(void *input_buffer,
+                                 const uint8_t *channel_map) noexcept {
+  thru_buffer_ = input_buffer;
+  thru_channel_map_ = channel_map;
+  thru_event_count_ = jack_midi_get_event_count(input_buffer);
+  next_thru_event_ = 0;
 }
 
-void JackMidiSink::WritePitchWheelChange(double offset_seconds,
-                                         uint8_t channel,
-                                         uint16_t pitch) {
-  jack_midi_data_t least = static_cast<jack_midi_data_t>(pitch & 0x7f);
-  jack_midi_data_t most = static_cast<jack_midi_data_t>((pitch >> 7) & 0x7f);
-  jack_midi_data_t buffer[] = {
-    static_cast<jack_midi_data_t>(0xd0 | channel), least, most
-  };
-  WriteMidi(offset_seconds, buffer, sizeof(buffer));
+RtStatus JackMidiSink::FlushThru() noexcept {
+  if (buffer_ == nullptr) return RtStatus::kNoPortBuffer;
+  WriteThruBefore(nframes_);
+  return thru_status_;
 }
 
-void JackMidiSink::WriteControlChange(double offset_seconds,
-                                      uint8_t channel, uint8_t control,
-                                      uint8_t value) {
-  jack_midi_data_t buffer[] = {
-    static_cast<jack_midi_data_t>(0xb0 | channel), control, value
-  };
-  WriteMidi(offset_seconds, buffer, sizeof(buffer));
+void JackMidiSink::WriteThruBefore(jack_nframes_t offset) noexcept {
+  jack_midi_event_t event;
+  while (next_thru_event_ < thru_event_count_) {
+    if (jack_midi_event_get(&event, thru_buffer_, next_thru_event_) != 0) {
+      ++next_thru_event_;
+      continue;
+    }
+    if (event.time >= offset) break;
+    RtStatus event_status = WriteThruEvent(event);
+    if (thru_status_ == RtStatus::kOk) thru_status_ = event_status;
+    ++next_thru_event_;
+  }
 }
 
-void JackMidiSink::WriteAllSoundOff(double offset_seconds,
-                                    uint8_t channel) {
-  WriteControlChange(offset_seconds, channel, 0x78, 0x00);
-}
-
-void JackMidiSink::WriteGlobalSoundOff(double offset_seconds) {
-  for (uint8_t channel = 0; channel < 16; ++channel)
-    WriteAllSoundOff(offset_seconds, channel);
-}
-
-void JackMidiSink::WriteResetAllControllers(double offset_seconds,
-                                            uint8_t channel) {
-  WriteControlChange(offset_seconds, channel, 0x79, 0x00);
-}
-
-void JackMidiSink::WriteGlobalResetControllers(double offset_seconds) {
-  for (uint8_t channel = 0; channel < 16; ++channel)
-    WriteAllSoundOff(offset_seconds, channel);
+RtStatus JackMidiSink::WriteThruEvent(
+    const jack_midi_event_t &event) noexcept {
+  bool channel_message = event.size > 0
+      && event.buffer[0] >= 0x80 && event.buffer[0] < 0xf0;
+  if (thru_channel_map_ == nullptr || !channel_message) {
+    if (jack_midi_event_write(buffer_, event.time, event.buffer,
+                              event.size) != 0)
+      return RtStatus::kPortBufferFull;
+    active_notes().Update(event.buffer, event.size);
+    CountWritten(event.size);
+    return RtStatus::kOk;
+  }
+  jack_midi_data_t *data = jack_midi_event_reserve(buffer_, event.time,
+                                                   event.size);
+  if (data == nullptr) return RtStatus::kPortBufferFull;
+  std::memcpy(data, event.buffer, event.size);
+  data[0] = (data[0] & 0xf0) | thru_channel_map_[data[0] & 0x0f];
+  active_notes().Update(data, event.size);
+  CountWritten(event.size);
+  return RtStatus::kOk;
 }
 
 }
@@ -4,33 +4,72 @@
 #include <jack/jack.h>
 #include <jack/midiport.h>
 
+#include "active_notes.h"
+#include "midi_sink.h"
+#include "rt_status.h"
+
 namespace midiaud {
 
-class JackMidiSink {
+/**
+ * Writes MIDI events into the buffer of a Jack port for one cycle.
+ *
+ * If the port buffer is unavailable, every write reports
+ * RtStatus::kNoPortBuffer.
+ */
+class JackMidiSink : public MidiSink {
  public:
   JackMidiSink(jack_port_t *port, jack_nframes_t nframes,
-               jack_nframes_t framerate);
-
-  void WriteMidi(double offset_seconds,
-                 const jack_midi_data_t *data, size_t size);
-  void WriteProgramChange(double offset_seconds,
-                          uint8_t channel, uint8_t program);
-  void WriteNoteOn(double offset_seconds, uint8_t channel,
-                   uint8_t note, uint8_t velocity);
-  void WritePitchWheelChange(double offset_seconds,
-                          uint8_t channel, uint16_t pitch);
-  void WriteControlChange(double offset_seconds,
-                          uint8_t channel, uint8_t control,
-                          uint8_t value);
-  void WriteAllSoundOff(double offset_seconds, uint8_t channel);
-  void WriteGlobalSoundOff(double offset_seconds);
-  void WriteResetAllControllers(double offset_seconds,
-                                uint8_t channel);
-  void WriteGlobalResetControllers(double offset_seconds);
+               jack_nframes_t framerate,
+               ActiveNotes &active_notes) noexcept;
+
+  /**
+   * Passes the events of a Jack MIDI input buffer through to the
+   * output, merging them with the events written by the other methods
+   * in timestamp order.
+   *
+   * Input events are written just before the first event that comes
+   * after them, or by FlushThru(). At equal timestamps, our own
+   * events go first, so that a sound off at the start of the cycle
+   * does not silence notes played live in the same frame.
+   *
+   * @param input_buffer the buffer of the input port for this cycle.
+   * @param channel_map target channel for every input channel, or
+   *        nullptr to pass the events through unchanged.
+   */
+  void SetThruSource(void *input_buffer,
+                     const uint8_t *channel_map) noexcept;
+  /**
+   * Writes the remaining input events. Must be called at the end of
+   * the cycle if SetThruSource() was used.
+   *
+   * @returns the first failure to write an input event in this cycle.
+   */
+  RtStatus FlushThru() noexcept;
+
+  bool valid() const { return buffer_ != nullptr; }
+
+ protected:
+  RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                      size_t size) noexcept override;
+  /**
+   * Reserves the space of every event of the run and copies its bytes
+   * in place.
+   */
+  size_t WriteEvents(const jack_nframes_t *offsets,
+                     const uint32_t *data_offsets, const uint8_t *bytes,
+                     size_t count, RtStatus &status) noexcept override;
 
  private:
+  void WriteThruBefore(jack_nframes_t offset) noexcept;
+  RtStatus WriteThruEvent(const jack_midi_event_t &event) noexcept;
+
   void *buffer_;
-  jack_nframes_t framerate_;
+  jack_nframes_t nframes_;
+  void *thru_buffer_;
+  const uint8_t *thru_channel_map_;
+  uint32_t thru_event_count_;
+  uint32_t next_thru_event_;
+  RtStatus thru_status_;
 };
 
 }
@@ -0,0 +1,34 @@
+#ifndef LOCKFREE_QUEUE_INL_H_
+#define LOCKFREE_QUEUE_INL_H_
+
+namespace midiaud {
+
+template <typename T, size_t Capacity>
+LockfreeQueue<T, Capacity>::LockfreeQueue()
+    : read_offset_(0), write_offset_(0) {
+}
+
+template <typename T, size_t Capacity>
+bool LockfreeQueue<T, Capacity>::Push(const T &value) noexcept {
+  size_t write_offset = write_offset_.load(std::memory_order_relaxed);
+  size_t next_write_offset = (write_offset + 1) % kSlots;
+  if (next_write_offset == read_offset_.load(std::memory_order_acquire))
+    return false;
+  data_[write_offset] = value;
+  write_offset_.store(next_write_offset, std::memory_order_release);
+  return true;
+}
+
+template <typename T, size_t Capacity>
+bool LockfreeQueue<T, Capacity>::Pop(T &value) noexcept {
+  size_t read_offset = read_offset_.load(std::memory_order_relaxed);
+  if (read_offset == write_offset_.load(std::memory_order_acquire))
+    return false;
+  value = data_[read_offset];
+  read_offset_.store((read_offset + 1) % kSlots, std::memory_order_release);
+  return true;
+}
+
+}
+
+#endif // LOCKFREE_QUEUE_INL_H_
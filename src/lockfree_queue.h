@@ -0,0 +1,42 @@
+#ifndef LOCKFREE_QUEUE_H_
+#define LOCKFREE_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+
+namespace midiaud {
+
+/**
+ * Fixed-capacity, wait-free single producer single consumer queue.
+ *
+ * Neither Push() nor Pop() allocates, thus either end may be used
+ * from the RT thread. `T` should be trivially copyable, because
+ * popped slots are not destructed until they are overwritten.
+ */
+template <typename T, size_t Capacity>
+class LockfreeQueue {
+ public:
+  LockfreeQueue();
+
+  /**
+   * Returns false without blocking if the queue is full.
+   */
+  bool Push(const T &value) noexcept;
+  /**
+   * Returns false without blocking if the queue is empty.
+   */
+  bool Pop(T &value) noexcept;
+
+ private:
+  // One slot is always kept empty to tell a full queue from an empty
+  // one.
+  static constexpr size_t kSlots = Capacity + 1;
+
+  T data_[kSlots];
+  std::atomic<size_t> read_offset_;
+  std::atomic<size_t> write_offset_;
+};
+
+}
+
+#endif // LOCKFREE_QUEUE_H_
@@ -3,20 +3,48 @@
 
 #include <array>
 #include <atomic>
+#include <cstddef>
 
 namespace midiaud {
 
+/**
+ * Hands the latest of a series of values from a single writer thread
+ * to a single reader thread without locks.
+ *
+ * Emplace() replaces the slot after the newest one and publishes it,
+ * Fetch() moves the reader onto the newest slot. The slot returned by
+ * Fetch() stays untouched until the next Fetch() call: the writer
+ * would have to go around all `Size` slots to reach it, and it gives
+ * up on the slot before the one the reader last announced. Thus at
+ * most `Size - 1` values may be emplaced between two fetches, and old
+ * values are destructed by the writer when their slot is reused.
+ */
 template <typename T, size_t Size = 3>
 class LockfreeResource {
  public:
+  static_assert(Size >= 3, "a writer needs a slot apart from the newest "
+                "and the one being read");
+
   LockfreeResource();
 
+  /**
+   * Returns false without blocking if the reader has not fetched
+   * enough of the previous values yet.
+   */
   template <typename... Args> bool Emplace(Args &&... args);
   T *Fetch();
 
  private:
+  static constexpr size_t kCacheLineSize = 64;
+
   T data_[Size];
+  // The reader stores into read_offset_ on every Fetch(), so it gets a
+  // cache line of its own. Filling a slot or publishing it does not
+  // take that line away from the reader, nor does the reader's store
+  // invalidate the line the writer loads write_offset_ from.
+  char slots_padding_[kCacheLineSize];
   std::atomic<ptrdiff_t> read_offset_;
+  char read_offset_padding_[kCacheLineSize - sizeof(std::atomic<ptrdiff_t>)];
   std::atomic<ptrdiff_t> write_offset_;
 };
 
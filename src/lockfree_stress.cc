@@ -0,0 +1,472 @@
+
+#include "lockfree_stress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "jack_midi_player.h"
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
+#include "lockfree_resource.h"
+#include "lockfree_resource-inl.h"
+#include "playback_control.h"
+
+namespace midiaud {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * A PlaybackCommand whose fields are all derived from `sequence`, so
+ * that the reader can tell a torn or stale slot.
+ */
+struct StampedCommand {
+  PlaybackCommand command;
+  uint64_t sequence;
+  Clock::time_point pushed;
+};
+
+StampedCommand MakeCommand(uint64_t sequence) {
+  PlaybackCommand command{
+    static_cast<PlaybackCommand::Type>(sequence % 6),
+    static_cast<uint16_t>(sequence * 40503), static_cast<double>(sequence)};
+  return {command, sequence, Clock::time_point()};
+}
+
+bool SameCommand(const PlaybackCommand &lhs, const PlaybackCommand &rhs) {
+  return lhs.type == rhs.type && lhs.channels == rhs.channels
+      && lhs.value == rhs.value;
+}
+
+/**
+ * Runs `producer` and `consumer` on their own threads until both
+ * return. Both are started at once, so that neither gets a head start.
+ */
+template <typename Producer, typename Consumer>
+void RunPair(Producer producer, Consumer consumer) {
+  std::atomic<int> started{0};
+  auto start = [&started]() {
+    started.fetch_add(1);
+    while (started.load() < 2) std::this_thread::yield();
+  };
+  std::thread producer_thread([&]() { start(); producer(); });
+  std::thread consumer_thread([&]() { start(); consumer(); });
+  producer_thread.join();
+  consumer_thread.join();
+}
+
+double Percentile(const std::vector<double> &sorted, double fraction) {
+  size_t index = static_cast<size_t>(fraction * (sorted.size() - 1));
+  return sorted[index];
+}
+
+/**
+ * A value of `Words` copies of its sequence number, so that a reader
+ * can tell a torn or stale value.
+ */
+template <size_t Words>
+struct Filled {
+  Filled() : Filled(0) {}
+  explicit Filled(uint64_t sequence) {
+    std::fill(words, words + Words, sequence);
+  }
+
+  bool consistent() const {
+    return std::all_of(words, words + Words, [this](uint64_t word) {
+      return word == words[0];
+    });
+  }
+
+  uint64_t words[Words];
+};
+
+constexpr size_t kCacheLineSize = 64;
+
+template <typename T, size_t Size>
+struct PackedLayout {
+  T data[Size];
+  std::atomic<ptrdiff_t> read_offset;
+  std::atomic<ptrdiff_t> write_offset;
+};
+
+template <typename T, size_t Size>
+struct AlignedLayout {
+  alignas(kCacheLineSize) T data[Size];
+  alignas(kCacheLineSize) std::atomic<ptrdiff_t> read_offset;
+  alignas(kCacheLineSize) std::atomic<ptrdiff_t> write_offset;
+};
+
+/**
+ * LockfreeResource with its members laid out by `Layout`, to compare
+ * layouts. The algorithm has to be kept the same as that of
+ * LockfreeResource.
+ */
+template <typename T, size_t Size, template <typename, size_t> class Layout>
+class ResourceVariant {
+ public:
+  ResourceVariant() {
+    members_.read_offset.store(Size - 1);
+    members_.write_offset.store(0);
+  }
+
+  template <typename... Args> bool Emplace(Args &&... args) {
+    ptrdiff_t read_offset =
+        members_.read_offset.load(std::memory_order_acquire);
+    ptrdiff_t write_offset =
+        members_.write_offset.load(std::memory_order_relaxed);
+    ptrdiff_t next_write_offset = (write_offset + 1) % Size;
+    if (next_write_offset == read_offset) return false;
+    members_.data[write_offset] = T(std::forward<Args>(args)...);
+    members_.write_offset.store(next_write_offset,
+                                std::memory_order_release);
+    return true;
+  }
+
+  T *Fetch() {
+    ptrdiff_t write_offset =
+        members_.write_offset.load(std::memory_order_acquire);
+    ptrdiff_t read_offset = (write_offset + Size - 1) % Size;
+    members_.read_offset.store(read_offset, std::memory_order_release);
+    return &members_.data[read_offset];
+  }
+
+ private:
+  Layout<T, Size> members_;
+};
+
+/**
+ * Keeps the loads of the benchmark from being optimized away.
+ */
+std::atomic<uint64_t> benchmark_sink{0};
+
+constexpr size_t kFetchBatch = 16;
+
+template <typename Resource>
+LatencySummary TimeFetch(size_t samples, bool contended) {
+  typedef Filled<kCacheLineSize / sizeof(uint64_t)> Line;
+  Resource resource;
+  std::atomic<bool> done{false};
+  std::thread writer;
+  if (contended) {
+    writer = std::thread([&]() {
+      for (uint64_t sequence = 1; !done.load(std::memory_order_relaxed);) {
+        if (resource.Emplace(sequence)) {
+          ++sequence;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::vector<double> latencies;
+  latencies.reserve(samples);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < samples; ++i) {
+    auto batch_start = Clock::now();
+    for (size_t j = 0; j < kFetchBatch; ++j) {
+      const Line *line = resource.Fetch();
+      sum += line->words[0];
+    }
+    std::chrono::duration<double> batch_duration =
+        Clock::now() - batch_start;
+    latencies.push_back(batch_duration.count() / kFetchBatch);
+  }
+  done.store(true);
+  if (writer.joinable()) writer.join();
+  benchmark_sink.fetch_add(sum, std::memory_order_relaxed);
+  return SummarizeLatencies(latencies);
+}
+
+template <size_t Slots>
+void BenchmarkSlots(size_t samples,
+                    std::vector<FetchBenchmarkResult> &results) {
+  typedef Filled<kCacheLineSize / sizeof(uint64_t)> Line;
+  for (bool contended : {false, true}) {
+    results.push_back({"padded", Slots, contended,
+                       TimeFetch<LockfreeResource<Line, Slots>>(
+                           samples, contended)});
+    results.push_back({"packed", Slots, contended,
+                       TimeFetch<ResourceVariant<Line, Slots, PackedLayout>>(
+                           samples, contended)});
+    results.push_back({"aligned", Slots, contended,
+                       TimeFetch<ResourceVariant<Line, Slots, AlignedLayout>>(
+                           samples, contended)});
+  }
+}
+
+constexpr size_t kMaxModelSlots = 8;
+
+/**
+ * Shared variables of the model of LockfreeResource, and the program
+ * counter and locals of both threads. Slots hold the number of the
+ * value written into them.
+ */
+struct ModelState {
+  int data[kMaxModelSlots];
+  int read_offset;
+  int write_offset;
+  /**
+   * Slot the writer is assigning to, or -1.
+   */
+  int writing;
+  /**
+   * Slot returned by the last Fetch(), or -1.
+   */
+  int held;
+  bool violated;
+
+  int emplaces_left;
+  int writer_step;
+  int writer_slot;
+  int next_value;
+
+  int fetches_left;
+  int reader_step;
+  int reader_slot;
+  int last_value;
+};
+
+/**
+ * Performs the next atomic step of Emplace().
+ */
+void StepWriter(ModelState &state, int slots) {
+  switch (state.writer_step) {
+    case 0:
+      // Loads read_offset_. The writer owns write_offset_, thus its
+      // load cannot race with anything.
+      if ((state.write_offset + 1) % slots == state.read_offset) {
+        --state.emplaces_left;
+        return;
+      }
+      state.writer_slot = state.write_offset;
+      state.writer_step = 1;
+      return;
+    case 1:
+      // Starts assigning the slot.
+      if (state.writer_slot == state.held) state.violated = true;
+      state.writing = state.writer_slot;
+      state.writer_step = 2;
+      return;
+    case 2:
+      state.data[state.writer_slot] = ++state.next_value;
+      state.writing = -1;
+      state.writer_step = 3;
+      return;
+    default:
+      state.write_offset = (state.writer_slot + 1) % slots;
+      state.writer_step = 0;
+      --state.emplaces_left;
+      return;
+  }
+}
+
+/**
+ * Performs the next atomic step of Fetch(), then uses the value.
+ */
+void StepReader(ModelState &state, int slots) {
+  switch (state.reader_step) {
+    case 0:
+      state.reader_slot = (state.write_offset + slots - 1) % slots;
+      state.reader_step = 1;
+      return;
+    case 1:
+      state.read_offset = state.reader_slot;
+      state.held = state.reader_slot;
+      state.reader_step = 2;
+      return;
+    default:
+      if (state.writing == state.reader_slot
+          || state.data[state.reader_slot] < state.last_value)
+        state.violated = true;
+      state.last_value = state.data[state.reader_slot];
+      state.reader_step = 0;
+      --state.fetches_left;
+      return;
+  }
+}
+
+void Explore(const ModelState &state, int slots,
+             ModelCheckResult &result) {
+  bool writer_done = state.emplaces_left == 0;
+  bool reader_done = state.fetches_left == 0;
+  if (writer_done && reader_done) {
+    ++result.interleavings;
+    if (state.violated) ++result.violations;
+    return;
+  }
+  if (!writer_done) {
+    ModelState next = state;
+    StepWriter(next, slots);
+    Explore(next, slots, result);
+  }
+  if (!reader_done) {
+    ModelState next = state;
+    StepReader(next, slots);
+    Explore(next, slots, result);
+  }
+}
+
+}
+
+LatencySummary SummarizeLatencies(std::vector<double> &seconds) {
+  if (seconds.empty()) return {0, 0, 0, 0, 0};
+  std::sort(seconds.begin(), seconds.end());
+  return {seconds.size(), Percentile(seconds, 0.5),
+          Percentile(seconds, 0.99), Percentile(seconds, 0.999),
+          seconds.back()};
+}
+
+QueueStressResult StressCommandQueue(double seconds,
+                                     size_t latency_samples) {
+  QueueStressResult result{0, 0, 0, {0, 0, 0, 0, 0}};
+  LockfreeQueue<StampedCommand, JackMidiPlayer::kCommandQueueCapacity>
+      queue;
+  std::atomic<bool> done{false};
+
+  auto deadline = Clock::now()
+      + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(seconds));
+  RunPair(
+      [&]() {
+        for (uint64_t sequence = 0; Clock::now() < deadline; ++sequence) {
+          StampedCommand command = MakeCommand(sequence);
+          while (!queue.Push(command)) {
+            ++result.full_pushes;
+            std::this_thread::yield();
+          }
+        }
+        done.store(true);
+      },
+      [&]() {
+        uint64_t expected = 0;
+        StampedCommand command;
+        for (;;) {
+          // Seen before popping, so nothing pushed before it is missed.
+          bool finished = done.load();
+          if (!queue.Pop(command)) {
+            if (finished) break;
+            std::this_thread::yield();
+            continue;
+          }
+          if (command.sequence != expected
+              || !SameCommand(command.command,
+                              MakeCommand(command.sequence).command))
+            ++result.errors;
+          expected = command.sequence + 1;
+          ++result.commands;
+        }
+      });
+
+  // One command is in flight at a time, so that the latency is that
+  // of the queue rather than of the commands queued before.
+  std::vector<double> latencies;
+  latencies.reserve(latency_samples);
+  std::atomic<uint64_t> consumed{0};
+  RunPair(
+      [&]() {
+        for (uint64_t sequence = 1; sequence <= latency_samples;
+             ++sequence) {
+          StampedCommand command = MakeCommand(sequence);
+          command.pushed = Clock::now();
+          queue.Push(command);
+          while (consumed.load(std::memory_order_acquire) != sequence)
+            std::this_thread::yield();
+        }
+      },
+      [&]() {
+        StampedCommand command;
+        while (latencies.size() < latency_samples) {
+          if (!queue.Pop(command)) {
+            std::this_thread::yield();
+            continue;
+          }
+          std::chrono::duration<double> latency =
+              Clock::now() - command.pushed;
+          latencies.push_back(latency.count());
+          consumed.store(command.sequence, std::memory_order_release);
+        }
+      });
+  result.latency = SummarizeLatencies(latencies);
+  return result;
+}
+
+ResourceStressResult StressResource(double seconds) {
+  typedef Filled<4 * kCacheLineSize / sizeof(uint64_t)> Value;
+  ResourceStressResult result{0, 0, 0, 0};
+  LockfreeResource<Value> resource;
+  std::atomic<bool> done{false};
+
+  auto deadline = Clock::now()
+      + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(seconds));
+  RunPair(
+      [&]() {
+        uint64_t sequence = 1;
+        while (Clock::now() < deadline) {
+          if (resource.Emplace(sequence)) {
+            ++sequence;
+          } else {
+            ++result.failed_emplaces;
+            std::this_thread::yield();
+          }
+        }
+        result.emplaced = sequence - 1;
+        done.store(true);
+      },
+      [&]() {
+        uint64_t last = 0;
+        while (!done.load()) {
+          const Value *value = resource.Fetch();
+          uint64_t sequence = value->words[0];
+          if (!value->consistent() || sequence < last) ++result.errors;
+          // Gives the writer a chance at the slot while it is held.
+          std::this_thread::yield();
+          if (!value->consistent() || value->words[0] != sequence)
+            ++result.errors;
+          last = sequence;
+          ++result.fetches;
+        }
+      });
+  return result;
+}
+
+ModelCheckResult ModelCheckResource(size_t slots, int emplaces,
+                                    int fetches) {
+  if (slots < 3 || slots > kMaxModelSlots)
+    throw std::invalid_argument("the model supports 3 to 8 slots");
+  ModelState state;
+  std::fill(state.data, state.data + kMaxModelSlots, 0);
+  state.read_offset = static_cast<int>(slots) - 1;
+  state.write_offset = 0;
+  state.writing = -1;
+  state.held = -1;
+  state.violated = false;
+  state.emplaces_left = emplaces;
+  state.writer_step = 0;
+  state.writer_slot = -1;
+  state.next_value = 0;
+  state.fetches_left = fetches;
+  state.reader_step = 0;
+  state.reader_slot = -1;
+  state.last_value = 0;
+  ModelCheckResult result{0, 0};
+  Explore(state, static_cast<int>(slots), result);
+  return result;
+}
+
+std::vector<FetchBenchmarkResult> BenchmarkFetch(size_t samples) {
+  std::vector<FetchBenchmarkResult> results;
+  BenchmarkSlots<3>(samples, results);
+  BenchmarkSlots<4>(samples, results);
+  BenchmarkSlots<8>(samples, results);
+  return results;
+}
+
+}
@@ -0,0 +1,135 @@
+#ifndef LOCKFREE_STRESS_H_
+#define LOCKFREE_STRESS_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace midiaud {
+
+/**
+ * Distribution of a measured duration.
+ */
+struct LatencySummary {
+  size_t samples;
+  double p50_seconds;
+  double p99_seconds;
+  double p999_seconds;
+  double max_seconds;
+};
+
+/**
+ * Summarizes `seconds`, which is sorted in place.
+ */
+LatencySummary SummarizeLatencies(std::vector<double> &seconds);
+
+/**
+ * Outcome of hammering the command queue from two threads.
+ */
+struct QueueStressResult {
+  size_t commands;
+  /**
+   * Commands popped out of order, twice, or with a payload that does
+   * not match their sequence number. Anything but 0 is a bug.
+   */
+  size_t errors;
+  /**
+   * Pushes that found the queue full and had to be retried.
+   */
+  size_t full_pushes;
+  /**
+   * Time from Push() to Pop() of paced commands, with a reader that
+   * polls all the time.
+   */
+  LatencySummary latency;
+};
+
+/**
+ * Pushes numbered commands into a LockfreeQueue of the capacity
+ * JackMidiPlayer uses for PlaybackCommands as fast as possible from
+ * one thread, while another thread pops them in a tight loop, for
+ * `seconds`. Then measures the latency of `latency_samples` commands
+ * pushed one at a time.
+ */
+QueueStressResult StressCommandQueue(double seconds,
+                                     size_t latency_samples);
+
+/**
+ * Outcome of hammering a LockfreeResource from two threads.
+ */
+struct ResourceStressResult {
+  size_t emplaced;
+  size_t fetches;
+  /**
+   * Fetched values that were torn, older than the value fetched
+   * before, or changed before the next Fetch(). Anything but 0 is a
+   * bug.
+   */
+  size_t errors;
+  /**
+   * Emplace() calls that found no free slot and had to be retried.
+   */
+  size_t failed_emplaces;
+};
+
+/**
+ * Emplaces numbered values spanning several cache lines into a
+ * LockfreeResource as fast as possible from one thread, while another
+ * thread fetches them in a tight loop and reads every fetched value
+ * twice, for `seconds`.
+ */
+ResourceStressResult StressResource(double seconds);
+
+/**
+ * Outcome of checking every interleaving of a bounded run.
+ */
+struct ModelCheckResult {
+  size_t interleavings;
+  /**
+   * Interleavings in which the writer started on the slot the reader
+   * was on, or the reader got a slot being written or an older value.
+   */
+  size_t violations;
+};
+
+/**
+ * Checks the protocol of LockfreeResource with `slots` slots by
+ * running a model of its atomic steps through every interleaving of
+ * `emplaces` Emplace() calls with `fetches` Fetch() calls. The model
+ * is sequentially consistent, the memory orders are left to a build
+ * with ThreadSanitizer.
+ *
+ * @throws std::invalid_argument if `slots` is not within 3 to 8.
+ */
+ModelCheckResult ModelCheckResource(size_t slots, int emplaces,
+                                    int fetches);
+
+/**
+ * Cost of Fetch() with one slot layout and slot count.
+ */
+struct FetchBenchmarkResult {
+  /**
+   * "padded" for LockfreeResource itself, "packed" without padding and
+   * "aligned" with every member on a cache line of its own.
+   */
+  const char *layout;
+  size_t slots;
+  /**
+   * Whether a writer thread was emplacing values all the time.
+   */
+  bool contended;
+  /**
+   * Mean time of a Fetch() and a load from the fetched value, over
+   * batches of calls, as a single call is too short to be timed.
+   */
+  LatencySummary latency;
+};
+
+/**
+ * Times `samples` batches of Fetch() calls for every layout, with 3, 4
+ * and 8 slots, with and without a writer.
+ */
+std::vector<FetchBenchmarkResult> BenchmarkFetch(size_t samples);
+
+}
+
+#endif // LOCKFREE_STRESS_H_
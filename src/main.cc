@@ -8,18 +8,355 @@
 #include <chrono>
 #include <thread>
 #include <csignal>
+#include <future>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
+#include "control_socket.h"
+#include "cycle_trace.h"
 #include "jack_midi_player.h"
+#include "marker_index.h"
+#include "midi_recorder.h"
+#include "offline_renderer.h"
+#include "playback_control.h"
 #include "smf_streamer.h"
+#include "stats_page.h"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+// Declared first so that they outlive the player recording into them.
+std::unique_ptr<midiaud::CycleTraceWriter> cycle_trace;
+std::unique_ptr<midiaud::MidiRecorder> midi_recorder;
+std::unique_ptr<midiaud::StatsPage> stats_page;
 std::unique_ptr<midiaud::JackMidiPlayer> midi_player;
 
+/**
+ * A parsed file that was not handed to the RT thread yet.
+ */
+struct ParsedFile {
+  fs::path input_file;
+  midiaud::SmfStreamer streamer;
+  midiaud::LoadTimings timings;
+};
+
+/**
+ * File loading state of the main thread, shared by the watcher and
+ * the control socket.
+ */
+struct LoadedFile {
+  fs::path input_file;
+  /**
+   * Kept around in the main thread so that reloads can reuse the
+   * unchanged parts of the file.
+   */
+  midiaud::SmfStreamer streamer;
+  time_t last_load_time;
+  int reloads;
+  double last_reload_seconds;
+  /**
+   * Whether files are streamed with bounded memory instead of being
+   * loaded up front.
+   */
+  bool streaming;
+  /**
+   * Whether files are laid out at the frames of the sample rate when
+   * they are handed to the RT thread.
+   */
+  bool prerender;
+  /**
+   * Tempo scale last posted to the RT thread. Relocating drops the
+   * anchor of the scale, so cues of the file are found at their file
+   * time divided by it.
+   */
+  double tempo_scale;
+  /**
+   * File being parsed in the background, if any.
+   */
+  std::future<ParsedFile> pending_load;
+};
+
+/**
+ * Shows the loaded file to monitoring tools.
+ */
+void publish_file_stats(const LoadedFile &loaded) {
+  if (stats_page) {
+    stats_page->PublishFile(loaded.input_file.string(), loaded.reloads,
+                            loaded.last_reload_seconds);
+  }
+}
+
+/**
+ * Hands a copy of the loaded streamer to the RT thread.
+ */
+void publish_streamer(LoadedFile &loaded) {
+  if (loaded.prerender)
+    loaded.streamer.Prerender(midi_player->sample_rate());
+  if (cycle_trace) {
+    // The replay may run in another working directory.
+    std::string filename = loaded.input_file.empty()
+        ? std::string() : fs::absolute(loaded.input_file).string();
+    loaded.streamer.set_load_id(
+        cycle_trace->RecordLoad(filename, loaded.streamer.streaming(),
+                                loaded.streamer.prerendered_rate()));
+  }
+  if (midi_recorder)
+    midi_recorder->SetTempoMap(loaded.streamer.shared_tempo_map());
+  midi_player->EmplaceSmfStreamer(loaded.streamer);
+  publish_file_stats(loaded);
+}
+
+ParsedFile parse_file(const fs::path &input_file, bool streaming) {
+  ParsedFile parsed{input_file, midiaud::SmfStreamer(), {0, 0, 0}};
+  parsed.streamer = streaming
+      ? midiaud::SmfStreamer::OpenStreaming(input_file.string(),
+                                            &parsed.timings)
+      : midiaud::SmfStreamer(input_file.string(), &parsed.timings);
+  return parsed;
+}
+
+/**
+ * Logs the malformed metaevents found while building the tempo map.
+ */
+void log_diagnostics(const midiaud::SmfStreamer &streamer) {
+  for (const auto &diagnostic : streamer.tempo_map().diagnostics()) {
+    std::cerr << "Warning: " << diagnostic.message << " at tick "
+              << diagnostic.ticks << std::endl;
+  }
+}
+
+void finish_load(LoadedFile &loaded, ParsedFile parsed) {
+  loaded.streamer = std::move(parsed.streamer);
+  loaded.input_file = parsed.input_file;
+  publish_streamer(loaded);
+  std::time(&loaded.last_load_time);
+  std::cerr << "Loaded " << loaded.input_file << ": parse "
+            << parsed.timings.parse_seconds * 1000 << " ms, tempo map "
+            << parsed.timings.tempo_map_seconds * 1000 << " ms, index "
+            << parsed.timings.index_seconds * 1000 << " ms" << std::endl;
+  log_diagnostics(loaded.streamer);
+}
+
+void load_file(LoadedFile &loaded, const fs::path &input_file) {
+  finish_load(loaded, parse_file(input_file, loaded.streaming));
+}
+
+/**
+ * Parses `input_file` in a worker thread, so that the Jack client
+ * can be activated and connected in the meantime.
+ */
+void load_file_async(LoadedFile &loaded, const fs::path &input_file) {
+  loaded.pending_load = std::async(std::launch::async, &parse_file,
+                                   input_file, loaded.streaming);
+}
+
+/**
+ * Publishes the file parsed in the background once it is ready. The
+ * RT thread positions it at the current transport frame, like any
+ * new streamer.
+ *
+ * @throws the exception that made parsing fail.
+ */
+void poll_pending_load(LoadedFile &loaded) {
+  if (!loaded.pending_load.valid()
+      || loaded.pending_load.wait_for(std::chrono::seconds{0})
+          != std::future_status::ready)
+    return;
+  finish_load(loaded, loaded.pending_load.get());
+}
+
+void reload_file(LoadedFile &loaded) {
+  auto reload_start = std::chrono::steady_clock::now();
+  if (loaded.streaming) {
+    // Nothing is kept in memory that could be reused.
+    load_file(loaded, loaded.input_file);
+    ++loaded.reloads;
+    loaded.last_reload_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - reload_start).count();
+    publish_file_stats(loaded);
+    return;
+  }
+  midiaud::ReloadStats stats;
+  loaded.streamer = midiaud::SmfStreamer(loaded.input_file.string(),
+                                         loaded.streamer, &stats);
+  publish_streamer(loaded);
+  std::chrono::duration<double, std::milli> reload_duration =
+      std::chrono::steady_clock::now() - reload_start;
+  std::cerr << "Reused " << stats.tracks_reused << "/"
+            << stats.tracks_total << " tracks, "
+            << stats.events_reused << "/"
+            << stats.events_total << " events and "
+            << stats.tempo_positions_reused << "/"
+            << stats.tempo_positions_total
+            << " tempo map positions in "
+            << reload_duration.count() << " ms" << std::endl;
+  log_diagnostics(loaded.streamer);
+  std::time(&loaded.last_load_time);
+  ++loaded.reloads;
+  loaded.last_reload_seconds = reload_duration.count() / 1000;
+  publish_file_stats(loaded);
+}
+
+/**
+ * Warns about the recorded messages dropped since the last call.
+ */
+void log_recorder_drops(size_t &logged_drops) {
+  size_t drops = midi_recorder->dropped_events()
+      + midi_recorder->oversized_events();
+  if (drops == logged_drops) return;
+  std::cerr << "Warning: " << drops - logged_drops
+            << " recorded messages dropped" << std::endl;
+  logged_drops = drops;
+}
+
+const char *transport_state_name(jack_transport_state_t state) {
+  switch (state) {
+    case JackTransportStopped: return "stopped";
+    case JackTransportRolling: return "rolling";
+    case JackTransportStarting: return "starting";
+    default: return "unknown";
+  }
+}
+
+/**
+ * Parses a comma separated list of MIDI channels (1-16), "all" or
+ * "none" into a bitmask.
+ */
+uint16_t parse_channels(const std::string &channels) {
+  if (channels == "all") return midiaud::PlaybackControls::kAllChannels;
+  if (channels == "none") return 0;
+  uint16_t mask = 0;
+  std::istringstream channels_stream(channels);
+  std::string channel;
+  while (std::getline(channels_stream, channel, ',')) {
+    int number = std::stoi(channel);
+    if (number < 1 || number > 16)
+      throw std::invalid_argument("invalid MIDI channel " + channel);
+    mask |= 1 << (number - 1);
+  }
+  return mask;
+}
+
+/**
+ * Looks up a cue by the text of a marker, cue point or lyric first,
+ * then by the number of a marker or cue point.
+ */
+const midiaud::Marker *find_cue(const midiaud::MarkerIndex &marker_index,
+                                const std::string &name) {
+  const midiaud::Marker *cue = marker_index.FindName(name);
+  if (cue != nullptr || name.empty()
+      || name.find_first_not_of("0123456789") != std::string::npos)
+    return cue;
+  return marker_index.FindNumber(std::stoul(name));
+}
+
+std::string post_command(midiaud::PlaybackCommand::Type type,
+                         uint16_t channels, double value) {
+  if (!midi_player->PostCommand({type, channels, value}))
+    return "error command queue is full";
+  return "ok";
+}
+
+/**
+ * Executes a command received through the control socket.
+ *
+ * Commands that affect playback reach the RT thread the same way as
+ * their command-line counterparts, i.e. through the lock-free
+ * resource container or the Jack transport.
+ */
+std::string handle_control_command(LoadedFile &loaded,
+                                   const std::string &command) {
+  std::istringstream command_stream(command);
+  std::string verb;
+  command_stream >> verb;
+  std::string argument;
+  std::getline(command_stream >> std::ws, argument);
+
+  if ((verb == "load" || verb == "unload") && loaded.pending_load.valid())
+    return "error a file is still loading";
+
+  if (verb == "ping") {
+    // Used by midiaud-ctl to measure round-trip latency.
+  } else if (verb == "load") {
+    if (argument.empty()) return "error missing file name";
+    load_file(loaded, argument);
+  } else if (verb == "unload") {
+    loaded.streamer = midiaud::SmfStreamer();
+    loaded.input_file.clear();
+    publish_streamer(loaded);
+  } else if (verb == "seek") {
+    std::istringstream frame_stream(argument);
+    jack_nframes_t frame;
+    if (!(frame_stream >> frame)) return "error invalid frame";
+    midi_player->Locate(frame);
+  } else if (verb == "cue") {
+    const midiaud::Marker *cue = find_cue(loaded.streamer.marker_index(),
+                                          argument);
+    if (cue == nullptr) return "error no cue " + argument;
+    midi_player->Locate(static_cast<jack_nframes_t>(std::llround(
+        cue->seconds / loaded.tempo_scale * midi_player->sample_rate())));
+  } else if (verb == "connect") {
+    midi_player->ConnectPort(argument);
+  } else if (verb == "disconnect") {
+    midi_player->DisconnectPort(argument);
+  } else if (verb == "master") {
+    if (argument == "on") {
+      midi_player->SetTimebaseMaster(false);
+    } else if (argument == "conditional") {
+      midi_player->SetTimebaseMaster(true);
+    } else if (argument == "off") {
+      midi_player->ReleaseTimebaseMaster();
+    } else {
+      return "error expected on, conditional or off";
+    }
+  } else if (verb == "mute") {
+    return post_command(midiaud::PlaybackCommand::kSetMute,
+                        parse_channels(argument), 0);
+  } else if (verb == "solo") {
+    return post_command(midiaud::PlaybackCommand::kSetSolo,
+                        parse_channels(argument), 0);
+  } else if (verb == "loop") {
+    if (argument != "on" && argument != "off")
+      return "error expected on or off";
+    return post_command(midiaud::PlaybackCommand::kSetLoop, 0,
+                        argument == "on");
+  } else if (verb == "gain") {
+    return post_command(midiaud::PlaybackCommand::kSetVelocityGain, 0,
+                        std::stod(argument));
+  } else if (verb == "tempo") {
+    double tempo_scale = std::stod(argument);
+    std::string reply = post_command(
+        midiaud::PlaybackCommand::kSetTempoScale, 0, tempo_scale);
+    if (reply == "ok") {
+      loaded.tempo_scale = std::max(
+          double{midiaud::timebase::TimeScale::kMinScale}, tempo_scale);
+    }
+    return reply;
+  } else if (verb == "panic") {
+    return post_command(midiaud::PlaybackCommand::kPanic, 0, 0);
+  } else if (verb == "stats") {
+    jack_position_t pos;
+    jack_transport_state_t state = midi_player->QueryTransport(&pos);
+    std::ostringstream reply;
+    reply << "ok file=" << loaded.input_file.string()
+          << " events=" << loaded.streamer.event_count()
+          << " tempo_positions=" << loaded.streamer.tempo_map().size()
+          << " cues=" << loaded.streamer.marker_index().cue_count()
+          << " reloads=" << loaded.reloads
+          << " master=" << midi_player->timebase_master()
+          << " transport=" << transport_state_name(state)
+          << " frame=" << pos.frame;
+    return reply.str();
+  } else {
+    return "error unknown command " + verb;
+  }
+  return "ok";
+}
+
 void signal_handler(int signal) {
   std::cerr << "Received signal " << signal << std::endl;
   if (signal == SIGINT) {
@@ -31,7 +368,55 @@ void signal_handler(int signal) {
 }
 
 void print_usage(char *argv0) {
-  std::cout << "Usage: " << argv0 << " [options] input-file\n";
+  std::cout << "Usage: " << argv0 << " [options] input-file\n"
+            << "       " << argv0 << " --render output-dir [options] "
+            << "input-file...\n";
+}
+
+/**
+ * Renders every input file into an event log without Jack.
+ */
+int run_render(const po::variables_map &vm) {
+  fs::path output_dir(vm["render"].as<fs::path>());
+  midiaud::RenderSettings settings{vm["buffer-size"].as<jack_nframes_t>(),
+                                   vm["sample-rate"].as<jack_nframes_t>()};
+  if (settings.buffer_size == 0 || settings.sample_rate == 0)
+    throw std::invalid_argument("buffer size and sample rate must be positive");
+  unsigned threads = vm["jobs"].as<unsigned>();
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  fs::create_directories(output_dir);
+
+  std::vector<midiaud::RenderJob> jobs;
+  for (const fs::path &input_file
+           : vm["input-file"].as<std::vector<fs::path>>()) {
+    fs::path output_file = output_dir / input_file.stem();
+    output_file += ".mrl";
+    jobs.push_back({input_file.string(), output_file.string(), {0, 0},
+                    std::string()});
+  }
+
+  auto render_start = std::chrono::steady_clock::now();
+  midiaud::RenderInParallel(jobs, settings, threads);
+  std::chrono::duration<double> render_duration =
+      std::chrono::steady_clock::now() - render_start;
+
+  size_t total_events = 0;
+  int failures = 0;
+  for (const midiaud::RenderJob &job : jobs) {
+    if (job.error.empty()) {
+      std::cout << job.input_file << ": " << job.result.events
+                << " events in " << job.result.frames << " frames\n";
+      total_events += job.result.events;
+    } else {
+      std::cerr << job.input_file << ": " << job.error << "\n";
+      ++failures;
+    }
+  }
+  std::cout << "Rendered " << total_events << " events from "
+            << jobs.size() - failures << " files in "
+            << render_duration.count() << " s ("
+            << total_events / render_duration.count() << " events/s)\n";
+  return failures == 0 ? 0 : -1;
 }
 
 int main(int argc, char *argv[]) {
@@ -45,14 +430,57 @@ int main(int argc, char *argv[]) {
        "Jack port name")
       ("destination-port,d", po::value<std::string>(),
        "Destination for MIDI output")
+      ("input-port,i", po::value<std::string>(),
+       "Jack port name for MIDI input merged into the output")
+      ("source-port", po::value<std::string>(),
+       "Source for MIDI input")
+      ("thru-channel", po::value<int>(),
+       "send every message from the MIDI input to this channel (1-16)")
+      ("clock-port", po::value<std::string>(),
+       "Jack port name for MIDI clock and song position output")
+      ("clock-destination", po::value<std::string>(),
+       "Destination for MIDI clock output")
       ("master,m", "become Jack timebase master")
+      ("follow", "play in the bars and beats of the timebase master "
+       "instead of at the tempo of the file")
       ("watch,w", "watch input file for changes")
+      ("stream", "decode the input file during playback with bounded "
+       "memory instead of loading it up front")
+      ("control,s", po::value<std::string>(),
+       "listen for commands on this Unix domain socket")
+      ("tempo-scale,t", po::value<double>(),
+       "play at this fraction of the notated tempo")
+      ("prerender", "lay out the file at the frames of the Jack sample "
+       "rate when it is loaded, so that periods at the notated tempo copy "
+       "ready-made runs of events")
+      ("setup-budget", po::value<size_t>()->default_value(
+           size_t{midiaud::JackMidiPlayer::kDefaultSetupBudget}),
+       "bytes of SysEx setup data written per period while the transport "
+       "is starting")
+      ("fatal-errors", po::value<std::string>(),
+       "comma separated list of RT errors that stop playback "
+       "(no-buffer, buffer-full, queue-overflow, underrun), others are only "
+       "logged; default: no-buffer,queue-overflow")
+      ("trace", po::value<std::string>(),
+       "capture every Jack cycle into this file for midiaud-replay")
+      ("record", po::value<std::string>(),
+       "record the MIDI input into this Standard MIDI File while the "
+       "transport is rolling")
+      ("no-stats", "do not publish statistics for midiaud-top")
+      ("render", po::value<fs::path>(),
+       "render the input files into this directory without Jack, "
+       "as fast as possible")
+      ("buffer-size", po::value<jack_nframes_t>()->default_value(256),
+       "simulated Jack buffer size for --render")
+      ("sample-rate", po::value<jack_nframes_t>()->default_value(48000),
+       "simulated sample rate for --render")
+      ("jobs,j", po::value<unsigned>()->default_value(0),
+       "number of files to render in parallel, 0 for one per core")
       ;
 
   po::options_description hidden_options_desc;
   hidden_options_desc.add_options()
-      ("input-file", po::value<fs::path>()->required(),
-       "input file")
+      ("input-file", po::value<std::vector<fs::path>>(), "input file")
       ;
 
   po::options_description options_desc;
@@ -80,6 +508,16 @@ int main(int argc, char *argv[]) {
     }
     // Now we can raise pending exceptions.
     po::notify(vm);
+    // When controlled through a socket, the file may be loaded later.
+    if (vm.count("input-file") == 0 && vm.count("control") == 0)
+      throw po::required_option("input-file");
+    if (vm.count("input-file") > 0 && vm.count("render") == 0
+        && vm["input-file"].as<std::vector<fs::path>>().size() > 1)
+      throw std::invalid_argument("only one input file can be played");
+    if (vm.count("record") > 0 && vm.count("input-port") == 0)
+      throw std::invalid_argument("--record needs --input-port");
+    if (vm.count("follow") > 0 && vm.count("master") > 0)
+      throw std::invalid_argument("--follow cannot follow itself as --master");
   } catch (std::exception &e) {
     // Command-line options are probably malformed, better print usage
     // as well as exceptions message.
@@ -91,17 +529,69 @@ int main(int argc, char *argv[]) {
 
   std::string client_name(vm["client"].as<std::string>());
   std::string port_name(vm["port"].as<std::string>());
-  fs::path input_file(vm["input-file"].as<fs::path>());
   bool watch = (vm.count("watch") > 0);
 
   try {
+    if (vm.count("render") > 0) return run_render(vm);
+
     midi_player.reset(new midiaud::JackMidiPlayer(client_name, port_name));
-    midi_player->EmplaceSmfStreamer(input_file.string());
+    if (vm.count("trace") > 0) {
+      cycle_trace.reset(new midiaud::CycleTraceWriter(
+          vm["trace"].as<std::string>()));
+      midi_player->set_cycle_trace(cycle_trace.get());
+    }
+    if (vm.count("record") > 0) {
+      midi_recorder.reset(new midiaud::MidiRecorder(
+          vm["record"].as<std::string>()));
+      midi_player->set_recorder(midi_recorder.get());
+    }
+    if (vm.count("no-stats") == 0) {
+      // Monitoring is optional, playback goes on without it.
+      try {
+        stats_page.reset(new midiaud::StatsPage(client_name));
+        midi_player->set_stats_page(stats_page.get());
+      } catch (std::exception &e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+      }
+    }
+    if (vm.count("fatal-errors") > 0) {
+      midiaud::RtErrorPolicy error_policy;
+      error_policy.SetFatalList(vm["fatal-errors"].as<std::string>());
+      midi_player->set_error_policy(error_policy);
+    }
+    midi_player->set_setup_budget(vm["setup-budget"].as<size_t>());
+    midi_player->set_follow_bbt(vm.count("follow") > 0);
+    if (vm.count("input-port") > 0) {
+      midi_player->RegisterInputPort(vm["input-port"].as<std::string>());
+      if (vm.count("thru-channel") > 0) {
+        int thru_channel = vm["thru-channel"].as<int>();
+        if (thru_channel < 1 || thru_channel > 16)
+          throw std::invalid_argument("invalid thru channel");
+        midi_player->SetThruChannel(thru_channel - 1);
+      }
+    }
+    if (vm.count("clock-port") > 0)
+      midi_player->RegisterClockPort(vm["clock-port"].as<std::string>());
+    double tempo_scale = 1;
+    if (vm.count("tempo-scale") > 0) {
+      tempo_scale = std::max(double{midiaud::timebase::TimeScale::kMinScale},
+                             vm["tempo-scale"].as<double>());
+      midi_player->PostCommand({midiaud::PlaybackCommand::kSetTempoScale,
+                                0, tempo_scale});
+    }
+    LoadedFile loaded{fs::path(), midiaud::SmfStreamer(), 0, 0, 0,
+                      vm.count("stream") > 0, vm.count("prerender") > 0,
+                      tempo_scale, {}};
+    // The client is activated with the empty streamer right away, the
+    // file replaces it once it is parsed.
+    if (vm.count("input-file") > 0) {
+      load_file_async(loaded,
+                      vm["input-file"].as<std::vector<fs::path>>().front());
+    }
 
-    time_t last_load_time;
+    size_t logged_recorder_drops = 0;
     constexpr int max_reload_retries = 5;
     int reload_retries = 0;
-    std::time(&last_load_time);
     std::signal(SIGINT, &signal_handler);
 
     midi_player->Activate();
@@ -111,21 +601,53 @@ int main(int argc, char *argv[]) {
       std::string destination_port(vm["destination-port"].as<std::string>());
       midi_player->ConnectPort(destination_port);
     }
+    if (vm.count("clock-destination") > 0 && vm.count("clock-port") > 0) {
+      midi_player->ConnectClockPort(
+          vm["clock-destination"].as<std::string>());
+    }
+    if (vm.count("source-port") > 0 && vm.count("input-port") > 0) {
+      std::string source_port(vm["source-port"].as<std::string>());
+      midi_player->ConnectInputPort(source_port);
+    }
 
     if (vm.count("master") > 0) {
       midi_player->SetTimebaseMaster(false);
     }
 
+    std::unique_ptr<midiaud::ControlServer> control_server;
+    if (vm.count("control") > 0) {
+      control_server.reset(new midiaud::ControlServer(
+          vm["control"].as<std::string>(),
+          [&loaded](const std::string &command) {
+            return handle_control_command(loaded, command);
+          }));
+    }
+
     while (midi_player->keep_running()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds{10});
-      if (watch) {
-        time_t last_modified = fs::last_write_time(input_file);
-        if (std::difftime(last_load_time, last_modified) < 0) {
+      if (control_server) {
+        control_server->Poll(10);
+      } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      }
+      midi_player->DrainErrors();
+      if (midi_recorder) log_recorder_drops(logged_recorder_drops);
+      poll_pending_load(loaded);
+      if (loaded.prerender && !loaded.input_file.empty()
+          && !loaded.streaming
+          && loaded.streamer.prerendered_rate()
+              != midi_player->sample_rate()) {
+        // The layout only suits the sample rate it was made for.
+        std::cerr << "Sample rate changed, prerendering again" << std::endl;
+        publish_streamer(loaded);
+      }
+      if (watch && !loaded.input_file.empty()
+          && !loaded.pending_load.valid()) {
+        time_t last_modified = fs::last_write_time(loaded.input_file);
+        if (std::difftime(loaded.last_load_time, last_modified) < 0) {
           if (reload_retries == 0)
-            std::cerr << "Reloading " << input_file << std::endl;
+            std::cerr << "Reloading " << loaded.input_file << std::endl;
           try {
-            midi_player->EmplaceSmfStreamer(input_file.string());
-            std::time(&last_load_time);
+            reload_file(loaded);
             reload_retries = 0;
           } catch (...) {
             // The reload of the MIDI file may have failed because the
@@ -139,6 +661,17 @@ int main(int argc, char *argv[]) {
     }
 
     midi_player->Deactivate();
+    if (cycle_trace) cycle_trace->Close();
+    if (midi_recorder) {
+      midi_recorder->Close();
+      std::cerr << "Recorded " << midi_recorder->recorded_events()
+                << " messages, dropped "
+                << midi_recorder->dropped_events()
+                << " that did not fit into the ring and "
+                << midi_recorder->oversized_events() << " longer than "
+                << size_t{midiaud::RecordedEvent::kMaxSize} << " bytes"
+                << std::endl;
+    }
 
     return 0;
   } catch (std::exception &e) {
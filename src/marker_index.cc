@@ -0,0 +1,81 @@
+
+#include "marker_index.h"
+
+#include <algorithm>
+
+namespace midiaud {
+
+namespace {
+
+const char kWhitespace[] = " \t\r\n";
+
+/**
+ * Returns the text of a metaevent, whose length is stored with
+ * variable-length encoding after its type.
+ */
+std::string MetaeventText(const MidiBuffer &midi) {
+  size_t offset = 2;
+  size_t length = 0;
+  while (offset < midi.size()) {
+    uint8_t byte = midi[offset++];
+    length = (length << 7) | (byte & 0x7f);
+    if ((byte & 0x80) == 0) break;
+  }
+  length = std::min(length, midi.size() - std::min(offset, midi.size()));
+  std::string text(midi.begin() + offset, midi.begin() + offset + length);
+  // Some editors pad the text or terminate it like a C string.
+  text.erase(std::find(text.begin(), text.end(), '\0'), text.end());
+  size_t first = text.find_first_not_of(kWhitespace);
+  if (first == std::string::npos) return std::string();
+  return text.substr(first, text.find_last_not_of(kWhitespace) - first + 1);
+}
+
+}
+
+MarkerIndex::MarkerIndex() {
+}
+
+MarkerIndex::MarkerIndex(const std::vector<Event> &metaevents,
+                         const timebase::TempoMap &tempo_map) {
+  for (const Event &event : metaevents) {
+    if (!IsMarkerEvent(event)) continue;
+    Marker::Type type = static_cast<Marker::Type>(event.midi()[1]);
+    if (type != Marker::kLyric)
+      cues_.push_back(static_cast<uint32_t>(markers_.size()));
+    markers_.push_back({type, event.ticks(),
+                        tempo_map.GetTicks(event.ticks()).seconds(),
+                        MetaeventText(event.midi())});
+  }
+  by_name_.resize(markers_.size());
+  for (size_t i = 0; i < by_name_.size(); ++i)
+    by_name_[i] = static_cast<uint32_t>(i);
+  std::stable_sort(by_name_.begin(), by_name_.end(),
+                   [this](uint32_t lhs, uint32_t rhs) {
+                     return markers_[lhs].text < markers_[rhs].text;
+                   });
+}
+
+bool MarkerIndex::IsMarkerEvent(const Event &event) {
+  return event.is_metadata() && event.midi().size() > 2
+      && (event.midi()[1] == Marker::kLyric
+          || event.midi()[1] == Marker::kMarker
+          || event.midi()[1] == Marker::kCuePoint);
+}
+
+const Marker *MarkerIndex::FindName(const std::string &name) const {
+  auto found = std::lower_bound(
+      by_name_.cbegin(), by_name_.cend(), name,
+      [this](uint32_t index, const std::string &name) {
+        return markers_[index].text < name;
+      });
+  if (found == by_name_.cend() || markers_[*found].text != name)
+    return nullptr;
+  return &markers_[*found];
+}
+
+const Marker *MarkerIndex::FindNumber(size_t number) const {
+  if (number < 1 || number > cues_.size()) return nullptr;
+  return &markers_[cues_[number - 1]];
+}
+
+}
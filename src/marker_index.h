@@ -0,0 +1,95 @@
+#ifndef MARKER_INDEX_H_
+#define MARKER_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "event.h"
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * A named position of the file, taken from a marker, cue point or
+ * lyric metaevent.
+ */
+struct Marker {
+  enum Type : uint8_t {
+    kLyric = 0x05,
+    kMarker = 0x06,
+    kCuePoint = 0x07
+  };
+
+  Type type;
+  double ticks;
+  double seconds;
+  /**
+   * Text of the metaevent without surrounding whitespace.
+   */
+  std::string text;
+};
+
+/**
+ * The markers, cue points and lyrics of a file, sorted by time and by
+ * text, so that cues can be looked up by name without walking the
+ * file.
+ *
+ * Immutable once built, thus it can be shared by the copies of a
+ * streamer like the tempo map.
+ */
+class MarkerIndex {
+ public:
+  /**
+   * Builds an empty index.
+   */
+  MarkerIndex();
+  /**
+   * Indexes the marker, cue point and lyric metaevents of `metaevents`,
+   * which must be in the order of the file. Other events are ignored.
+   */
+  MarkerIndex(const std::vector<Event> &metaevents,
+              const timebase::TempoMap &tempo_map);
+
+  /**
+   * Returns whether `event` is a metaevent the index cares about.
+   */
+  static bool IsMarkerEvent(const Event &event);
+
+  /**
+   * Returns the earliest marker, cue point or lyric with the text
+   * `name`, or nullptr if there is none. Takes logarithmic time.
+   */
+  const Marker *FindName(const std::string &name) const;
+  /**
+   * Returns the marker or cue point `number`, counting from 1 in the
+   * order of the file, or nullptr if there is none. Lyrics are not
+   * numbered.
+   */
+  const Marker *FindNumber(size_t number) const;
+
+  size_t size() const { return markers_.size(); }
+  /**
+   * Number of markers and cue points.
+   */
+  size_t cue_count() const { return cues_.size(); }
+
+ private:
+  /**
+   * Sorted by time, ties in the order of the file.
+   */
+  std::vector<Marker> markers_;
+  /**
+   * Indices of the markers and cue points in `markers_`.
+   */
+  std::vector<uint32_t> cues_;
+  /**
+   * Indices of `markers_`, sorted by text and then by time.
+   */
+  std::vector<uint32_t> by_name_;
+};
+
+}
+
+#endif // MARKER_INDEX_H_
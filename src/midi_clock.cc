@@ -0,0 +1,127 @@
+
+#include "midi_clock.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace midiaud {
+
+namespace {
+
+constexpr uint8_t kClock = 0xf8;
+constexpr uint8_t kStart = 0xfa;
+constexpr uint8_t kContinue = 0xfb;
+constexpr uint8_t kStop = 0xfc;
+constexpr uint8_t kSongPositionPointer = 0xf2;
+constexpr uint64_t kMaxSongPosition = 0x3fff;
+/**
+ * Positions this close after a sixteenth note still count as being on
+ * it, so that rounding errors do not skip a whole sixteenth note.
+ */
+constexpr double kTicksEpsilon = 1e-6;
+
+RtStatus WriteRealtime(MidiSink &sink, jack_nframes_t offset,
+                       uint8_t message) noexcept {
+  return sink.WriteMidiAt(offset, &message, 1);
+}
+
+RtStatus WriteSongPosition(MidiSink &sink, uint64_t sixteenth) noexcept {
+  uint16_t position = static_cast<uint16_t>(
+      std::min(sixteenth, kMaxSongPosition));
+  uint8_t message[] = {
+    kSongPositionPointer, static_cast<uint8_t>(position & 0x7f),
+    static_cast<uint8_t>((position >> 7) & 0x7f)
+  };
+  return sink.WriteMidiAt(0, message, sizeof(message));
+}
+
+}
+
+MidiClock::MidiClock()
+    : rolling_(false), expected_frame_(0), next_clock_(0),
+      pointer_sent_(false), pointer_frame_(0) {
+}
+
+RtStatus MidiClock::Process(bool now_playing, jack_nframes_t frame,
+                            jack_nframes_t nframes,
+                            const timebase::TempoMap &tempo_map,
+                            const timebase::TimeScale &time_scale,
+                            MidiSink &sink) noexcept {
+  RtStatus status = RtStatus::kOk;
+  auto update_status = [&status](RtStatus write_status) {
+    if (status == RtStatus::kOk) status = write_status;
+  };
+  jack_nframes_t framerate = sink.framerate();
+
+  // Relocations normally stop the transport while the clients sync,
+  // but a jump without stopping has to restart the clock too.
+  if (rolling_ && (!now_playing || frame != expected_frame_)) {
+    update_status(WriteRealtime(sink, 0, kStop));
+    rolling_ = false;
+    pointer_sent_ = false;
+  }
+
+  if (!now_playing) {
+    // Send the position early, receivers may need time to seek.
+    if (!pointer_sent_ || pointer_frame_ != frame) {
+      uint64_t sixteenth = SixteenthAt(frame, framerate, tempo_map,
+                                       time_scale);
+      update_status(WriteSongPosition(sink, sixteenth));
+      pointer_sent_ = true;
+      pointer_frame_ = frame;
+    }
+    return status;
+  }
+
+  if (!rolling_) {
+    uint64_t sixteenth = SixteenthAt(frame, framerate, tempo_map,
+                                     time_scale);
+    if (sixteenth == 0) {
+      update_status(WriteRealtime(sink, 0, kStart));
+    } else {
+      if (!pointer_sent_ || pointer_frame_ != frame)
+        update_status(WriteSongPosition(sink, sixteenth));
+      update_status(WriteRealtime(sink, 0, kContinue));
+    }
+    next_clock_ = sixteenth * kClocksPerSixteenth;
+    rolling_ = true;
+    pointer_sent_ = false;
+  }
+
+  int64_t end_frame = static_cast<int64_t>(frame) + nframes;
+  for (;;) {
+    int64_t clock_frame = ClockFrame(next_clock_, framerate, tempo_map,
+                                     time_scale);
+    if (clock_frame >= end_frame) break;
+    jack_nframes_t offset = static_cast<jack_nframes_t>(
+        std::max<int64_t>(0, clock_frame - frame));
+    update_status(WriteRealtime(sink, offset, kClock));
+    ++next_clock_;
+  }
+  expected_frame_ = frame + nframes;
+  return status;
+}
+
+uint64_t MidiClock::SixteenthAt(jack_nframes_t frame,
+                                jack_nframes_t framerate,
+                                const timebase::TempoMap &tempo_map,
+                                const timebase::TimeScale &time_scale) noexcept {
+  double transport_seconds = static_cast<double>(frame) / framerate;
+  double file_seconds = time_scale.ToFileSeconds(transport_seconds);
+  if (file_seconds <= 0) return 0;
+  double ticks = tempo_map.GetSeconds(file_seconds).ticks();
+  double ticks_per_sixteenth = tempo_map.ppqn() / 4;
+  return static_cast<uint64_t>(
+      std::ceil(ticks / ticks_per_sixteenth - kTicksEpsilon));
+}
+
+int64_t MidiClock::ClockFrame(uint64_t clock, jack_nframes_t framerate,
+                              const timebase::TempoMap &tempo_map,
+                              const timebase::TimeScale &time_scale) noexcept {
+  double ticks = clock * tempo_map.ppqn() / kClocksPerQuarter;
+  double file_seconds = tempo_map.GetTicks(ticks).seconds();
+  double transport_seconds = time_scale.ToTransportSeconds(file_seconds);
+  return std::llround(transport_seconds * framerate);
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef MIDI_CLOCK_H_
+#define MIDI_CLOCK_H_
+
+#include <cstdint>
+
+#include <jack/jack.h>
+
+#include "midi_sink.h"
+#include "rt_status.h"
+#include "timebase/tempo_map.h"
+#include "timebase/time_scale.h"
+
+namespace midiaud {
+
+/**
+ * Generates 24 PPQN MIDI clock and the matching transport messages
+ * from the tempo map of the played file.
+ *
+ * The frame of every clock is computed from its absolute musical
+ * position, so clocks fall on exact frames and no error accumulates
+ * across cycles. When the transport is relocated, a Song Position
+ * Pointer is sent for the next sixteenth note, and clocking resumes
+ * with Continue exactly at that sixteenth note.
+ */
+class MidiClock {
+ public:
+  static constexpr int kClocksPerQuarter = 24;
+  static constexpr int kClocksPerSixteenth = 6;
+
+  MidiClock();
+
+  /**
+   * Writes the clock messages due in a cycle. For RT thread.
+   *
+   * @param now_playing whether the transport is rolling.
+   * @param frame the transport frame at the start of the cycle.
+   * @returns the first failure to write a message.
+   */
+  RtStatus Process(bool now_playing, jack_nframes_t frame,
+                   jack_nframes_t nframes,
+                   const timebase::TempoMap &tempo_map,
+                   const timebase::TimeScale &time_scale,
+                   MidiSink &sink) noexcept;
+
+ private:
+  /**
+   * Returns the number of the first sixteenth note at or after
+   * `frame`.
+   */
+  static uint64_t SixteenthAt(jack_nframes_t frame, jack_nframes_t framerate,
+                              const timebase::TempoMap &tempo_map,
+                              const timebase::TimeScale &time_scale) noexcept;
+  /**
+   * Returns the frame of clock number `clock`.
+   */
+  static int64_t ClockFrame(uint64_t clock, jack_nframes_t framerate,
+                            const timebase::TempoMap &tempo_map,
+                            const timebase::TimeScale &time_scale) noexcept;
+
+  bool rolling_;
+  /**
+   * Frame where the next cycle starts if the transport keeps rolling.
+   */
+  jack_nframes_t expected_frame_;
+  uint64_t next_clock_;
+  /**
+   * Whether a Song Position Pointer was sent for `pointer_frame_`
+   * while the transport was stopped.
+   */
+  bool pointer_sent_;
+  jack_nframes_t pointer_frame_;
+};
+
+}
+
+#endif // MIDI_CLOCK_H_
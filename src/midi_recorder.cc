@@ -0,0 +1,186 @@
+
+#include "midi_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace midiaud {
+
+namespace {
+
+/**
+ * MThd chunk of a format 0 file and the header of its track chunk.
+ * The division and the size of the track are filled in by Close().
+ */
+constexpr uint8_t kHeader[] = {
+  'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 0,
+  'M', 'T', 'r', 'k', 0, 0, 0, 0
+};
+constexpr std::streamoff kDivisionOffset = 12;
+constexpr std::streamoff kTrackSizeOffset = 18;
+
+void WriteBigEndian(std::ostream &output, uint32_t value, int size) {
+  for (int i = size - 1; i >= 0; --i)
+    output.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+}
+
+MidiRecorder::MidiRecorder(const std::string &filename)
+    : output_(filename, std::ios::binary | std::ios::trunc),
+      recorded_events_(0), dropped_events_(0), oversized_events_(0),
+      stop_(false), tempo_map_(std::make_shared<timebase::TempoMap>()),
+      tempo_map_fixed_(false), next_position_(0), last_ticks_(0),
+      track_size_(0) {
+  if (!output_)
+    throw std::runtime_error("cannot open " + filename);
+  output_.write(reinterpret_cast<const char *>(kHeader), sizeof(kHeader));
+  thread_ = std::thread(&MidiRecorder::Run, this);
+}
+
+MidiRecorder::~MidiRecorder() {
+  try {
+    Close();
+  } catch (...) {
+  }
+}
+
+void MidiRecorder::SetTempoMap(
+    std::shared_ptr<const timebase::TempoMap> tempo_map) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!tempo_map_fixed_) tempo_map_ = std::move(tempo_map);
+}
+
+void MidiRecorder::Close() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_one();
+  thread_.join();
+
+  const uint8_t end_of_track[] = {0xff, 0x2f, 0x00};
+  WriteEvent(last_ticks_, end_of_track, sizeof(end_of_track));
+  uint16_t division = static_cast<uint16_t>(std::lround(tempo_map_->ppqn()));
+  output_.seekp(kDivisionOffset);
+  WriteBigEndian(output_, division, 2);
+  output_.seekp(kTrackSizeOffset);
+  WriteBigEndian(output_, track_size_, 4);
+  output_.close();
+  if (!output_)
+    throw std::runtime_error("cannot write recording");
+}
+
+void MidiRecorder::Record(double file_seconds, const uint8_t *data,
+                          size_t size) noexcept {
+  if (size == 0 || data[0] >= 0xf8) return;
+  if (size > RecordedEvent::kMaxSize) {
+    oversized_events_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  RecordedEvent event;
+  event.file_seconds = file_seconds;
+  event.size = static_cast<uint16_t>(size);
+  std::memcpy(event.data, data, size);
+  if (!ring_.Push(event))
+    dropped_events_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MidiRecorder::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    stop_condition_.wait_for(lock, std::chrono::milliseconds{20});
+    lock.unlock();
+    Flush();
+    lock.lock();
+  }
+  lock.unlock();
+  Flush();
+}
+
+void MidiRecorder::Flush() {
+  RecordedEvent event;
+  if (!ring_.Pop(event)) return;
+  {
+    // From now on the main thread leaves tempo_map_ alone.
+    std::lock_guard<std::mutex> lock(mutex_);
+    tempo_map_fixed_ = true;
+  }
+  do {
+    // Tracks cannot go back in time: after the transport was moved
+    // back, messages are appended at the end of the recording.
+    double ticks = std::max(
+        tempo_map_->GetSeconds(event.file_seconds).ticks(),
+        static_cast<double>(last_ticks_));
+    WriteTempoMapUntil(ticks);
+    WriteEvent(ticks, event.data, event.size);
+    recorded_events_.fetch_add(1, std::memory_order_relaxed);
+  } while (ring_.Pop(event));
+  output_.flush();
+}
+
+void MidiRecorder::WriteTempoMapUntil(double ticks) {
+  while (next_position_ < tempo_map_->size()) {
+    const timebase::Position &position =
+        *(tempo_map_->begin() + next_position_);
+    if (position.ticks() > ticks) return;
+    uint32_t tempo = static_cast<uint32_t>(
+        std::lround(position.microseconds_per_midi_quarter()));
+    const uint8_t tempo_event[] = {
+      0xff, 0x51, 0x03, static_cast<uint8_t>(tempo >> 16),
+      static_cast<uint8_t>(tempo >> 8), static_cast<uint8_t>(tempo)
+    };
+    WriteEvent(position.ticks(), tempo_event, sizeof(tempo_event));
+    const uint8_t meter_event[] = {
+      0xff, 0x58, 0x04, static_cast<uint8_t>(position.beats_per_bar()),
+      static_cast<uint8_t>(std::lround(std::log2(position.beat_type()))),
+      24, static_cast<uint8_t>(std::lround(
+          position.beats_per_midi_quarter() * 32 / position.beat_type()))
+    };
+    WriteEvent(position.ticks(), meter_event, sizeof(meter_event));
+    ++next_position_;
+  }
+}
+
+void MidiRecorder::WriteEvent(double ticks, const uint8_t *data,
+                              size_t size) {
+  uint64_t whole_ticks = std::max<uint64_t>(std::llround(ticks),
+                                            last_ticks_);
+  WriteVariableLength(static_cast<uint32_t>(whole_ticks - last_ticks_));
+  last_ticks_ = whole_ticks;
+  if (data[0] == 0xf0 || (data[0] > 0xf0 && data[0] < 0xff)) {
+    // SysEx is stored without its leading F0, other system messages
+    // have to be escaped with F7.
+    bool sysex = data[0] == 0xf0;
+    output_.put(static_cast<char>(sysex ? 0xf0 : 0xf7));
+    ++track_size_;
+    if (sysex) {
+      ++data;
+      --size;
+    }
+    WriteVariableLength(static_cast<uint32_t>(size));
+  }
+  output_.write(reinterpret_cast<const char *>(data), size);
+  track_size_ += size;
+}
+
+void MidiRecorder::WriteVariableLength(uint32_t value) {
+  uint8_t bytes[5];
+  int count = 0;
+  do {
+    bytes[count++] = value & 0x7f;
+    value >>= 7;
+  } while (value != 0);
+  while (count > 1) {
+    output_.put(static_cast<char>(bytes[--count] | 0x80));
+    ++track_size_;
+  }
+  output_.put(static_cast<char>(bytes[0]));
+  ++track_size_;
+}
+
+}
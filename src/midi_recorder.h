@@ -0,0 +1,138 @@
+#ifndef MIDI_RECORDER_H_
+#define MIDI_RECORDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * A message received from the input port while the transport was
+ * rolling.
+ */
+struct RecordedEvent {
+  static constexpr size_t kMaxSize = 22;
+
+  /**
+   * Time of the message on the timeline of the played file.
+   */
+  double file_seconds;
+  uint16_t size;
+  uint8_t data[kMaxSize];
+};
+
+static_assert(sizeof(RecordedEvent) == 32, "unexpected RecordedEvent padding");
+
+/**
+ * Records the MIDI input into a Standard MIDI File, in the bars and
+ * beats of the played file.
+ *
+ * The RT thread pushes the messages into a preallocated lock-free
+ * ring without blocking, a background thread converts their times to
+ * ticks and appends them to the file as they arrive, so memory use
+ * does not grow with the length of the recording. Messages that do
+ * not fit into the ring or into a RecordedEvent are counted and
+ * dropped.
+ *
+ * The file has a single track, which starts with the tempo and meter
+ * changes of the played file up to the recorded messages, so that it
+ * lines up with the played file when imported.
+ */
+class MidiRecorder {
+ public:
+  static constexpr size_t kRingCapacity = 4096;
+
+  /**
+   * Creates the file and starts the writer thread.
+   */
+  explicit MidiRecorder(const std::string &filename);
+  MidiRecorder(const MidiRecorder &) = delete;
+  ~MidiRecorder();
+  MidiRecorder &operator=(const MidiRecorder &) = delete;
+
+  /**
+   * Sets the tempo map the recorded messages are placed by. Only the
+   * map set before the first message arrives is used, later ones are
+   * ignored so that the ticks of the recording stay consistent.
+   */
+  void SetTempoMap(std::shared_ptr<const timebase::TempoMap> tempo_map);
+  /**
+   * Writes the remaining messages, completes the file and stops the
+   * writer thread.
+   *
+   * @throws std::runtime_error if the file could not be written.
+   */
+  void Close();
+
+  /**
+   * Queues a message received `file_seconds` into the played file.
+   * System real-time messages are ignored. For RT thread.
+   */
+  void Record(double file_seconds, const uint8_t *data,
+              size_t size) noexcept;
+
+  size_t recorded_events() const {
+    return recorded_events_.load(std::memory_order_relaxed);
+  }
+  /**
+   * Messages lost because the writer thread did not keep up.
+   */
+  size_t dropped_events() const {
+    return dropped_events_.load(std::memory_order_relaxed);
+  }
+  /**
+   * Messages lost because they were longer than
+   * RecordedEvent::kMaxSize.
+   */
+  size_t oversized_events() const {
+    return oversized_events_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void Run();
+  /**
+   * Appends the queued messages to the file. For the writer thread.
+   */
+  void Flush();
+  /**
+   * Writes the tempo and meter changes up to `ticks`. For the writer
+   * thread.
+   */
+  void WriteTempoMapUntil(double ticks);
+  void WriteEvent(double ticks, const uint8_t *data, size_t size);
+  void WriteVariableLength(uint32_t value);
+
+  std::ofstream output_; // For writer thread after construction.
+  LockfreeQueue<RecordedEvent, kRingCapacity> ring_;
+  std::atomic<size_t> recorded_events_;
+  std::atomic<size_t> dropped_events_;
+  std::atomic<size_t> oversized_events_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_; // Guarded by mutex_.
+  std::shared_ptr<const timebase::TempoMap> tempo_map_; // Ditto.
+  bool tempo_map_fixed_; // Ditto.
+  /**
+   * Index of the next position of the tempo map to be written. For
+   * writer thread.
+   */
+  size_t next_position_;
+  uint64_t last_ticks_; // For writer thread.
+  uint32_t track_size_; // For writer thread.
+  std::thread thread_;
+};
+
+}
+
+#endif // MIDI_RECORDER_H_
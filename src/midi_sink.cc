@@ -0,0 +1,169 @@
+
+#include "midi_sink.h"
+
+namespace midiaud {
+
+MidiSink::MidiSink(jack_nframes_t framerate,
+                   ActiveNotes &active_notes) noexcept
+    : framerate_(framerate), active_notes_(active_notes),
+      trace_(nullptr), events_written_(0), bytes_written_(0) {
+}
+
+MidiSink::~MidiSink() {
+}
+
+RtStatus MidiSink::WriteMidi(double offset_seconds, const uint8_t *data,
+                             size_t size) noexcept {
+  jack_nframes_t offset =
+      static_cast<jack_nframes_t>(offset_seconds * framerate_);
+  return WriteMidiAt(offset, data, size);
+}
+
+RtStatus MidiSink::WriteMidiAt(jack_nframes_t offset, const uint8_t *data,
+                               size_t size) noexcept {
+  RtStatus status = WriteEvent(offset, data, size);
+  if (status == RtStatus::kOk) {
+    active_notes_.Update(data, size);
+    CountWritten(size);
+    if (trace_ != nullptr) trace_->RecordEvent(offset, data, size);
+  }
+  return status;
+}
+
+RtStatus MidiSink::WriteRunAt(const jack_nframes_t *offsets,
+                              const uint32_t *data_offsets,
+                              const uint8_t *bytes, size_t count) noexcept {
+  RtStatus status = RtStatus::kOk;
+  size_t index = 0;
+  while (index < count) {
+    RtStatus run_status = RtStatus::kOk;
+    size_t written = WriteEvents(offsets + index, data_offsets + index,
+                                 bytes, count - index, run_status);
+    for (size_t end = index + written; index < end; ++index) {
+      const uint8_t *data = bytes + data_offsets[index];
+      size_t size = data_offsets[index + 1] - data_offsets[index];
+      active_notes_.Update(data, size);
+      CountWritten(size);
+      if (trace_ != nullptr) trace_->RecordEvent(offsets[index], data, size);
+    }
+    if (index < count) {
+      // The event that failed is dropped.
+      if (status == RtStatus::kOk) status = run_status;
+      ++index;
+    }
+  }
+  return status;
+}
+
+size_t MidiSink::WriteEvents(const jack_nframes_t *offsets,
+                             const uint32_t *data_offsets,
+                             const uint8_t *bytes, size_t count,
+                             RtStatus &status) noexcept {
+  for (size_t i = 0; i < count; ++i) {
+    status = WriteEvent(offsets[i], bytes + data_offsets[i],
+                        data_offsets[i + 1] - data_offsets[i]);
+    if (status != RtStatus::kOk) return i;
+  }
+  return count;
+}
+
+RtStatus MidiSink::WriteProgramChange(double offset_seconds,
+                                      uint8_t channel,
+                                      uint8_t program) noexcept {
+  uint8_t buffer[] = {
+    static_cast<uint8_t>(0xc0 | channel), program
+  };
+  return WriteMidi(offset_seconds, buffer, sizeof(buffer));
+}
+
+RtStatus MidiSink::WriteNoteOn(double offset_seconds, uint8_t channel,
+                               uint8_t note, uint8_t velocity) noexcept {
+  uint8_t buffer[] = {
+    static_cast<uint8_t>(0x90 | channel), note, velocity
+  };
+  return WriteMidi(offset_seconds, buffer, sizeof(buffer));
+}
+
+RtStatus MidiSink::WritePitchWheelChange(double offset_seconds,
+                                         uint8_t channel,
+                                         uint16_t pitch) noexcept {
+  uint8_t least = static_cast<uint8_t>(pitch & 0x7f);
+  uint8_t most = static_cast<uint8_t>((pitch >> 7) & 0x7f);
+  uint8_t buffer[] = {
+    static_cast<uint8_t>(0xe0 | channel), least, most
+  };
+  return WriteMidi(offset_seconds, buffer, sizeof(buffer));
+}
+
+RtStatus MidiSink::WriteControlChange(double offset_seconds,
+                                      uint8_t channel, uint8_t control,
+                                      uint8_t value) noexcept {
+  uint8_t buffer[] = {
+    static_cast<uint8_t>(0xb0 | channel), control, value
+  };
+  return WriteMidi(offset_seconds, buffer, sizeof(buffer));
+}
+
+RtStatus MidiSink::WriteAllSoundOff(double offset_seconds,
+                                    uint8_t channel) noexcept {
+  return WriteControlChange(offset_seconds, channel, 0x78, 0x00);
+}
+
+RtStatus MidiSink::WriteGlobalSoundOff(double offset_seconds) noexcept {
+  RtStatus status = RtStatus::kOk;
+  for (uint8_t channel = 0; channel < 16; ++channel) {
+    RtStatus channel_status = WriteAllSoundOff(offset_seconds, channel);
+    if (status == RtStatus::kOk) status = channel_status;
+  }
+  return status;
+}
+
+RtStatus MidiSink::WriteResetAllControllers(double offset_seconds,
+                                            uint8_t channel) noexcept {
+  return WriteControlChange(offset_seconds, channel, 0x79, 0x00);
+}
+
+RtStatus MidiSink::WriteGlobalResetControllers(
+    double offset_seconds) noexcept {
+  RtStatus status = RtStatus::kOk;
+  for (uint8_t channel = 0; channel < 16; ++channel) {
+    RtStatus channel_status = WriteResetAllControllers(offset_seconds,
+                                                       channel);
+    if (status == RtStatus::kOk) status = channel_status;
+  }
+  return status;
+}
+
+RtStatus MidiSink::WriteActiveNotesOff(double offset_seconds) noexcept {
+  RtStatus status = RtStatus::kOk;
+  for (uint8_t channel = 0; channel < 16; ++channel) {
+    for (int word = 0; word < ActiveNotes::kWordsPerChannel; ++word) {
+      uint64_t notes = active_notes_.notes(channel, word);
+      while (notes != 0) {
+        int bit = __builtin_ctzll(notes);
+        notes &= notes - 1;
+        uint8_t buffer[] = {
+          static_cast<uint8_t>(0x80 | channel),
+          static_cast<uint8_t>(word * 64 + bit), 0
+        };
+        RtStatus note_status = WriteMidi(offset_seconds, buffer,
+                                         sizeof(buffer));
+        if (status == RtStatus::kOk) status = note_status;
+      }
+    }
+  }
+  uint32_t sustained = active_notes_.sustained();
+  while (sustained != 0) {
+    uint8_t channel = __builtin_ctz(sustained);
+    sustained &= sustained - 1;
+    RtStatus pedal_status = WriteControlChange(offset_seconds, channel,
+                                               0x40, 0x00);
+    if (status == RtStatus::kOk) status = pedal_status;
+  }
+  // Notes that could not be switched off are forgotten anyways, there
+  // is no point in trying again in later cycles.
+  active_notes_.Clear();
+  return status;
+}
+
+}
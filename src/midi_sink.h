@@ -0,0 +1,125 @@
+#ifndef MIDI_SINK_H_
+#define MIDI_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <jack/jack.h>
+
+#include "active_notes.h"
+#include "cycle_trace.h"
+#include "rt_status.h"
+
+namespace midiaud {
+
+/**
+ * Destination of the MIDI events of one cycle.
+ *
+ * Used from the RT thread, hence nothing here throws. Subclasses only
+ * have to store single events, the helpers for composing messages
+ * and tracking the sounding notes are shared.
+ */
+class MidiSink {
+ public:
+  /**
+   * @param active_notes the notes sounding before this cycle, updated
+   *        with every event written.
+   */
+  MidiSink(jack_nframes_t framerate, ActiveNotes &active_notes) noexcept;
+  MidiSink(const MidiSink &) = delete;
+  virtual ~MidiSink();
+  MidiSink &operator=(const MidiSink &) = delete;
+
+  RtStatus WriteMidi(double offset_seconds,
+                     const uint8_t *data, size_t size) noexcept;
+  /**
+   * Like WriteMidi(), but `offset` is given in frames, for events
+   * whose frame is already known exactly.
+   */
+  RtStatus WriteMidiAt(jack_nframes_t offset,
+                       const uint8_t *data, size_t size) noexcept;
+  /**
+   * Writes a run of `count` events whose frames are already known,
+   * like as many WriteMidiAt() calls. Event `i` is due `offsets[i]`
+   * frames into the cycle, its bytes are those from `data_offsets[i]`
+   * to `data_offsets[i + 1]` in `bytes`.
+   *
+   * Events that cannot be written are dropped, and the first failure
+   * is returned.
+   */
+  RtStatus WriteRunAt(const jack_nframes_t *offsets,
+                      const uint32_t *data_offsets, const uint8_t *bytes,
+                      size_t count) noexcept;
+  RtStatus WriteProgramChange(double offset_seconds,
+                              uint8_t channel, uint8_t program) noexcept;
+  RtStatus WriteNoteOn(double offset_seconds, uint8_t channel,
+                       uint8_t note, uint8_t velocity) noexcept;
+  RtStatus WritePitchWheelChange(double offset_seconds,
+                                 uint8_t channel, uint16_t pitch) noexcept;
+  RtStatus WriteControlChange(double offset_seconds,
+                              uint8_t channel, uint8_t control,
+                              uint8_t value) noexcept;
+  RtStatus WriteAllSoundOff(double offset_seconds,
+                            uint8_t channel) noexcept;
+  RtStatus WriteGlobalSoundOff(double offset_seconds) noexcept;
+  RtStatus WriteResetAllControllers(double offset_seconds,
+                                    uint8_t channel) noexcept;
+  RtStatus WriteGlobalResetControllers(double offset_seconds) noexcept;
+  /**
+   * Sends note offs for the sounding notes and releases the held
+   * sustain pedals. Nothing is sent for silent channels.
+   */
+  RtStatus WriteActiveNotesOff(double offset_seconds) noexcept;
+
+  jack_nframes_t framerate() const { return framerate_; }
+  /**
+   * Number and total size of the events written so far.
+   */
+  size_t events_written() const { return events_written_; }
+  size_t bytes_written() const { return bytes_written_; }
+  /**
+   * Records every event written through WriteMidi() into `trace`,
+   * unless it is nullptr.
+   */
+  void set_trace(CycleTraceWriter *trace) { trace_ = trace; }
+
+ protected:
+  /**
+   * Stores a single event `offset` frames after the start of the
+   * cycle. Offsets are nondecreasing across calls.
+   */
+  virtual RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                              size_t size) noexcept = 0;
+  /**
+   * Stores the events of a run, laid out as for WriteRunAt(), until
+   * one of them fails. Subclasses may store them in bulk, by default
+   * they are passed to WriteEvent() one by one.
+   *
+   * @param status set to the failure, if any.
+   * @returns the number of events stored before the failure.
+   */
+  virtual size_t WriteEvents(const jack_nframes_t *offsets,
+                             const uint32_t *data_offsets,
+                             const uint8_t *bytes, size_t count,
+                             RtStatus &status) noexcept;
+
+  ActiveNotes &active_notes() { return active_notes_; }
+  /**
+   * Accounts for an event written bypassing WriteMidiAt().
+   */
+  void CountWritten(size_t size) {
+    ++events_written_;
+    bytes_written_ += size;
+  }
+
+ private:
+  jack_nframes_t framerate_;
+  ActiveNotes &active_notes_;
+  CycleTraceWriter *trace_;
+  size_t events_written_;
+  size_t bytes_written_;
+};
+
+}
+
+#endif // MIDI_SINK_H_
@@ -0,0 +1,109 @@
+
+#include "offline_renderer.h"
+
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+
+#include "active_notes.h"
+#include "midi_sink.h"
+#include "parallel.h"
+#include "playback_control.h"
+#include "smf_streamer.h"
+#include "timebase/time_scale.h"
+
+namespace midiaud {
+
+namespace {
+
+void WriteLittleEndian(std::ostream &output, uint64_t value, int bytes) {
+  char buffer[8];
+  for (int i = 0; i < bytes; ++i)
+    buffer[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  output.write(buffer, bytes);
+}
+
+/**
+ * Appends the events of a simulated cycle to an event log.
+ */
+class RenderSink : public MidiSink {
+ public:
+  RenderSink(std::ostream &output, jack_nframes_t cycle_start,
+             jack_nframes_t framerate, ActiveNotes &active_notes) noexcept
+      : MidiSink(framerate, active_notes), output_(output),
+        cycle_start_(cycle_start), events_(0) {
+  }
+
+  size_t events() const { return events_; }
+
+ protected:
+  RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                      size_t size) noexcept override {
+    WriteLittleEndian(output_, static_cast<uint64_t>(cycle_start_) + offset,
+                      8);
+    WriteLittleEndian(output_, size, 4);
+    output_.write(reinterpret_cast<const char *>(data), size);
+    ++events_;
+    return RtStatus::kOk;
+  }
+
+ private:
+  std::ostream &output_;
+  jack_nframes_t cycle_start_;
+  size_t events_;
+};
+
+}
+
+RenderResult RenderFile(const std::string &input_file,
+                        const std::string &output_file,
+                        const RenderSettings &settings) {
+  SmfStreamer smf_streamer(input_file);
+  std::ofstream output(output_file, std::ios::binary | std::ios::trunc);
+  if (!output)
+    throw std::runtime_error("cannot open " + output_file);
+  output.write("MIDIAUDL", 8);
+  WriteLittleEndian(output, settings.sample_rate, 4);
+
+  timebase::TimeScale time_scale;
+  PlaybackControls controls;
+  ActiveNotes active_notes;
+  RenderResult result{0, 0};
+  double framerate = settings.sample_rate;
+
+  // Like a JackTransportStarting at frame 0 followed by rolling until
+  // the last event, and a final cycle in which the transport stops.
+  smf_streamer.Reposition(0, time_scale);
+  for (jack_nframes_t frame = 0; ; frame += settings.buffer_size) {
+    RenderSink sink(output, frame, settings.sample_rate, active_notes);
+    bool now_playing = !smf_streamer.finished();
+    smf_streamer.StopIfNeeded(now_playing, sink);
+    if (now_playing) {
+      smf_streamer.CopyToSink(frame / framerate,
+                              (frame + settings.buffer_size) / framerate,
+                              time_scale, controls, sink);
+    }
+    result.events += sink.events();
+    result.frames = frame + settings.buffer_size;
+    if (!now_playing) break;
+  }
+
+  if (!output)
+    throw std::runtime_error("cannot write " + output_file);
+  return result;
+}
+
+void RenderInParallel(std::vector<RenderJob> &jobs,
+                      const RenderSettings &settings, unsigned threads) {
+  RunInParallel(jobs.size(), threads, [&](size_t i) {
+    RenderJob &job = jobs[i];
+    try {
+      job.result = RenderFile(job.input_file, job.output_file, settings);
+    } catch (std::exception &e) {
+      job.result = RenderResult{0, 0};
+      job.error = e.what();
+    }
+  });
+}
+
+}
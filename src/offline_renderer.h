@@ -0,0 +1,60 @@
+#ifndef OFFLINE_RENDERER_H_
+#define OFFLINE_RENDERER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+
+namespace midiaud {
+
+/**
+ * Parameters of the simulated Jack server.
+ */
+struct RenderSettings {
+  jack_nframes_t buffer_size;
+  jack_nframes_t sample_rate;
+};
+
+struct RenderResult {
+  size_t events;
+  jack_nframes_t frames;
+};
+
+struct RenderJob {
+  std::string input_file;
+  std::string output_file;
+  RenderResult result;
+  /**
+   * Empty if the job succeeded.
+   */
+  std::string error;
+};
+
+/**
+ * Plays `input_file` from the start to the end through the same
+ * SmfStreamer calls as the process callback, without a Jack server
+ * and as fast as possible.
+ *
+ * Every emitted event is written to `output_file` in a compact binary
+ * log: the magic "MIDIAUDL", the sample rate as a little endian
+ * uint32, then for every event its absolute frame as a little endian
+ * uint64, its size as a little endian uint32 and its bytes.
+ *
+ * @throws std::runtime_error if the files cannot be read or written.
+ */
+RenderResult RenderFile(const std::string &input_file,
+                        const std::string &output_file,
+                        const RenderSettings &settings);
+
+/**
+ * Runs RenderFile() for every job on a pool of `threads` threads.
+ * Failures are stored in the jobs instead of being thrown.
+ */
+void RenderInParallel(std::vector<RenderJob> &jobs,
+                      const RenderSettings &settings, unsigned threads);
+
+}
+
+#endif // OFFLINE_RENDERER_H_
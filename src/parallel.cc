@@ -0,0 +1,27 @@
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace midiaud {
+
+void RunInParallel(size_t count, unsigned threads,
+                   const std::function<void(size_t)> &function) {
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    for (size_t i = next_index++; i < count; i = next_index++)
+      function(i);
+  };
+  threads = std::max(1u, std::min<unsigned>(threads, count));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i)
+    pool.emplace_back(worker);
+  worker();
+  for (std::thread &thread : pool)
+    thread.join();
+}
+
+}
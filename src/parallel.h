@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <cstddef>
+#include <functional>
+
+namespace midiaud {
+
+/**
+ * Calls `function` with every index below `count` on a pool of
+ * `threads` threads, the calling thread being one of them. Indices are
+ * handed out one at a time, so long jobs do not hold up short ones.
+ * `function` must not throw.
+ */
+void RunInParallel(size_t count, unsigned threads,
+                   const std::function<void(size_t)> &function);
+
+}
+
+#endif // PARALLEL_H_
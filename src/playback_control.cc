@@ -0,0 +1,48 @@
+
+#include "playback_control.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace midiaud {
+
+PlaybackControls::PlaybackControls()
+    : mute_(0), solo_(0), loop_(false), velocity_gain_(1) {
+}
+
+void PlaybackControls::Apply(const PlaybackCommand &command) noexcept {
+  switch (command.type) {
+    case PlaybackCommand::kSetMute:
+      mute_ = command.channels;
+      break;
+    case PlaybackCommand::kSetSolo:
+      solo_ = command.channels;
+      break;
+    case PlaybackCommand::kSetLoop:
+      loop_ = command.value != 0;
+      break;
+    case PlaybackCommand::kSetVelocityGain:
+      velocity_gain_ = std::max(0., command.value);
+      break;
+    case PlaybackCommand::kSetTempoScale:
+    case PlaybackCommand::kPanic:
+      break;
+  }
+}
+
+const uint8_t *PlaybackControls::Filter(const uint8_t *data, size_t size,
+                                        uint8_t *scratch) const noexcept {
+  // Only note ons with a nonzero velocity are affected.
+  if (size != 3 || (data[0] & 0xf0) != 0x90 || data[2] == 0) return data;
+  uint8_t channel = data[0] & 0x0f;
+  if ((audible_channels() & (1 << channel)) == 0) return nullptr;
+  if (velocity_gain_ == 1) return data;
+  double velocity = std::round(data[2] * velocity_gain_);
+  scratch[0] = data[0];
+  scratch[1] = data[1];
+  // Velocity 0 would turn the note on into a note off.
+  scratch[2] = static_cast<uint8_t>(std::min(127., std::max(1., velocity)));
+  return scratch;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef PLAYBACK_CONTROL_H_
+#define PLAYBACK_CONTROL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace midiaud {
+
+/**
+ * Small command sent from the main thread to the RT thread to change
+ * playback without replacing the SmfStreamer.
+ */
+struct PlaybackCommand {
+  enum Type : uint8_t {
+    kSetMute,
+    kSetSolo,
+    kSetLoop,
+    kSetVelocityGain,
+    kSetTempoScale,
+    kPanic
+  };
+
+  Type type;
+  /**
+   * Bitmask of MIDI channels for kSetMute and kSetSolo, bit 0 being
+   * channel 1.
+   */
+  uint16_t channels;
+  /**
+   * Velocity gain for kSetVelocityGain, speed factor for
+   * kSetTempoScale, 0 or 1 for kSetLoop.
+   */
+  double value;
+};
+
+/**
+ * Playback settings owned by the RT thread.
+ */
+class PlaybackControls {
+ public:
+  static constexpr uint16_t kAllChannels = 0xffff;
+
+  PlaybackControls();
+
+  /**
+   * Applies `command`, except kPanic and kSetTempoScale, which have to
+   * be carried out by the caller.
+   */
+  void Apply(const PlaybackCommand &command) noexcept;
+
+  /**
+   * Filters an outgoing channel message.
+   *
+   * Note ons on channels that are not audible are suppressed, every
+   * other message is kept so that muting does not leave notes hanging
+   * or controllers out of date. Note on velocities are scaled by the
+   * velocity gain.
+   *
+   * @param data the message to filter.
+   * @param size the size of the message.
+   * @param scratch at least `size` bytes to write the modified message
+   *        into.
+   * @returns `data`, `scratch` if the message was modified, or
+   *          nullptr if it has to be dropped.
+   */
+  const uint8_t *Filter(const uint8_t *data, size_t size,
+                        uint8_t *scratch) const noexcept;
+
+  /**
+   * Whether Filter() keeps every message as it is.
+   */
+  bool pass_through() const {
+    return audible_channels() == kAllChannels && velocity_gain_ == 1;
+  }
+  uint16_t audible_channels() const {
+    return (solo_ != 0 ? solo_ : kAllChannels) & ~mute_;
+  }
+  bool loop() const { return loop_; }
+  double velocity_gain() const { return velocity_gain_; }
+
+ private:
+  uint16_t mute_;
+  uint16_t solo_;
+  bool loop_;
+  double velocity_gain_;
+};
+
+}
+
+#endif // PLAYBACK_CONTROL_H_
@@ -0,0 +1,90 @@
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "cycle_trace.h"
+#include "trace_replay.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options] trace-file\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("repeat,r", po::value<int>()->default_value(1),
+       "replay the trace this many times for stable timings")
+      ;
+
+  po::options_description hidden_options_desc;
+  hidden_options_desc.add_options()
+      ("trace-file", po::value<std::string>()->required(), "trace file")
+      ;
+
+  po::options_description options_desc;
+  options_desc.add(generic_options_desc).add(hidden_options_desc);
+
+  po::positional_options_description positional_options_desc;
+  positional_options_desc.add("trace-file", 1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(options_desc)
+              .positional(positional_options_desc)
+              .run(), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  try {
+    midiaud::CycleTrace trace = midiaud::ReadCycleTrace(
+        vm["trace-file"].as<std::string>());
+    if (trace.lost_records > 0) {
+      std::cerr << "Warning: " << trace.lost_records
+                << " records were lost during capture, expect mismatches"
+                << std::endl;
+    }
+
+    int repeat = vm["repeat"].as<int>();
+    midiaud::ReplayResult result{0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < repeat; ++i) {
+      // Mismatches are deterministic, only report them once.
+      std::ostream null_log(nullptr);
+      midiaud::ReplayResult run = midiaud::ReplayCycleTrace(
+          trace, i == 0 ? std::cout : null_log);
+      if (i == 0 || run.max_cycle_seconds < result.max_cycle_seconds)
+        result = run;
+    }
+
+    std::cout << "Replayed " << result.cycles << " cycles, "
+              << result.events << " events\n"
+              << "Mismatched cycles: " << result.mismatched_cycles << "\n"
+              << "RT errors: " << result.rt_errors << "\n"
+              << "Mean cycle time: "
+              << (result.cycles > 0
+                  ? result.total_seconds / result.cycles * 1e6 : 0)
+              << " us\n"
+              << "Max cycle time: " << result.max_cycle_seconds * 1e6
+              << " us at frame " << result.slowest_cycle_frame << "\n";
+    return result.mismatched_cycles == 0 ? 0 : 1;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return -1;
+  }
+}
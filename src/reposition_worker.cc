@@ -0,0 +1,85 @@
+
+#include "reposition_worker.h"
+
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+
+namespace midiaud {
+
+RepositionWorker::RepositionWorker(
+    std::shared_ptr<const SegmentedEvents> events,
+    std::shared_ptr<const timebase::TempoMap> tempo_map)
+    : events_(std::move(events)), tempo_map_(std::move(tempo_map)),
+      request_seconds_(0), request_generation_(0), stop_(false),
+      generation_(0), result_{0, 0, ChaseState()}, scanned_seconds_(0) {
+  if (sem_init(&wakeup_, 0, 0) != 0)
+    throw std::runtime_error("sem_init failed");
+  thread_ = std::thread(&RepositionWorker::Run, this);
+}
+
+RepositionWorker::~RepositionWorker() {
+  stop_.store(true, std::memory_order_relaxed);
+  sem_post(&wakeup_);
+  thread_.join();
+  sem_destroy(&wakeup_);
+}
+
+uint32_t RepositionWorker::Request(double file_seconds) noexcept {
+  ++generation_;
+  request_seconds_.store(file_seconds, std::memory_order_relaxed);
+  request_generation_.store(generation_, std::memory_order_release);
+  sem_post(&wakeup_);
+  return generation_;
+}
+
+bool RepositionWorker::Poll(uint32_t generation,
+                            RepositionResult &result) noexcept {
+  while (results_.Pop(result)) {
+    if (result.generation == generation) return true;
+  }
+  return false;
+}
+
+void RepositionWorker::Run() {
+  uint32_t generation = 0;
+  for (;;) {
+    while (sem_wait(&wakeup_) != 0 && errno == EINTR) {}
+    if (stop_.load(std::memory_order_relaxed)) return;
+    uint32_t requested =
+        request_generation_.load(std::memory_order_acquire);
+    // Several posts may wake us for the same request.
+    if (requested == generation) continue;
+    generation = requested;
+    Prepare(request_seconds_.load(std::memory_order_relaxed));
+    result_.generation = generation;
+    // The RT thread drains stale results whenever it polls, so the
+    // queue is only full while nobody waits for this one.
+    while (!results_.Push(result_)) {
+      if (stop_.load(std::memory_order_relaxed)
+          || request_generation_.load(std::memory_order_relaxed)
+              != generation)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+  }
+}
+
+void RepositionWorker::Prepare(double file_seconds) noexcept {
+  if (file_seconds < scanned_seconds_) {
+    result_.next_event = 0;
+    result_.chase.Clear();
+  }
+  SegmentedEvents::Iterator next_event = events_->At(result_.next_event);
+  while (next_event != events_->end()
+         && tempo_map_->GetTicks(next_event->ticks()).seconds()
+             < file_seconds) {
+    const MidiBuffer &midi = next_event->midi();
+    result_.chase.Acknowledge(midi.data(), midi.size());
+    ++next_event;
+  }
+  result_.next_event = next_event.index();
+  scanned_seconds_ = file_seconds;
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef REPOSITION_WORKER_H_
+#define REPOSITION_WORKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include <semaphore.h>
+
+#include "chase_state.h"
+#include "event.h"
+#include "lockfree_queue.h"
+#include "lockfree_queue-inl.h"
+#include "segmented_events.h"
+#include "timebase/tempo_map.h"
+
+namespace midiaud {
+
+/**
+ * Where playback has to continue after a reposition.
+ */
+struct RepositionResult {
+  /**
+   * Request this result was computed for.
+   */
+  uint32_t generation;
+  /**
+   * Index of the first event at or after the requested position.
+   */
+  size_t next_event;
+  ChaseState chase;
+};
+
+/**
+ * Prepares repositions of a loaded file off the RT thread.
+ *
+ * The RT thread posts the requested position, a background thread
+ * finds the first event to play from there and scans the events
+ * before it for the state to chase, then hands the result back
+ * through a lock-free queue. Successive requests forward in the file
+ * continue the scan where the previous one stopped.
+ */
+class RepositionWorker {
+ public:
+  RepositionWorker(std::shared_ptr<const SegmentedEvents> events,
+                   std::shared_ptr<const timebase::TempoMap> tempo_map);
+  RepositionWorker(const RepositionWorker &) = delete;
+  ~RepositionWorker();
+  RepositionWorker &operator=(const RepositionWorker &) = delete;
+
+  /**
+   * Requests a reposition to `file_seconds`, superseding the earlier
+   * requests. For RT thread.
+   *
+   * @returns the generation the result will carry.
+   */
+  uint32_t Request(double file_seconds) noexcept;
+  /**
+   * Looks for the result of request `generation`, discarding the
+   * results of earlier ones. For RT thread.
+   */
+  bool Poll(uint32_t generation, RepositionResult &result) noexcept;
+
+ private:
+  static constexpr size_t kResultSlots = 4;
+
+  void Run();
+  /**
+   * Fills `result_` for `file_seconds`. For background thread.
+   */
+  void Prepare(double file_seconds) noexcept;
+
+  // Immutable after construction.
+  std::shared_ptr<const SegmentedEvents> events_;
+  std::shared_ptr<const timebase::TempoMap> tempo_map_;
+
+  std::atomic<double> request_seconds_;
+  std::atomic<uint32_t> request_generation_;
+  std::atomic<bool> stop_;
+  /**
+   * Posted by the RT thread, sem_post() never blocks.
+   */
+  sem_t wakeup_;
+  LockfreeQueue<RepositionResult, kResultSlots> results_;
+
+  uint32_t generation_; // For RT thread.
+
+  RepositionResult result_; // For background thread.
+  double scanned_seconds_; // For background thread.
+
+  std::thread thread_;
+};
+
+}
+
+#endif // REPOSITION_WORKER_H_
@@ -0,0 +1,67 @@
+
+#include "rt_status.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace midiaud {
+
+namespace {
+
+struct StatusName {
+  RtStatus status;
+  const char *name;
+  const char *description;
+};
+
+constexpr StatusName kStatusNames[] = {
+  {RtStatus::kOk, "ok", "no error"},
+  {RtStatus::kNoPortBuffer, "no-buffer", "jack_port_get_buffer failed"},
+  {RtStatus::kPortBufferFull, "buffer-full",
+   "jack_midi_event_write failure"},
+  {RtStatus::kErrorQueueOverflow, "queue-overflow",
+   "too many RT errors, some of them were lost"},
+  {RtStatus::kPrefetchUnderrun, "underrun",
+   "events were not decoded or repositioned in time"},
+};
+
+}
+
+const char *RtStatusDescription(RtStatus status) {
+  for (const StatusName &status_name : kStatusNames) {
+    if (status_name.status == status) return status_name.description;
+  }
+  return "unknown error";
+}
+
+RtStatus ParseRtStatus(const std::string &name) {
+  for (const StatusName &status_name : kStatusNames) {
+    if (name == status_name.name) return status_name.status;
+  }
+  throw std::invalid_argument("unknown RT error: " + name);
+}
+
+RtErrorPolicy::RtErrorPolicy()
+    : fatal_mask_(0) {
+  SetFatal(RtStatus::kNoPortBuffer, true);
+  SetFatal(RtStatus::kErrorQueueOverflow, true);
+}
+
+void RtErrorPolicy::SetFatal(RtStatus status, bool fatal) {
+  if (fatal) {
+    fatal_mask_ |= Bit(status);
+  } else {
+    fatal_mask_ &= ~Bit(status);
+  }
+}
+
+void RtErrorPolicy::SetFatalList(const std::string &names) {
+  fatal_mask_ = 0;
+  std::istringstream names_stream(names);
+  std::string name;
+  while (std::getline(names_stream, name, ',')) {
+    if (!name.empty()) SetFatal(ParseRtStatus(name), true);
+  }
+}
+
+}
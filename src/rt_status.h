@@ -0,0 +1,79 @@
+#ifndef RT_STATUS_H_
+#define RT_STATUS_H_
+
+#include <cstdint>
+#include <string>
+
+#include <jack/jack.h>
+
+namespace midiaud {
+
+/**
+ * Outcome of an operation performed in the RT thread.
+ *
+ * Code reachable from the Jack callbacks never throws, it reports
+ * failures with these status codes instead.
+ */
+enum class RtStatus : uint8_t {
+  kOk = 0,
+  kNoPortBuffer,
+  kPortBufferFull,
+  kErrorQueueOverflow,
+  kPrefetchUnderrun,
+  kStatusCount
+};
+
+/**
+ * Fixed-size record of a failure in the RT thread, posted to the
+ * main thread through a lock-free queue.
+ */
+struct RtError {
+  RtStatus status;
+  /**
+   * Transport frame of the cycle in which the error happened.
+   */
+  jack_nframes_t frame;
+};
+
+const char *RtStatusDescription(RtStatus status);
+/**
+ * Parses the short name of a status (e.g. "buffer-full").
+ *
+ * @throws std::invalid_argument if the name is unknown.
+ */
+RtStatus ParseRtStatus(const std::string &name);
+
+/**
+ * Decides which RT errors deactivate the client and which ones are
+ * merely logged.
+ */
+class RtErrorPolicy {
+ public:
+  /**
+   * By default, a full port buffer only loses events and a prefetch
+   * underrun only delays them, thus both are recoverable, while a
+   * missing port buffer and a lost error record are fatal.
+   */
+  RtErrorPolicy();
+
+  void SetFatal(RtStatus status, bool fatal);
+  /**
+   * Sets the fatal statuses from a comma separated list of names,
+   * all other statuses become recoverable.
+   */
+  void SetFatalList(const std::string &names);
+  bool IsFatal(RtStatus status) const noexcept {
+    return (fatal_mask_ & Bit(status)) != 0;
+  }
+
+ private:
+  static uint32_t Bit(RtStatus status) noexcept {
+    return UINT32_C(1) << static_cast<uint32_t>(status);
+  }
+
+  uint32_t fatal_mask_;
+};
+
+}
+
+#endif // RT_STATUS_H_
@@ -0,0 +1,52 @@
+
+#include "segmented_events.h"
+
+#include <algorithm>
+
+namespace midiaud {
+
+SegmentedEvents::Iterator::Iterator(const SegmentedEvents *events,
+                                    size_t segment, size_t offset) noexcept
+    : events_(events), segment_(segment), event_(nullptr),
+      segment_end_(nullptr), index_(events->starts_[segment] + offset) {
+  if (segment < events->segments_.size()) {
+    const Segment &events_of_segment = *events->segments_[segment];
+    event_ = events_of_segment.data() + offset;
+    segment_end_ = events_of_segment.data() + events_of_segment.size();
+  }
+}
+
+SegmentedEvents::Iterator &SegmentedEvents::Iterator::operator++() noexcept {
+  ++index_;
+  if (++event_ == segment_end_) *this = Iterator(events_, segment_ + 1, 0);
+  return *this;
+}
+
+SegmentedEvents::SegmentedEvents() : starts_(1, 0) {
+}
+
+SegmentedEvents::SegmentedEvents(std::vector<SegmentPtr> segments)
+    : segments_(std::move(segments)) {
+  starts_.reserve(segments_.size() + 1);
+  starts_.push_back(0);
+  for (const SegmentPtr &segment : segments_)
+    starts_.push_back(starts_.back() + segment->size());
+}
+
+SegmentedEvents::Iterator SegmentedEvents::At(size_t index) const noexcept {
+  if (index >= size()) return end();
+  size_t segment = std::upper_bound(starts_.cbegin(), starts_.cend(), index)
+      - starts_.cbegin() - 1;
+  return Iterator(this, segment, index - starts_[segment]);
+}
+
+size_t SegmentedEvents::FindSegment(double ticks) const {
+  auto after = std::upper_bound(
+      segments_.cbegin(), segments_.cend(), ticks,
+      [](double ticks, const SegmentPtr &segment) {
+        return ticks < segment->front().ticks();
+      });
+  return after == segments_.cbegin() ? 0 : after - segments_.cbegin() - 1;
+}
+
+}
@@ -0,0 +1,128 @@
+#ifndef SEGMENTED_EVENTS_H_
+#define SEGMENTED_EVENTS_H_
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "event.h"
+
+namespace midiaud {
+
+/**
+ * Events of a file in time order, stored in immutable segments of
+ * consecutive ticks.
+ *
+ * Each segment holds every event from the ticks of its first event up
+ * to the first event of the next one, thus events of the same ticks
+ * never straddle two segments. Successive loads of a file share the
+ * segments an edit did not touch, while the events can still be
+ * walked and addressed by index as a single list.
+ */
+class SegmentedEvents {
+ public:
+  typedef std::vector<Event> Segment;
+  typedef std::shared_ptr<const Segment> SegmentPtr;
+
+  /**
+   * Forward iterator that also knows the index of its event. Never
+   * allocates, thus it can be used by the RT thread.
+   */
+  class Iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Event value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Event *pointer;
+    typedef const Event &reference;
+
+    Iterator() noexcept
+        : events_(nullptr), segment_(0), event_(nullptr),
+          segment_end_(nullptr), index_(0) {
+    }
+
+    const Event &operator*() const noexcept { return *event_; }
+    const Event *operator->() const noexcept { return event_; }
+    Iterator &operator++() noexcept;
+    bool operator==(const Iterator &rhs) const noexcept {
+      return index_ == rhs.index_;
+    }
+    bool operator!=(const Iterator &rhs) const noexcept {
+      return index_ != rhs.index_;
+    }
+
+    size_t index() const noexcept { return index_; }
+    size_t segment() const noexcept { return segment_; }
+    /**
+     * Index of the event in its segment.
+     */
+    size_t offset() const noexcept {
+      return index_ - events_->starts_[segment_];
+    }
+
+   private:
+    friend class SegmentedEvents;
+
+    Iterator(const SegmentedEvents *events, size_t segment,
+             size_t offset) noexcept;
+
+    const SegmentedEvents *events_;
+    size_t segment_;
+    const Event *event_;
+    const Event *segment_end_;
+    size_t index_;
+  };
+
+  /**
+   * Builds an empty list.
+   */
+  SegmentedEvents();
+  /**
+   * Concatenates `segments`, which must not be empty and must follow
+   * each other in time.
+   */
+  explicit SegmentedEvents(std::vector<SegmentPtr> segments);
+  SegmentedEvents(const SegmentedEvents &) = delete;
+  SegmentedEvents &operator=(const SegmentedEvents &) = delete;
+
+  size_t size() const noexcept { return starts_.back(); }
+  bool empty() const noexcept { return size() == 0; }
+  Iterator begin() const noexcept { return Iterator(this, 0, 0); }
+  Iterator end() const noexcept {
+    return Iterator(this, segments_.size(), 0);
+  }
+  /**
+   * Returns an iterator to the event at `index`, or end() if there is
+   * none. Looks up the segment by binary search.
+   */
+  Iterator At(size_t index) const noexcept;
+  const Event &operator[](size_t index) const noexcept { return *At(index); }
+
+  size_t segment_count() const { return segments_.size(); }
+  const SegmentPtr &segment(size_t segment) const {
+    return segments_[segment];
+  }
+  /**
+   * Index of the first event of `segment`.
+   */
+  size_t segment_start(size_t segment) const { return starts_[segment]; }
+  /**
+   * Returns the segment the events at `ticks` belong to, which is the
+   * last one starting at or before them, or the first one if none
+   * does.
+   */
+  size_t FindSegment(double ticks) const;
+
+ private:
+  std::vector<SegmentPtr> segments_;
+  /**
+   * Index of the first event of every segment, followed by the total
+   * number of events.
+   */
+  std::vector<size_t> starts_;
+};
+
+}
+
+#endif // SEGMENTED_EVENTS_H_
@@ -0,0 +1,211 @@
+
+#include "smf_decoder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace midiaud {
+
+namespace {
+
+uint32_t ReadBigEndian(const uint8_t *bytes, int size) {
+  uint32_t value = 0;
+  for (int i = 0; i < size; ++i)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+
+/**
+ * Number of data bytes following the status byte of a channel
+ * message.
+ */
+int ChannelMessageDataSize(uint8_t status) {
+  uint8_t type = status & 0xf0;
+  return (type == 0xc0 || type == 0xd0) ? 1 : 2;
+}
+
+}
+
+constexpr size_t SmfDecoder::kBufferSize;
+
+SmfDecoder::SmfDecoder(const std::string &filename)
+    : fd_(open(filename.c_str(), O_RDONLY | O_CLOEXEC)),
+      filename_(filename), division_{0, 0, 0}, ticks_(0) {
+  if (fd_ < 0)
+    throw std::runtime_error("cannot open " + filename + ": "
+                             + std::strerror(errno));
+  try {
+    uint8_t header[14];
+    ReadExact(0, header, sizeof(header));
+    if (std::memcmp(header, "MThd", 4) != 0)
+      throw std::runtime_error(filename + " is not a Standard MIDI File");
+    uint64_t offset = 8 + ReadBigEndian(header + 4, 4);
+    uint32_t track_count = ReadBigEndian(header + 10, 2);
+    division_ = timebase::TimeDivision::FromWord(
+        static_cast<uint16_t>(ReadBigEndian(header + 12, 2)));
+
+    for (uint32_t i = 0; i < track_count; ++i) {
+      uint8_t chunk_header[8];
+      ReadExact(offset, chunk_header, sizeof(chunk_header));
+      uint64_t begin = offset + sizeof(chunk_header);
+      uint64_t end = begin + ReadBigEndian(chunk_header + 4, 4);
+      offset = end;
+      // Unknown chunks have to be skipped according to the standard.
+      if (std::memcmp(chunk_header, "MTrk", 4) != 0) {
+        --i;
+        continue;
+      }
+      tracks_.push_back({begin, end, 0, 0, false});
+      track_begins_.push_back(begin);
+      buffers_.push_back({0, std::vector<uint8_t>()});
+      ReadDeltaTime(tracks_.size() - 1);
+    }
+    start_ = tracks_;
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+SmfDecoder::~SmfDecoder() {
+  close(fd_);
+}
+
+bool SmfDecoder::Next() {
+  size_t track = tracks_.size();
+  for (size_t i = 0; i < tracks_.size(); ++i) {
+    if (tracks_[i].finished) continue;
+    if (track == tracks_.size() || tracks_[i].ticks < tracks_[track].ticks)
+      track = i;
+  }
+  if (track == tracks_.size()) return false;
+
+  TrackPosition &position = tracks_[track];
+  uint64_t offset = position.offset;
+  ticks_ = position.ticks;
+  data_.clear();
+  uint8_t status = ReadByte(track, offset);
+  if (status == 0xff) {
+    uint8_t type = ReadByte(track, offset);
+    uint32_t size = ReadVariableLength(track, offset);
+    data_.push_back(status);
+    data_.push_back(type);
+    // Keep the length the way libsmf does, so metaevents look the
+    // same no matter which reader decoded them.
+    uint32_t length = size;
+    uint8_t length_bytes[4];
+    int length_size = 0;
+    do {
+      length_bytes[length_size++] = length & 0x7f;
+      length >>= 7;
+    } while (length != 0);
+    while (length_size > 0) {
+      --length_size;
+      data_.push_back(length_bytes[length_size]
+                      | (length_size > 0 ? 0x80 : 0));
+    }
+    ReadBytes(track, offset, size);
+    if (type == 0x2f) position.finished = true;
+  } else if (status == 0xf0 || status == 0xf7) {
+    uint32_t size = ReadVariableLength(track, offset);
+    if (status == 0xf0) data_.push_back(status);
+    ReadBytes(track, offset, size);
+  } else {
+    if ((status & 0x80) != 0) {
+      position.running_status = status;
+      data_.push_back(status);
+    } else {
+      if (position.running_status == 0)
+        throw std::runtime_error(filename_ + ": data byte without status");
+      data_.push_back(position.running_status);
+      data_.push_back(status);
+    }
+    while (data_.size() < 1u + ChannelMessageDataSize(data_[0]))
+      data_.push_back(ReadByte(track, offset));
+  }
+
+  position.offset = offset;
+  if (!position.finished) ReadDeltaTime(track);
+  return true;
+}
+
+void SmfDecoder::Restore(const Checkpoint &checkpoint) {
+  if (checkpoint.size() != tracks_.size())
+    throw std::invalid_argument("checkpoint of another file");
+  tracks_ = checkpoint;
+}
+
+std::vector<uint8_t> SmfDecoder::ReadTrack(size_t track) {
+  std::vector<uint8_t> bytes(
+      static_cast<size_t>(start_[track].end - track_begins_[track]));
+  ReadExact(track_begins_[track], bytes.data(), bytes.size());
+  return bytes;
+}
+
+void SmfDecoder::SelectTrack(size_t track) {
+  tracks_ = start_;
+  for (size_t i = 0; i < tracks_.size(); ++i) {
+    if (i != track) tracks_[i].finished = true;
+  }
+}
+
+uint8_t SmfDecoder::ReadByte(size_t track, uint64_t &offset) {
+  if (offset >= tracks_[track].end)
+    throw std::runtime_error(filename_ + ": unexpected end of track");
+  TrackBuffer &buffer = buffers_[track];
+  if (offset < buffer.offset
+      || offset >= buffer.offset + buffer.bytes.size()) {
+    size_t size = static_cast<size_t>(
+        std::min<uint64_t>(kBufferSize, tracks_[track].end - offset));
+    buffer.bytes.resize(size);
+    ReadExact(offset, buffer.bytes.data(), size);
+    buffer.offset = offset;
+  }
+  return buffer.bytes[offset++ - buffer.offset];
+}
+
+uint32_t SmfDecoder::ReadVariableLength(size_t track, uint64_t &offset) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    uint8_t byte = ReadByte(track, offset);
+    value = (value << 7) | (byte & 0x7f);
+    if ((byte & 0x80) == 0) return value;
+  }
+  throw std::runtime_error(filename_ + ": variable length value too long");
+}
+
+void SmfDecoder::ReadBytes(size_t track, uint64_t &offset, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    data_.push_back(ReadByte(track, offset));
+}
+
+void SmfDecoder::ReadDeltaTime(size_t track) {
+  TrackPosition &position = tracks_[track];
+  if (position.offset >= position.end) {
+    // Tolerate tracks without an end of track metaevent.
+    position.finished = true;
+    return;
+  }
+  uint64_t offset = position.offset;
+  position.ticks += ReadVariableLength(track, offset);
+  position.offset = offset;
+}
+
+void SmfDecoder::ReadExact(uint64_t offset, uint8_t *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t result = pread(fd_, buffer, size, offset);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0)
+      throw std::runtime_error("cannot read " + filename_);
+    buffer += result;
+    offset += result;
+    size -= result;
+  }
+}
+
+}
@@ -0,0 +1,117 @@
+#ifndef SMF_DECODER_H_
+#define SMF_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "timebase/time_division.h"
+
+namespace midiaud {
+
+/**
+ * Incremental reader of Standard MIDI Files.
+ *
+ * Unlike libsmf, which loads the whole file, only a small buffer per
+ * track is kept in memory. Events of every track are merged in time
+ * order as they are decoded. The read position can be saved into a
+ * checkpoint and restored later for seeking.
+ */
+class SmfDecoder {
+ public:
+  /**
+   * Read position of a single track.
+   */
+  struct TrackPosition {
+    /**
+     * File offset of the status byte of the pending event.
+     */
+    uint64_t offset;
+    uint64_t end;
+    /**
+     * Absolute time of the pending event.
+     */
+    uint64_t ticks;
+    uint8_t running_status;
+    bool finished;
+  };
+  typedef std::vector<TrackPosition> Checkpoint;
+
+  /**
+   * @throws std::runtime_error if the file cannot be opened or has
+   *         no valid header.
+   */
+  explicit SmfDecoder(const std::string &filename);
+  SmfDecoder(const SmfDecoder &) = delete;
+  ~SmfDecoder();
+  SmfDecoder &operator=(const SmfDecoder &) = delete;
+
+  /**
+   * Decodes the next event of the file in time order. Events at the
+   * same time are ordered by track.
+   *
+   * The event is available through ticks() and data() until the next
+   * call.
+   *
+   * @returns false at the end of the file.
+   * @throws std::runtime_error if the file is malformed.
+   */
+  bool Next();
+
+  Checkpoint Save() const { return tracks_; }
+  void Restore(const Checkpoint &checkpoint);
+
+  size_t track_count() const { return tracks_.size(); }
+  /**
+   * Returns the contents of the chunk of `track`.
+   *
+   * @throws std::runtime_error if the file cannot be read.
+   */
+  std::vector<uint8_t> ReadTrack(size_t track);
+  /**
+   * Restarts decoding at the start of the file with only `track`
+   * decoded, for reading the tracks one by one.
+   */
+  void SelectTrack(size_t track);
+
+  const timebase::TimeDivision &division() const { return division_; }
+  uint64_t ticks() const { return ticks_; }
+  const std::vector<uint8_t> &data() const { return data_; }
+  bool is_metadata() const { return !data_.empty() && data_[0] == 0xff; }
+
+ private:
+  static constexpr size_t kBufferSize = 4096;
+
+  struct TrackBuffer {
+    uint64_t offset;
+    std::vector<uint8_t> bytes;
+  };
+
+  uint8_t ReadByte(size_t track, uint64_t &offset);
+  uint32_t ReadVariableLength(size_t track, uint64_t &offset);
+  void ReadBytes(size_t track, uint64_t &offset, size_t size);
+  /**
+   * Reads the delta time of the next event of `track`, or marks it
+   * finished at the end of its chunk.
+   */
+  void ReadDeltaTime(size_t track);
+  void ReadExact(uint64_t offset, uint8_t *buffer, size_t size);
+
+  int fd_;
+  std::string filename_;
+  timebase::TimeDivision division_;
+  Checkpoint tracks_;
+  /**
+   * Read positions at the start of the file.
+   */
+  Checkpoint start_;
+  std::vector<uint64_t> track_begins_;
+  std::vector<TrackBuffer> buffers_;
+  uint64_t ticks_;
+  std::vector<uint8_t> data_;
+};
+
+}
+
+#endif // SMF_DECODER_H_
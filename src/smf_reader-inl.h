@@ -7,6 +7,8 @@
 #include <smf.h>
 
 #include "event.h"
+#include "smf_decoder.h"
+#include "timebase/time_division.h"
 
 namespace midiaud {
 
@@ -22,18 +24,31 @@ struct DeleteSmfT {
 template <typename OutputIterator>
 void ReadStandardMidiFile(const std::string &filename,
                           OutputIterator result,
-                          double &ppqn) {
+                          timebase::TimeDivision &division) {
+  // libsmf refuses files with SMPTE division, those are read by our
+  // own decoder instead.
+  {
+    SmfDecoder decoder(filename);
+    division = decoder.division();
+    if (division.smpte()) {
+      while (decoder.Next()) {
+        *result++ = Event(decoder.ticks(), decoder.data().cbegin(),
+                          decoder.data().cend());
+      }
+      return;
+    }
+  }
   std::unique_ptr<smf_t, DeleteSmfT> smf(smf_load(filename.c_str()));
   if (smf == nullptr)
     throw std::runtime_error("smf_load failed");
-  ReadFromSmfT(smf.get(), result, ppqn);
+  ReadFromSmfT(smf.get(), result, division);
 }
 
 template <typename OutputIterator>
 void ReadFromSmfT(smf_t *smf,
                   OutputIterator result,
-                  double &ppqn) {
-  ppqn = smf->ppqn;
+                  timebase::TimeDivision &division) {
+  division = {static_cast<double>(smf->ppqn), 0, 0};
   smf_rewind(smf);
   for (smf_event_t *event = smf_get_next_event(smf);
        event != nullptr;
@@ -1,68 +1,547 @@
 
 #include "smf_streamer.h"
 
-#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <stdexcept>
-
-#include "smf_reader-inl.h"
+#include <utility>
 
 namespace midiaud {
 
+namespace {
+
+bool IsSysex(const MidiBuffer &midi) {
+  return !midi.empty() && (midi[0] == 0xf0 || midi[0] == 0xf7);
+}
+
+/**
+ * Events are placed at the frame nearest to their time, so that an
+ * event falls at the same frame whichever cycle boundaries surround
+ * it, instead of a frame early whenever the subtraction of the cycle
+ * start comes out just short.
+ */
+long long RoundToFrame(double seconds, const MidiSink &sink) {
+  return std::llround(seconds * sink.framerate());
+}
+
+/**
+ * Returns the index of the event before which every SysEx is setup
+ * data, which is the first sounding note if there is SysEx before it,
+ * otherwise 0.
+ */
+size_t FindSetupEnd(const SegmentedEvents &events) {
+  auto first_note = std::find_if(
+      events.begin(), events.end(), [](const Event &event) {
+        const MidiBuffer &midi = event.midi();
+        return midi.size() == 3 && (midi[0] & 0xf0) == 0x90 && midi[2] != 0;
+      });
+  auto has_sysex = std::any_of(
+      events.begin(), first_note,
+      [](const Event &event) { return IsSysex(event.midi()); });
+  return has_sysex ? first_note.index() : 0;
+}
+
+/**
+ * The ticks spanned by the events an edit changed.
+ */
+struct ChangedTicks {
+  bool any;
+  double first;
+  double last;
+  /**
+   * Whether a tempo or time signature metaevent was changed.
+   */
+  bool tempo;
+};
+
+/**
+ * Adds the events that differ between two versions of a track to
+ * `changed`, which are the ones left after stripping the common
+ * prefix and suffix of the versions.
+ */
+void AddChanges(const std::vector<Event> &events,
+                const std::vector<Event> &old_events,
+                ChangedTicks &changed) {
+  size_t common = std::min(events.size(), old_events.size());
+  size_t prefix = std::mismatch(events.cbegin(), events.cbegin() + common,
+                                old_events.cbegin()).first
+      - events.cbegin();
+  size_t suffix = std::mismatch(events.crbegin(),
+                                events.crbegin() + (common - prefix),
+                                old_events.crbegin()).first
+      - events.crbegin();
+  for (const std::vector<Event> *version : {&events, &old_events}) {
+    auto begin = version->cbegin() + prefix;
+    auto end = version->cend() - suffix;
+    if (begin == end) continue;
+    if (!changed.any) {
+      changed = {true, begin->ticks(), (end - 1)->ticks(), false};
+    } else {
+      changed.first = std::min(changed.first, begin->ticks());
+      changed.last = std::max(changed.last, (end - 1)->ticks());
+    }
+    if (std::any_of(begin, end, &timebase::TempoMap::IsTempoEvent))
+      changed.tempo = true;
+  }
+}
+
+}
+
 SmfStreamer::SmfStreamer()
-    : initialized_(false), was_playing_(false), repositioned_(false) {
+    : initialized_(false), was_playing_(false), repositioned_(false),
+      tracks_(std::make_shared<TrackList>()),
+      events_(std::make_shared<SegmentedEvents>()),
+      metaevents_(std::make_shared<EventList>()),
+      tempo_map_(std::make_shared<timebase::TempoMap>()),
+      marker_index_(std::make_shared<MarkerIndex>()),
+      next_event_(events_->end()), reposition_pending_(false),
+      reposition_generation_(0), requested_seconds_(0), consumed_(false),
+      chase_pending_(false), setup_end_(0), setup_pending_(false),
+      setup_sent_(false), next_setup_event_(0), load_id_(0) {
 }
 
-SmfStreamer::SmfStreamer(const std::string &filename)
-    : initialized_(false), was_playing_(false), repositioned_(false) {
-  double ppqn;
-  ReadStandardMidiFile(filename, std::back_inserter(events_), ppqn);
-  next_event_ = events_.cend();
+SmfStreamer::SmfStreamer(const std::string &filename,
+                         LoadTimings *timings)
+    : initialized_(false), was_playing_(false), repositioned_(false),
+      reposition_pending_(false), reposition_generation_(0),
+      requested_seconds_(0), consumed_(false), chase_pending_(false),
+      setup_end_(0), setup_pending_(false), setup_sent_(false),
+      next_setup_event_(0), load_id_(0) {
+  auto parse_start = std::chrono::steady_clock::now();
+  timebase::TimeDivision division;
+  auto tracks = std::make_shared<TrackList>(
+      ReadTracks(filename, TrackList(), division));
+  std::vector<SegmentedEvents::SegmentPtr> segments;
+  MergeTracks(*tracks, 0, std::numeric_limits<double>::infinity(),
+              segments);
+  auto events = std::make_shared<SegmentedEvents>(std::move(segments));
+  auto metaevents = std::make_shared<EventList>(MergeMetaevents(*tracks));
+
+  auto tempo_map_start = std::chrono::steady_clock::now();
+  auto tempo_map = std::make_shared<timebase::TempoMap>(division);
+  for (const Event &event : *metaevents) {
+    tempo_map->AcknowledgeEvent(event);
+  }
+  marker_index_ = std::make_shared<MarkerIndex>(*metaevents, *tempo_map);
 
-  tempo_map_ = timebase::TempoMap(ppqn);
-  for (const Event &event : events_) {
-    tempo_map_.AcknowledgeEvent(event);
+  if (timings != nullptr) {
+    std::chrono::duration<double> parse_duration =
+        tempo_map_start - parse_start;
+    std::chrono::duration<double> tempo_map_duration =
+        std::chrono::steady_clock::now() - tempo_map_start;
+    *timings = {parse_duration.count(), tempo_map_duration.count(), 0};
   }
+
+  tracks_ = std::move(tracks);
+  events_ = std::move(events);
+  metaevents_ = std::move(metaevents);
+  tempo_map_ = std::move(tempo_map);
+  next_event_ = events_->end();
+  reposition_worker_ = std::make_shared<RepositionWorker>(events_,
+                                                          tempo_map_);
+  setup_end_ = FindSetupEnd(*events_);
 }
 
-void SmfStreamer::Reposition(double seconds) {
-  Rewind();
-  SeekForwardTo(seconds);
+SmfStreamer::SmfStreamer(const std::string &filename,
+                         const SmfStreamer &previous,
+                         ReloadStats *stats)
+    : initialized_(false), was_playing_(false), repositioned_(false),
+      reposition_pending_(false), reposition_generation_(0),
+      requested_seconds_(0), consumed_(false), chase_pending_(false),
+      setup_end_(0), setup_pending_(false), setup_sent_(false),
+      next_setup_event_(0), load_id_(0) {
+  timebase::TimeDivision division;
+  auto tracks = std::make_shared<TrackList>(
+      ReadTracks(filename, *previous.tracks_, division));
+
+  // Tracks shared with the previous load are the same, the others are
+  // compared to their old version to find what the edit touched.
+  const TrackList &old_tracks = *previous.tracks_;
+  const DecodedTrack no_track{};
+  std::vector<ChangedTicks> changed_events;
+  ChangedTicks changed_metaevents{false, 0, 0, false};
+  size_t tracks_reused = 0;
+  for (size_t i = 0; i < std::max(tracks->size(), old_tracks.size()); ++i) {
+    const DecodedTrack &track =
+        i < tracks->size() ? *(*tracks)[i] : no_track;
+    const DecodedTrack &old_track =
+        i < old_tracks.size() ? *old_tracks[i] : no_track;
+    if (&track == &old_track) {
+      ++tracks_reused;
+      continue;
+    }
+    ChangedTicks changed{false, 0, 0, false};
+    AddChanges(track.events, old_track.events, changed);
+    if (changed.any) changed_events.push_back(changed);
+    AddChanges(track.metaevents, old_track.metaevents, changed_metaevents);
+  }
+
+  const SegmentedEvents &old_events = *previous.events_;
+  size_t events_reused = 0;
+  if (changed_events.empty()) {
+    events_ = previous.events_;
+    events_reused = events_->size();
+  } else {
+    // The segments overlapping the ticks changed in any track are
+    // merged again from the tracks, the others are shared.
+    std::vector<std::pair<size_t, size_t>> spans;
+    for (const ChangedTicks &changed : changed_events) {
+      spans.emplace_back(old_events.FindSegment(changed.first),
+                         old_events.FindSegment(changed.last));
+    }
+    std::sort(spans.begin(), spans.end());
+    std::vector<SegmentedEvents::SegmentPtr> segments;
+    size_t next_segment = 0;
+    for (size_t i = 0; i < spans.size(); ++i) {
+      size_t first = spans[i].first;
+      size_t last = spans[i].second;
+      while (i + 1 < spans.size() && spans[i + 1].first <= last)
+        last = std::max(last, spans[++i].second);
+      for (; next_segment < first; ++next_segment) {
+        segments.push_back(old_events.segment(next_segment));
+        events_reused += old_events.segment(next_segment)->size();
+      }
+      double begin_ticks = 0;
+      double end_ticks = std::numeric_limits<double>::infinity();
+      if (first > 0) begin_ticks = old_events.segment(first)->front().ticks();
+      if (last + 1 < old_events.segment_count())
+        end_ticks = old_events.segment(last + 1)->front().ticks();
+      MergeTracks(*tracks, begin_ticks, end_ticks, segments);
+      next_segment = last + 1;
+    }
+    for (; next_segment < old_events.segment_count(); ++next_segment) {
+      segments.push_back(old_events.segment(next_segment));
+      events_reused += old_events.segment(next_segment)->size();
+    }
+    events_ = std::make_shared<SegmentedEvents>(std::move(segments));
+  }
+
+  if (!changed_metaevents.any) {
+    metaevents_ = previous.metaevents_;
+    events_reused += metaevents_->size();
+  } else {
+    // Metaevents are few, it is not worth splicing them.
+    metaevents_ = std::make_shared<EventList>(MergeMetaevents(*tracks));
+  }
+  bool division_changed = division != previous.tempo_map_->division();
+  // Ticks from which on the events may be due at other times.
+  double retimed_ticks = std::numeric_limits<double>::infinity();
+  size_t tempo_positions_reused = previous.tempo_map_->size();
+  if (!division_changed && !changed_metaevents.tempo) {
+    tempo_map_ = previous.tempo_map_;
+  } else {
+    // Positions before the first changed metaevent cannot depend on
+    // the edit, therefore only the rest of the map is rebuilt.
+    retimed_ticks = division_changed ? 0 : changed_metaevents.first;
+    std::shared_ptr<timebase::TempoMap> tempo_map;
+    if (retimed_ticks > 0) {
+      tempo_map = std::make_shared<timebase::TempoMap>(*previous.tempo_map_);
+      tempo_map->TruncateAt(retimed_ticks);
+    } else {
+      tempo_map = std::make_shared<timebase::TempoMap>(division);
+    }
+    tempo_positions_reused = retimed_ticks > 0 ? tempo_map->size() : 0;
+    auto first_to_acknowledge = std::lower_bound(
+        metaevents_->cbegin(), metaevents_->cend(), retimed_ticks,
+        [](const Event &event, double ticks) {
+          return event.ticks() < ticks;
+        });
+    std::for_each(first_to_acknowledge, metaevents_->cend(),
+                  [&](const Event &event) {
+                    if (timebase::TempoMap::IsTempoEvent(event))
+                      tempo_map->AcknowledgeEvent(event);
+                  });
+    tempo_map_ = std::move(tempo_map);
+  }
+  if (metaevents_ == previous.metaevents_
+      && tempo_map_ == previous.tempo_map_) {
+    marker_index_ = previous.marker_index_;
+  } else {
+    // Markers are few, it is not worth patching the index.
+    marker_index_ = std::make_shared<MarkerIndex>(*metaevents_, *tempo_map_);
+  }
+
+  tracks_ = std::move(tracks);
+  next_event_ = events_->end();
+  reposition_worker_ = std::make_shared<RepositionWorker>(events_,
+                                                          tempo_map_);
+  setup_end_ = FindSetupEnd(*events_);
+  if (previous.frame_timeline_) {
+    frame_timeline_ = std::make_shared<FrameTimeline>(
+        *events_, *tempo_map_, previous.frame_timeline_->frame_rate(),
+        previous.frame_timeline_.get(), retimed_ticks);
+  }
+
+  if (stats != nullptr) {
+    stats->tracks_total = tracks_->size();
+    stats->tracks_reused = tracks_reused;
+    stats->events_total = events_->size() + metaevents_->size();
+    stats->events_reused = events_reused;
+    stats->tempo_positions_total = tempo_map_->size();
+    stats->tempo_positions_reused = tempo_positions_reused;
+  }
+}
+
+void SmfStreamer::Prerender(jack_nframes_t frame_rate) {
+  if (prefetcher_) return;
+  if (frame_timeline_ && frame_timeline_->frame_rate() == frame_rate)
+    return;
+  frame_timeline_ = std::make_shared<FrameTimeline>(*events_, *tempo_map_,
+                                                    frame_rate);
+}
+
+SmfStreamer SmfStreamer::OpenStreaming(const std::string &filename,
+                                       LoadTimings *timings) {
+  auto index_start = std::chrono::steady_clock::now();
+  SmfStreamer smf_streamer;
+  smf_streamer.prefetcher_ = std::make_shared<EventPrefetcher>(filename);
+  smf_streamer.tempo_map_ = smf_streamer.prefetcher_->tempo_map();
+  smf_streamer.marker_index_ = smf_streamer.prefetcher_->marker_index();
+  if (timings != nullptr) {
+    std::chrono::duration<double> index_duration =
+        std::chrono::steady_clock::now() - index_start;
+    *timings = {0, 0, index_duration.count()};
+  }
+  return smf_streamer;
+}
+
+void SmfStreamer::Reposition(
+    double seconds, const timebase::TimeScale &time_scale) noexcept {
+  double file_seconds = time_scale.ToFileSeconds(seconds);
+  if (prefetcher_) {
+    prefetcher_->Seek(file_seconds);
+  } else {
+    Rewind();
+    SeekForwardTo(file_seconds);
+  }
+  initialized_ = true;
+  repositioned_ = true;
+  // A reposition still being prepared is superseded.
+  reposition_pending_ = false;
+  chase_pending_ = false;
+  setup_pending_ = false;
+  setup_sent_ = false;
+  requested_seconds_ = file_seconds;
+  consumed_ = false;
+}
+
+void SmfStreamer::RequestReposition(
+    double seconds, const timebase::TimeScale &time_scale) noexcept {
+  if (!reposition_worker_) {
+    Reposition(seconds, time_scale);
+    return;
+  }
+  double file_seconds = time_scale.ToFileSeconds(seconds);
+  if (initialized_ && !consumed_ && file_seconds == requested_seconds_)
+    return;
+  reposition_generation_ = reposition_worker_->Request(file_seconds);
+  reposition_pending_ = true;
+  chase_pending_ = false;
+  setup_pending_ = setup_end_ > 0;
+  setup_sent_ = setup_pending_;
+  next_setup_event_ = 0;
+  requested_seconds_ = file_seconds;
+  consumed_ = false;
+  // Nothing is played until the prepared position arrives.
+  next_event_ = events_->end();
   initialized_ = true;
   repositioned_ = true;
 }
 
-void SmfStreamer::StopIfNeeded(bool now_playing, JackMidiSink &sink) {
+bool SmfStreamer::ready() noexcept {
+  if (prefetcher_) return prefetcher_->ready();
+  PollReposition();
+  return !reposition_pending_ && !setup_pending_;
+}
+
+RtStatus SmfStreamer::WriteSetup(size_t budget, MidiSink &sink) noexcept {
+  if (!setup_pending_) return RtStatus::kOk;
+  RtStatus status = RtStatus::kOk;
+  size_t written = 0;
+  for (SegmentedEvents::Iterator event = events_->At(next_setup_event_);
+       next_setup_event_ < setup_end_; ++event, ++next_setup_event_) {
+    const MidiBuffer &midi = event->midi();
+    if (IsSysex(midi)) {
+      // A single message larger than the budget still has to go out.
+      if (written > 0 && written + midi.size() > budget) return status;
+      RtStatus event_status = sink.WriteMidi(0, midi.data(), midi.size());
+      if (status == RtStatus::kOk) status = event_status;
+      written += midi.size();
+    }
+  }
+  setup_pending_ = false;
+  return status;
+}
+
+RtStatus SmfStreamer::StopIfNeeded(bool now_playing,
+                                   MidiSink &sink) noexcept {
+  RtStatus status = RtStatus::kOk;
   if (repositioned_ || (was_playing_ && !now_playing))
-    sink.WriteGlobalSoundOff(0);
+    status = sink.WriteActiveNotesOff(0);
   repositioned_ = false;
   was_playing_ = now_playing;
+  return status;
 }
 
-void SmfStreamer::CopyToSink(double start_seconds, double end_seconds,
-                             JackMidiSink &sink) {
+RtStatus SmfStreamer::CopyToSink(double start_seconds, double end_seconds,
+                                 const timebase::TimeScale &time_scale,
+                                 const PlaybackControls &controls,
+                                 MidiSink &sink) noexcept {
+  if (prefetcher_) {
+    return CopyPrefetchedToSink(start_seconds, end_seconds, time_scale,
+                                controls, sink);
+  }
+  consumed_ = true;
+  PollReposition();
+  // The transport only waits for a slow sync client so long.
+  if (reposition_pending_) return RtStatus::kPrefetchUnderrun;
+  // Should the transport roll before the setup data went out, it is
+  // flushed right away, so that it still precedes the chased state.
+  RtStatus status = WriteSetup(SIZE_MAX, sink);
+  if (chase_pending_) {
+    RtStatus chase_status = chase_.WriteToSink(controls, sink);
+    if (status == RtStatus::kOk) status = chase_status;
+    chase_pending_ = false;
+  }
+  long long start_frame = RoundToFrame(start_seconds, sink);
+  long long end_frame = RoundToFrame(end_seconds, sink);
+  if (frame_timeline_ && frame_timeline_->frame_rate() == sink.framerate()
+      && time_scale.identity()) {
+    RtStatus timeline_status = CopyPrerenderedToSink(start_frame, end_frame,
+                                                     controls, sink);
+    return status == RtStatus::kOk ? timeline_status : status;
+  }
   while (next_event_valid()) {
-    double seconds = tempo_map_.GetTicks(next_event_->ticks()).seconds();
-    if (seconds >= end_seconds) break;
-    if (!next_event_->is_metadata()) {
-      // Once repositioned by Reposition(), streaming is continous:
-      // start_seconds corresponds to the end_seconds of the previous
-      // cycle. If there is a discrepancy, send any events missed in
-      // the previous cycle (in our "past") anyways.
-      double offset_seconds = std::max(0., seconds - start_seconds);
-      sink.WriteMidi(offset_seconds, next_event_->midi().data(),
-                     next_event_->midi().size());
+    double file_seconds =
+        tempo_map_->GetTicks(next_event_->ticks()).seconds();
+    long long frame = RoundToFrame(
+        time_scale.ToTransportSeconds(file_seconds), sink);
+    if (frame >= end_frame) break;
+    bool sent_as_setup = setup_sent_
+        && next_event_.index() < setup_end_
+        && IsSysex(next_event_->midi());
+    if (!sent_as_setup) {
+      RtStatus event_status = CopyEventToSink(
+          frame - start_frame, next_event_->midi().data(),
+          next_event_->midi().size(), controls, sink);
+      if (status == RtStatus::kOk) status = event_status;
     }
     ++next_event_;
   }
+  return status;
+}
+
+RtStatus SmfStreamer::CopyPrefetchedToSink(
+    double start_seconds, double end_seconds,
+    const timebase::TimeScale &time_scale,
+    const PlaybackControls &controls, MidiSink &sink) noexcept {
+  RtStatus status = RtStatus::kOk;
+  long long start_frame = RoundToFrame(start_seconds, sink);
+  long long end_frame = RoundToFrame(end_seconds, sink);
+  PrefetchedEvent event;
+  while (prefetcher_->Peek(event)) {
+    long long frame = RoundToFrame(
+        time_scale.ToTransportSeconds(event.file_seconds), sink);
+    if (frame >= end_frame) return status;
+    RtStatus event_status = CopyEventToSink(
+        frame - start_frame, event.data, event.size, controls, sink);
+    if (status == RtStatus::kOk) status = event_status;
+    prefetcher_->Pop();
+  }
+  // Nothing can be known about events due in this cycle that were not
+  // decoded yet, they will be sent late once they arrive.
+  if (!prefetcher_->finished() && status == RtStatus::kOk)
+    status = RtStatus::kPrefetchUnderrun;
+  return status;
+}
+
+RtStatus SmfStreamer::CopyPrerenderedToSink(
+    long long start_frame, long long end_frame,
+    const PlaybackControls &controls, MidiSink &sink) noexcept {
+  RtStatus status = RtStatus::kOk;
+  while (next_event_valid()) {
+    const FrameTimeline::Segment &timeline =
+        frame_timeline_->segment(next_event_.segment());
+    // Indices are local to the segment.
+    size_t segment_start = next_event_.index() - next_event_.offset();
+    size_t setup_end = setup_end_ > segment_start
+        ? setup_end_ - segment_start : 0;
+    size_t index = next_event_.offset();
+    size_t due_end = timeline.FindDueEnd(index, end_frame);
+    // Events that have to be filtered, and the setup data that has to
+    // be skipped, are written one by one.
+    size_t single_end = due_end;
+    if (controls.pass_through()) {
+      single_end = setup_sent_
+          ? std::min(std::max(index, setup_end), due_end) : index;
+    }
+    for (; index < single_end; ++index) {
+      size_t size = timeline.data_size(index);
+      const uint8_t *data = timeline.data(index);
+      if (setup_sent_ && index < setup_end
+          && (data[0] == 0xf0 || data[0] == 0xf7))
+        continue;
+      RtStatus event_status = CopyEventToSink(
+          timeline.frame(index) - start_frame, data, size, controls, sink);
+      if (status == RtStatus::kOk) status = event_status;
+    }
+    jack_nframes_t offsets[kRunChunkEvents];
+    while (index < due_end) {
+      size_t count = std::min(due_end - index, size_t{kRunChunkEvents});
+      for (size_t i = 0; i < count; ++i) {
+        // Events missed in the previous cycle are sent right away, like
+        // by CopyEventToSink().
+        long long offset = timeline.frame(index + i) - start_frame;
+        offsets[i] = offset > 0 ? static_cast<jack_nframes_t>(offset) : 0;
+      }
+      RtStatus run_status = sink.WriteRunAt(
+          offsets, timeline.data_offsets(index), timeline.bytes(), count);
+      if (status == RtStatus::kOk) status = run_status;
+      index += count;
+    }
+    next_event_ = events_->At(segment_start + index);
+    // The rest of the segment is not due yet.
+    if (index < timeline.size()) break;
+  }
+  return status;
+}
+
+RtStatus SmfStreamer::CopyEventToSink(long long offset,
+                                      const uint8_t *data, size_t size,
+                                      const PlaybackControls &controls,
+                                      MidiSink &sink) noexcept {
+  uint8_t scratch[3];
+  const uint8_t *filtered = controls.Filter(data, size, scratch);
+  if (filtered == nullptr) return RtStatus::kOk;
+  // Once repositioned by Reposition(), streaming is continous: the
+  // start of the cycle corresponds to the end of the previous one. If
+  // there is a discrepancy, send any events missed in the previous
+  // cycle (in our "past") anyways.
+  return sink.WriteMidiAt(offset > 0 ? static_cast<jack_nframes_t>(offset)
+                                     : 0,
+                          filtered, size);
+}
+
+void SmfStreamer::PollReposition() noexcept {
+  if (!reposition_pending_) return;
+  RepositionResult result;
+  if (!reposition_worker_->Poll(reposition_generation_, result)) return;
+  next_event_ = events_->At(result.next_event);
+  chase_ = result.chase;
+  chase_pending_ = true;
+  reposition_pending_ = false;
 }
 
-void SmfStreamer::Rewind() {
-  next_event_ = events_.begin();
+void SmfStreamer::Rewind() noexcept {
+  next_event_ = events_->begin();
 }
 
-void SmfStreamer::SeekForwardTo(double seconds) {
+void SmfStreamer::SeekForwardTo(double seconds) noexcept {
   while (next_event_valid()
-         && tempo_map_.GetTicks(next_event_->ticks()).seconds() < seconds) {
+         && tempo_map_->GetTicks(next_event_->ticks()).seconds() < seconds) {
     ++next_event_;
   }
 }
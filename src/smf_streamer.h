@@ -1,40 +1,276 @@
 #ifndef SMF_STREAMER_H_
 #define SMF_STREAMER_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "chase_state.h"
 #include "event.h"
-#include "jack_midi_sink.h"
+#include "event_prefetcher.h"
+#include "frame_timeline.h"
+#include "marker_index.h"
+#include "midi_sink.h"
+#include "playback_control.h"
+#include "reposition_worker.h"
+#include "segmented_events.h"
+#include "smf_tracks.h"
 #include "timebase/tempo_map.h"
+#include "timebase/time_scale.h"
 
 namespace midiaud {
 
+/**
+ * Describes how much of the previously loaded file could be reused
+ * by an incremental reload.
+ */
+struct ReloadStats {
+  size_t tracks_total;
+  /**
+   * Tracks whose chunk did not change, thus were not decoded again.
+   */
+  size_t tracks_reused;
+  size_t events_total;
+  /**
+   * Events in the segments shared with the previous streamer, and the
+   * metaevents if none of them changed.
+   */
+  size_t events_reused;
+  size_t tempo_positions_total;
+  size_t tempo_positions_reused;
+};
+
+/**
+ * Time spent in the phases of loading a file, for profiling startup.
+ */
+struct LoadTimings {
+  double parse_seconds;
+  double tempo_map_seconds;
+  /**
+   * Only streaming builds a seek index. The tempo map is built by the
+   * same scan, thus it is accounted for here.
+   */
+  double index_seconds;
+};
+
 class SmfStreamer {
  public:
   SmfStreamer();
-  SmfStreamer(const std::string &filename);
+  explicit SmfStreamer(const std::string &filename,
+                       LoadTimings *timings = nullptr);
+  /**
+   * Reloads `filename`, sharing what did not change with `previous`.
+   *
+   * Only the tracks whose chunk changed are decoded, and only their
+   * events are compared with the old ones to find the ticks touched
+   * by the edit. The segments of events overlapping those ticks are
+   * merged again from the tracks, the others are shared, and so is
+   * their layout if `previous` was prerendered. The tempo map is only
+   * rebuilt from the first changed metaevent onwards, and only if a
+   * tempo or time signature metaevent was touched by the edit.
+   */
+  SmfStreamer(const std::string &filename, const SmfStreamer &previous,
+              ReloadStats *stats = nullptr);
+  /**
+   * Opens `filename` for streaming with bounded memory: events are
+   * decoded by a background thread shortly before they are due
+   * instead of being loaded up front. Copies of the streamer share
+   * the background thread, only one of them may be played.
+   */
+  static SmfStreamer OpenStreaming(const std::string &filename,
+                                   LoadTimings *timings = nullptr);
+
+  /**
+   * Lays out the events at the frames they are due at `frame_rate`,
+   * so that cycles played at the notated tempo and that frame rate
+   * copy ready-made runs of messages. Other cycles are played as
+   * usual. Does nothing for streamed files.
+   *
+   * Must be called before the streamer is handed to the RT thread,
+   * copies share the layout. Does nothing if the events are already
+   * laid out at `frame_rate`, like those of a reload of a prerendered
+   * file.
+   */
+  void Prerender(jack_nframes_t frame_rate);
 
-  void Reposition(double seconds);
-  void StopIfNeeded(bool now_playing, JackMidiSink &sink);
-  void CopyToSink(double start_seconds, double end_seconds,
-                  JackMidiSink &sink);
+  /**
+   * Moves the playhead to `seconds` right away, without chasing.
+   */
+  void Reposition(double seconds,
+                  const timebase::TimeScale &time_scale) noexcept;
+  /**
+   * Asks for the playhead to be moved to `seconds`, with the
+   * controllers, programs and pitch wheels set before it chased. The
+   * position is prepared by a background thread, ready() tells when
+   * it is done. Asking for the position that is already prepared or
+   * being prepared again does nothing, unless events were played
+   * since.
+   *
+   * Streaming files are sought like by Reposition(), without chasing.
+   */
+  void RequestReposition(double seconds,
+                         const timebase::TimeScale &time_scale) noexcept;
+  RtStatus StopIfNeeded(bool now_playing, MidiSink &sink) noexcept;
+  /**
+   * Writes the events due in the given interval of transport time to
+   * `sink`.
+   *
+   * The chased state is written first after a RequestReposition().
+   * Events that cannot be written are dropped, and the first failure
+   * is returned. RtStatus::kPrefetchUnderrun is returned if the events
+   * were not decoded or the reposition was not prepared in time.
+   */
+  RtStatus CopyToSink(double start_seconds, double end_seconds,
+                      const timebase::TimeScale &time_scale,
+                      const PlaybackControls &controls,
+                      MidiSink &sink) noexcept;
+
+  /**
+   * Writes the setup data of the file, the SysEx before its first
+   * note, after a RequestReposition(). At most `budget` bytes are
+   * written per call, unless a single message is larger, so that
+   * heavy setup data is spread across several cycles while the
+   * transport is starting. Playback skips the setup data sent this
+   * way.
+   */
+  RtStatus WriteSetup(size_t budget, MidiSink &sink) noexcept;
+
+  /**
+   * Returns whether the events at the position of the last
+   * Reposition() or RequestReposition() are available and the setup
+   * data was written.
+   */
+  bool ready() noexcept;
 
   bool initialized() const { return initialized_; }
-  const timebase::TempoMap &tempo_map() const { return tempo_map_; }
+  /**
+   * Whether the position of the last RequestReposition() is still
+   * being prepared, as of the last ready() call.
+   */
+  bool repositioning() const { return reposition_pending_; }
+  bool streaming() const { return prefetcher_ != nullptr; }
+  size_t event_count() const {
+    return prefetcher_ ? prefetcher_->event_count() : events_->size();
+  }
+  /**
+   * Returns whether every event was already streamed.
+   */
+  bool finished() const {
+    return initialized_
+        && (prefetcher_ ? prefetcher_->finished() : !next_event_valid());
+  }
+  /**
+   * Frame rate passed to Prerender(), 0 if there was none.
+   */
+  jack_nframes_t prerendered_rate() const {
+    return frame_timeline_ ? frame_timeline_->frame_rate() : 0;
+  }
+  const timebase::TempoMap &tempo_map() const { return *tempo_map_; }
+  const MarkerIndex &marker_index() const { return *marker_index_; }
+  std::shared_ptr<const timebase::TempoMap> shared_tempo_map() const {
+    return tempo_map_;
+  }
+  /**
+   * Identifies the load of this streamer in a cycle trace, 0 if it is
+   * not traced.
+   */
+  uint32_t load_id() const { return load_id_; }
+  void set_load_id(uint32_t load_id) { load_id_ = load_id; }
 
  private:
-  void Rewind();
-  void SeekForwardTo(double seconds);
+  typedef std::vector<Event> EventList;
+
+  /**
+   * Prerendered events are written in runs of at most this many, so
+   * that their offsets fit on the stack of the RT thread.
+   */
+  static constexpr size_t kRunChunkEvents = 64;
+
+  void Rewind() noexcept;
+  /**
+   * Takes over the prepared reposition if it arrived.
+   */
+  void PollReposition() noexcept;
+  void SeekForwardTo(double seconds) noexcept;
+  RtStatus CopyPrefetchedToSink(double start_seconds, double end_seconds,
+                                const timebase::TimeScale &time_scale,
+                                const PlaybackControls &controls,
+                                MidiSink &sink) noexcept;
+  /**
+   * Writes the entries of `frame_timeline_` before `end_frame`,
+   * starting at the next event. The run of due entries of every
+   * segment is found by FrameTimeline::Segment::FindDueEnd() and
+   * written in bulk, unless the playback controls have to alter it.
+   */
+  RtStatus CopyPrerenderedToSink(long long start_frame, long long end_frame,
+                                 const PlaybackControls &controls,
+                                 MidiSink &sink) noexcept;
+  /**
+   * Writes a single channel or system exclusive message due `offset`
+   * frames into the cycle.
+   */
+  static RtStatus CopyEventToSink(long long offset, const uint8_t *data,
+                                  size_t size,
+                                  const PlaybackControls &controls,
+                                  MidiSink &sink) noexcept;
 
-  bool next_event_valid() const { return next_event_ != events_.cend(); }
+  bool next_event_valid() const noexcept {
+    return next_event_ != events_->end();
+  }
 
   bool initialized_;
   bool was_playing_;
   bool repositioned_;
-  std::vector<Event> events_;
-  timebase::TempoMap tempo_map_;
-  std::vector<Event>::const_iterator next_event_;
+  // Shared between the streamers of successive reloads. They are
+  // immutable once the streamer is constructed, so copies of the
+  // streamer can be handed to the RT thread cheaply. Metaevents are
+  // kept apart from the events sent to the sink, only the main thread
+  // looks at them and at the decoded tracks.
+  std::shared_ptr<const TrackList> tracks_;
+  std::shared_ptr<const SegmentedEvents> events_;
+  std::shared_ptr<const EventList> metaevents_;
+  std::shared_ptr<const timebase::TempoMap> tempo_map_;
+  std::shared_ptr<const MarkerIndex> marker_index_;
+  SegmentedEvents::Iterator next_event_;
+  /**
+   * Source of the events instead of `events_` when streaming.
+   */
+  std::shared_ptr<EventPrefetcher> prefetcher_;
+  /**
+   * Frames of `events_` at a fixed frame rate, if prerendered. Shared
+   * by the copies like `events_`.
+   */
+  std::shared_ptr<const FrameTimeline> frame_timeline_;
+  /**
+   * Prepares the repositions of `events_`, shared by the copies like
+   * `prefetcher_`.
+   */
+  std::shared_ptr<RepositionWorker> reposition_worker_;
+  bool reposition_pending_;
+  uint32_t reposition_generation_;
+  double requested_seconds_;
+  /**
+   * Whether events were played since the last reposition.
+   */
+  bool consumed_;
+  bool chase_pending_;
+  ChaseState chase_;
+  /**
+   * Events before this index are setup data if they are SysEx.
+   * Immutable after construction, 0 if there is no setup data or the
+   * file is streamed.
+   */
+  size_t setup_end_;
+  bool setup_pending_;
+  /**
+   * Whether the setup data was written by WriteSetup() since the last
+   * reposition.
+   */
+  bool setup_sent_;
+  size_t next_setup_event_;
+  uint32_t load_id_;
 };
 
 }
@@ -0,0 +1,119 @@
+
+#include "smf_tracks.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "smf_decoder.h"
+
+namespace midiaud {
+
+namespace {
+
+/**
+ * Number of events after which a segment is closed at the next change
+ * of ticks. A reload merges this many events again for an edit of a
+ * single note.
+ */
+constexpr size_t kSegmentEvents = 4096;
+
+/**
+ * The events of a track yet to be merged.
+ */
+struct MergeCursor {
+  std::vector<Event>::const_iterator next;
+  std::vector<Event>::const_iterator end;
+  size_t track;
+};
+
+/**
+ * Calls `visit` with the events in the `list` of every track at or
+ * after `begin_ticks` and before `end_ticks`, in time order and by
+ * track.
+ */
+template <typename Visitor>
+void Merge(const TrackList &tracks, std::vector<Event> DecodedTrack::*list,
+           double begin_ticks, double end_ticks, Visitor visit) {
+  auto before = [](const Event &event, double ticks) {
+    return event.ticks() < ticks;
+  };
+  std::vector<MergeCursor> heap;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const std::vector<Event> &events = (*tracks[i]).*list;
+    auto next = std::lower_bound(events.cbegin(), events.cend(),
+                                 begin_ticks, before);
+    auto end = std::lower_bound(next, events.cend(), end_ticks, before);
+    if (next != end) heap.push_back({next, end, i});
+  }
+  auto later = [](const MergeCursor &lhs, const MergeCursor &rhs) {
+    if (lhs.next->ticks() != rhs.next->ticks())
+      return lhs.next->ticks() > rhs.next->ticks();
+    return lhs.track > rhs.track;
+  };
+  std::make_heap(heap.begin(), heap.end(), later);
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    MergeCursor &cursor = heap.back();
+    visit(*cursor.next);
+    if (++cursor.next == cursor.end) {
+      heap.pop_back();
+    } else {
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+  }
+}
+
+}
+
+TrackList ReadTracks(const std::string &filename, const TrackList &previous,
+                     timebase::TimeDivision &division) {
+  SmfDecoder decoder(filename);
+  division = decoder.division();
+  TrackList tracks;
+  tracks.reserve(decoder.track_count());
+  for (size_t i = 0; i < decoder.track_count(); ++i) {
+    std::vector<uint8_t> bytes = decoder.ReadTrack(i);
+    if (i < previous.size() && previous[i]->bytes == bytes) {
+      tracks.push_back(previous[i]);
+      continue;
+    }
+    auto track = std::make_shared<DecodedTrack>();
+    track->bytes = std::move(bytes);
+    decoder.SelectTrack(i);
+    while (decoder.Next()) {
+      std::vector<Event> &events = decoder.is_metadata() ? track->metaevents
+                                                         : track->events;
+      events.emplace_back(decoder.ticks(), decoder.data().cbegin(),
+                          decoder.data().cend());
+    }
+    tracks.push_back(std::move(track));
+  }
+  return tracks;
+}
+
+void MergeTracks(const TrackList &tracks, double begin_ticks,
+                 double end_ticks,
+                 std::vector<SegmentedEvents::SegmentPtr> &segments) {
+  auto segment = std::make_shared<SegmentedEvents::Segment>();
+  Merge(tracks, &DecodedTrack::events, begin_ticks, end_ticks,
+        [&](const Event &event) {
+          // Events of the same ticks are kept in the same segment.
+          if (segment->size() >= kSegmentEvents
+              && event.ticks() != segment->back().ticks()) {
+            segments.push_back(std::move(segment));
+            segment = std::make_shared<SegmentedEvents::Segment>();
+          }
+          segment->push_back(event);
+        });
+  if (!segment->empty()) segments.push_back(std::move(segment));
+}
+
+std::vector<Event> MergeMetaevents(const TrackList &tracks) {
+  std::vector<Event> metaevents;
+  Merge(tracks, &DecodedTrack::metaevents, 0,
+        std::numeric_limits<double>::infinity(),
+        [&](const Event &event) { metaevents.push_back(event); });
+  return metaevents;
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef SMF_TRACKS_H_
+#define SMF_TRACKS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event.h"
+#include "segmented_events.h"
+#include "timebase/time_division.h"
+
+namespace midiaud {
+
+/**
+ * A track of a Standard MIDI File, decoded on its own.
+ *
+ * Immutable, so that the loads of a file can share the tracks that
+ * did not change.
+ */
+struct DecodedTrack {
+  /**
+   * Contents of the track chunk, to tell whether it changed.
+   */
+  std::vector<uint8_t> bytes;
+  std::vector<Event> events;
+  std::vector<Event> metaevents;
+};
+
+typedef std::vector<std::shared_ptr<const DecodedTrack>> TrackList;
+
+/**
+ * Reads the tracks of `filename`. A track whose chunk is the same,
+ * byte for byte, as the track at the same position of `previous` is
+ * shared with it instead of being decoded again.
+ *
+ * @throws std::runtime_error if the file cannot be read or is
+ *         malformed.
+ */
+TrackList ReadTracks(const std::string &filename, const TrackList &previous,
+                     timebase::TimeDivision &division);
+
+/**
+ * Merges the events of `tracks` at or after `begin_ticks` and before
+ * `end_ticks` in time order, events at the same time ordered by
+ * track, like libsmf does. They are appended to `segments` in
+ * segments of a few thousand events.
+ */
+void MergeTracks(const TrackList &tracks, double begin_ticks,
+                 double end_ticks,
+                 std::vector<SegmentedEvents::SegmentPtr> &segments);
+
+/**
+ * Merges the metaevents of `tracks` in time order.
+ */
+std::vector<Event> MergeMetaevents(const TrackList &tracks);
+
+}
+
+#endif // SMF_TRACKS_H_
@@ -0,0 +1,220 @@
+
+#include "stats_page.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace midiaud {
+
+namespace {
+
+constexpr int kMaxReadAttempts = 1000;
+
+void BeginWrite(std::atomic<uint32_t> &sequence) noexcept {
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+  // Keeps the updates of the group after the counter turned odd.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void EndWrite(std::atomic<uint32_t> &sequence) noexcept {
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_release);
+}
+
+/**
+ * Copies a group of fields with `read` until the copy is consistent.
+ * Gives up after kMaxReadAttempts, e.g. if the writer died in the
+ * middle of an update.
+ */
+template <typename Read>
+bool ReadConsistent(const std::atomic<uint32_t> &sequence, Read read) {
+  for (int attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+    uint32_t begin = sequence.load(std::memory_order_acquire);
+    if (begin % 2 == 0) {
+      read();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == begin) return true;
+    }
+    std::this_thread::yield();
+  }
+  return false;
+}
+
+template <typename T>
+void Increment(std::atomic<T> &counter, T amount) noexcept {
+  // Single writer, no need for an atomic read-modify-write.
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+}
+
+size_t CycleBucket(uint32_t microseconds) noexcept {
+  if (microseconds < 4) return microseconds;
+  int msb = 2;
+  while (microseconds >> (msb + 1)) ++msb;
+  size_t bucket = 4 * (msb - 1) + ((microseconds >> (msb - 2)) & 3);
+  return std::min(bucket, StatsBlock::kCycleBuckets - 1);
+}
+
+uint32_t CycleBucketLimit(size_t bucket) noexcept {
+  if (bucket < 4) return static_cast<uint32_t>(bucket);
+  if (bucket == StatsBlock::kCycleBuckets - 1) return UINT32_MAX;
+  int msb = static_cast<int>(bucket / 4) + 1;
+  uint32_t next_start = static_cast<uint32_t>(4 + bucket % 4 + 1)
+      << (msb - 2);
+  return next_start - 1;
+}
+
+uint32_t StatsSnapshot::CyclePercentile(double fraction) const noexcept {
+  uint64_t total = 0;
+  for (uint64_t count : cycle_histogram) total += count;
+  if (total == 0) return 0;
+  uint64_t below = 0;
+  for (size_t bucket = 0; bucket < cycle_histogram.size(); ++bucket) {
+    below += cycle_histogram[bucket];
+    if (below >= fraction * total)
+      return std::min(CycleBucketLimit(bucket), max_cycle_microseconds);
+  }
+  return max_cycle_microseconds;
+}
+
+StatsPage::StatsPage(const std::string &client_name)
+    : name_(kNamePrefix + std::to_string(getpid())), block_(nullptr) {
+  // A segment left behind by a crashed process with the same pid is
+  // taken over.
+  int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw std::runtime_error("shm_open failed for " + name_);
+  void *memory = MAP_FAILED;
+  if (ftruncate(fd, sizeof(StatsBlock)) == 0) {
+    memory = mmap(nullptr, sizeof(StatsBlock), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(name_.c_str());
+    throw std::runtime_error("cannot map " + name_);
+  }
+  block_ = new (memory) StatsBlock();
+  block_->version = StatsBlock::kVersion;
+  block_->pid = static_cast<int32_t>(getpid());
+  std::strncpy(block_->client_name, client_name.c_str(),
+               StatsBlock::kClientNameSize - 1);
+  block_->magic.store(StatsBlock::kMagic, std::memory_order_release);
+}
+
+StatsPage::~StatsPage() {
+  munmap(block_, sizeof(StatsBlock));
+  shm_unlink(name_.c_str());
+}
+
+void StatsPage::CountError(RtStatus status) noexcept {
+  size_t index = static_cast<size_t>(status);
+  if (index >= StatsBlock::kStatusCount) return;
+  BeginWrite(block_->rt_sequence);
+  Increment<uint64_t>(block_->errors[index], 1);
+  EndWrite(block_->rt_sequence);
+}
+
+void StatsPage::PublishCycle(jack_transport_state_t state,
+                             jack_nframes_t frame,
+                             jack_nframes_t frame_rate,
+                             jack_nframes_t nframes,
+                             size_t events_written, size_t bytes_written,
+                             uint32_t microseconds) noexcept {
+  const auto relaxed = std::memory_order_relaxed;
+  BeginWrite(block_->rt_sequence);
+  block_->transport_state.store(state, relaxed);
+  block_->frame.store(frame, relaxed);
+  block_->frame_rate.store(frame_rate, relaxed);
+  block_->nframes.store(nframes, relaxed);
+  if (microseconds > block_->max_cycle_microseconds.load(relaxed))
+    block_->max_cycle_microseconds.store(microseconds, relaxed);
+  Increment<uint64_t>(block_->cycles, 1);
+  Increment<uint64_t>(block_->events_written, events_written);
+  Increment<uint64_t>(block_->bytes_written, bytes_written);
+  Increment<uint64_t>(block_->cycle_histogram[CycleBucket(microseconds)], 1);
+  EndWrite(block_->rt_sequence);
+}
+
+void StatsPage::PublishFile(const std::string &input_file, uint32_t reloads,
+                            double last_reload_seconds) noexcept {
+  const auto relaxed = std::memory_order_relaxed;
+  uint64_t words[StatsBlock::kInputFileWords] = {};
+  std::memcpy(words, input_file.c_str(),
+              std::min(input_file.size(), sizeof(words) - 1));
+  BeginWrite(block_->main_sequence);
+  block_->reloads.store(reloads, relaxed);
+  block_->last_reload_microseconds.store(
+      static_cast<uint32_t>(last_reload_seconds * 1e6), relaxed);
+  for (size_t i = 0; i < StatsBlock::kInputFileWords; ++i)
+    block_->input_file[i].store(words[i], relaxed);
+  EndWrite(block_->main_sequence);
+}
+
+bool ReadStatsPage(const std::string &name, StatsSnapshot *snapshot) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+  struct stat status;
+  void *memory = MAP_FAILED;
+  if (fstat(fd, &status) == 0
+      && static_cast<size_t>(status.st_size) >= sizeof(StatsBlock)) {
+    memory = mmap(nullptr, sizeof(StatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) return false;
+  const StatsBlock *block = static_cast<const StatsBlock *>(memory);
+
+  const auto relaxed = std::memory_order_relaxed;
+  bool valid = block->magic.load(std::memory_order_acquire)
+      == StatsBlock::kMagic && block->version == StatsBlock::kVersion;
+  if (valid) {
+    snapshot->pid = block->pid;
+    snapshot->client_name.assign(
+        block->client_name,
+        strnlen(block->client_name, StatsBlock::kClientNameSize));
+  }
+  valid = valid && ReadConsistent(block->rt_sequence, [&] {
+    snapshot->transport_state = static_cast<jack_transport_state_t>(
+        block->transport_state.load(relaxed));
+    snapshot->frame = block->frame.load(relaxed);
+    snapshot->frame_rate = block->frame_rate.load(relaxed);
+    snapshot->nframes = block->nframes.load(relaxed);
+    snapshot->max_cycle_microseconds =
+        block->max_cycle_microseconds.load(relaxed);
+    snapshot->cycles = block->cycles.load(relaxed);
+    snapshot->events_written = block->events_written.load(relaxed);
+    snapshot->bytes_written = block->bytes_written.load(relaxed);
+    for (size_t i = 0; i < StatsBlock::kStatusCount; ++i)
+      snapshot->errors[i] = block->errors[i].load(relaxed);
+    for (size_t i = 0; i < StatsBlock::kCycleBuckets; ++i)
+      snapshot->cycle_histogram[i] = block->cycle_histogram[i].load(relaxed);
+  });
+  uint64_t words[StatsBlock::kInputFileWords];
+  valid = valid && ReadConsistent(block->main_sequence, [&] {
+    snapshot->reloads = block->reloads.load(relaxed);
+    snapshot->last_reload_microseconds =
+        block->last_reload_microseconds.load(relaxed);
+    for (size_t i = 0; i < StatsBlock::kInputFileWords; ++i)
+      words[i] = block->input_file[i].load(relaxed);
+  });
+  if (valid) {
+    const char *input_file = reinterpret_cast<const char *>(words);
+    snapshot->input_file.assign(input_file,
+                                strnlen(input_file, sizeof(words)));
+  }
+  munmap(memory, sizeof(StatsBlock));
+  return valid;
+}
+
+}
@@ -0,0 +1,174 @@
+#ifndef STATS_PAGE_H_
+#define STATS_PAGE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <jack/jack.h>
+
+#include "rt_status.h"
+
+namespace midiaud {
+
+/**
+ * Layout of a stats segment, shared with the processes reading it.
+ *
+ * Every field that changes after creation is a lock-free atomic, so
+ * that readers never see torn values. The fields are grouped by their
+ * writer, and each group is guarded by a sequence counter (seqlock):
+ * the writer makes the counter odd while it updates the group, so a
+ * reader can tell whether its copy is consistent and retry if not.
+ * Writers never wait for readers.
+ */
+struct StatsBlock {
+  static constexpr uint32_t kMagic = 0x6d696469; // "midi"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kClientNameSize = 64;
+  static constexpr size_t kInputFileWords = 32;
+  /**
+   * Cycle durations are counted in buckets of 4 per octave of
+   * microseconds, see CycleBucket().
+   */
+  static constexpr size_t kCycleBuckets = 64;
+  static constexpr size_t kStatusCount =
+      static_cast<size_t>(RtStatus::kStatusCount);
+
+  /**
+   * Set last when the segment is created, so that readers skip
+   * segments that are not initialized yet.
+   */
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  int32_t pid;
+  char client_name[kClientNameSize];
+
+  // Written by the RT thread.
+  std::atomic<uint32_t> rt_sequence;
+  std::atomic<uint32_t> transport_state;
+  std::atomic<uint32_t> frame;
+  std::atomic<uint32_t> frame_rate;
+  std::atomic<uint32_t> nframes;
+  std::atomic<uint32_t> max_cycle_microseconds;
+  std::atomic<uint64_t> cycles;
+  std::atomic<uint64_t> events_written;
+  std::atomic<uint64_t> bytes_written;
+  /**
+   * Number of RT errors per RtStatus. Errors lost by the error queue
+   * are counted here all the same.
+   */
+  std::atomic<uint64_t> errors[kStatusCount];
+  std::atomic<uint64_t> cycle_histogram[kCycleBuckets];
+
+  // Written by the main thread.
+  std::atomic<uint32_t> main_sequence;
+  std::atomic<uint32_t> reloads;
+  std::atomic<uint32_t> last_reload_microseconds;
+  /**
+   * Path of the loaded file, NUL terminated and truncated to fit,
+   * packed into words so that it can be copied atomically.
+   */
+  std::atomic<uint64_t> input_file[kInputFileWords];
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "stats segments need lock-free atomics");
+
+/**
+ * Returns the histogram bucket of a cycle of `microseconds`.
+ * Durations below 4 us have a bucket each, longer ones are split into
+ * 4 buckets per octave.
+ */
+size_t CycleBucket(uint32_t microseconds) noexcept;
+/**
+ * Returns the longest duration counted in `bucket`.
+ */
+uint32_t CycleBucketLimit(size_t bucket) noexcept;
+
+/**
+ * Consistent copy of a stats segment.
+ */
+struct StatsSnapshot {
+  int pid;
+  std::string client_name;
+  jack_transport_state_t transport_state;
+  jack_nframes_t frame;
+  jack_nframes_t frame_rate;
+  jack_nframes_t nframes;
+  uint32_t max_cycle_microseconds;
+  uint64_t cycles;
+  uint64_t events_written;
+  uint64_t bytes_written;
+  std::array<uint64_t, StatsBlock::kStatusCount> errors;
+  std::array<uint64_t, StatsBlock::kCycleBuckets> cycle_histogram;
+  uint32_t reloads;
+  uint32_t last_reload_microseconds;
+  std::string input_file;
+
+  /**
+   * Returns an upper bound of the cycle duration below which
+   * `fraction` of the cycles stayed, 0 if no cycle was counted.
+   */
+  uint32_t CyclePercentile(double fraction) const noexcept;
+};
+
+/**
+ * Publishes the state of a player in a named POSIX shared memory
+ * segment, "/midiaud.<pid>", for monitoring tools like midiaud-top.
+ * The segment is removed again on destruction.
+ *
+ * There is a single writer per group of fields: the RT thread for
+ * the cycle statistics and the main thread for the loaded file.
+ */
+class StatsPage {
+ public:
+  static constexpr const char *kNamePrefix = "/midiaud.";
+
+  /**
+   * Creates the segment of this process.
+   *
+   * @throws std::runtime_error if the segment cannot be created.
+   */
+  explicit StatsPage(const std::string &client_name);
+  StatsPage(const StatsPage &) = delete;
+  ~StatsPage();
+  StatsPage &operator=(const StatsPage &) = delete;
+
+  /**
+   * Counts an RT error. For RT thread.
+   */
+  void CountError(RtStatus status) noexcept;
+  /**
+   * Publishes the transport state and the output of a cycle that
+   * took `microseconds`. For RT thread.
+   */
+  void PublishCycle(jack_transport_state_t state, jack_nframes_t frame,
+                    jack_nframes_t frame_rate, jack_nframes_t nframes,
+                    size_t events_written, size_t bytes_written,
+                    uint32_t microseconds) noexcept;
+  /**
+   * Publishes the loaded file. For main thread.
+   */
+  void PublishFile(const std::string &input_file, uint32_t reloads,
+                   double last_reload_seconds) noexcept;
+
+  const std::string &name() const { return name_; }
+
+ private:
+  std::string name_;
+  StatsBlock *block_;
+};
+
+/**
+ * Reads the stats segment called `name`.
+ *
+ * @returns false if the segment does not exist, is not initialized,
+ *          has another version or its writer kept it busy.
+ */
+bool ReadStatsPage(const std::string &name, StatsSnapshot *snapshot);
+
+}
+
+#endif // STATS_PAGE_H_
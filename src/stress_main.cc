@@ -0,0 +1,121 @@
+
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "control_benchmark.h"
+#include "lockfree_stress.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options]\n";
+}
+
+void print_latency(const std::string &name,
+                   const midiaud::LatencySummary &latency) {
+  std::cout << std::left << std::setw(24) << name << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << latency.samples
+            << std::setw(10) << latency.p50_seconds * 1e9
+            << std::setw(10) << latency.p99_seconds * 1e9
+            << std::setw(10) << latency.p999_seconds * 1e9
+            << std::setw(12) << latency.max_seconds * 1e9 << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description options_desc{"Allowed options"};
+  options_desc.add_options()
+      ("help", "produce help message")
+      ("seconds,s", po::value<double>()->default_value(2),
+       "run every stress test this long")
+      ("latency-samples", po::value<size_t>()->default_value(100000),
+       "number of latencies to measure per benchmark")
+      ("model-emplaces", po::value<int>()->default_value(5),
+       "Emplace() calls in every interleaving of the model check")
+      ("model-fetches", po::value<int>()->default_value(3),
+       "Fetch() calls in every interleaving of the model check")
+      ("control-pings", po::value<size_t>()->default_value(10000),
+       "number of control socket round trips to measure")
+      ;
+
+  po::variables_map vm;
+  double seconds;
+  size_t latency_samples;
+  int model_emplaces;
+  int model_fetches;
+  size_t control_pings;
+  try {
+    po::store(po::parse_command_line(argc, argv, options_desc), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+    seconds = vm["seconds"].as<double>();
+    latency_samples = vm["latency-samples"].as<size_t>();
+    model_emplaces = vm["model-emplaces"].as<int>();
+    model_fetches = vm["model-fetches"].as<int>();
+    control_pings = vm["control-pings"].as<size_t>();
+    if (seconds <= 0 || latency_samples == 0 || control_pings == 0
+        || model_emplaces < 0 || model_fetches < 0)
+      throw std::invalid_argument("durations and samples must be positive "
+                                  "and call counts not negative");
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << options_desc << "\n";
+    return -1;
+  }
+
+  midiaud::QueueStressResult queue_result =
+      midiaud::StressCommandQueue(seconds, latency_samples);
+  std::cout << "Command queue: " << queue_result.commands
+            << " commands, " << queue_result.full_pushes
+            << " full pushes, " << queue_result.errors << " errors\n";
+  midiaud::ResourceStressResult resource_result =
+      midiaud::StressResource(seconds);
+  std::cout << "Resource: " << resource_result.emplaced << " emplaced, "
+            << resource_result.fetches << " fetches, "
+            << resource_result.failed_emplaces << " failed emplaces, "
+            << resource_result.errors << " errors\n";
+  size_t violations = 0;
+  for (size_t slots : {3, 4, 8}) {
+    midiaud::ModelCheckResult model_result = midiaud::ModelCheckResource(
+        slots, model_emplaces, model_fetches);
+    std::cout << "Resource model with " << slots << " slots: "
+              << model_result.interleavings << " interleavings, "
+              << model_result.violations << " violations\n";
+    violations += model_result.violations;
+  }
+  std::cout << "\n";
+
+  std::cout << std::left << std::setw(24) << "LATENCY" << std::right
+            << std::setw(10) << "SAMPLES" << std::setw(10) << "NS/P50"
+            << std::setw(10) << "NS/P99" << std::setw(10) << "NS/P99.9"
+            << std::setw(12) << "NS/MAX" << "\n";
+  print_latency("command push-pop", queue_result.latency);
+  for (const midiaud::FetchBenchmarkResult &result
+           : midiaud::BenchmarkFetch(latency_samples)) {
+    std::ostringstream name;
+    name << "fetch " << result.layout << " " << result.slots
+         << (result.contended ? " writing" : " idle");
+    print_latency(name.str(), result.latency);
+  }
+  try {
+    print_latency("control socket ping",
+                  midiaud::BenchmarkControlSocket(control_pings));
+  } catch (std::exception &e) {
+    std::cerr << "Control socket: " << e.what() << "\n";
+    return 1;
+  }
+  bool failed = queue_result.errors != 0 || resource_result.errors != 0
+      || violations != 0;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <unistd.h>
+
+#include "sync_benchmark.h"
+
+namespace po = boost::program_options;
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options] [input-file]\n";
+}
+
+/**
+ * Parses a comma separated list of instance counts.
+ */
+std::vector<int> parse_instance_counts(const std::string &list) {
+  std::vector<int> instance_counts;
+  std::istringstream list_stream(list);
+  std::string instances;
+  while (std::getline(list_stream, instances, ',')) {
+    int value = std::stoi(instances);
+    if (value <= 0)
+      throw std::invalid_argument("instance counts must be positive");
+    instance_counts.push_back(value);
+  }
+  if (instance_counts.empty())
+    throw std::invalid_argument("no instance counts given");
+  return instance_counts;
+}
+
+/**
+ * The midiaud built next to this program, or the one in the path.
+ */
+std::string default_midiaud(const char *argv0) {
+  std::string path(argv0);
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos) return "midiaud";
+  return path.substr(0, slash + 1) + "midiaud";
+}
+
+void print_result(const midiaud::SyncBenchmarkResult &result) {
+  const midiaud::SyncErrors &errors = result.errors;
+  double mean_error = errors.matched > 0
+      ? static_cast<double>(errors.error_sum_frames) / errors.matched : 0;
+  std::cout << std::setw(9) << result.instances
+            << std::setw(10) << errors.matched
+            << std::setw(9) << errors.missing
+            << std::setw(7) << errors.extra
+            << std::setw(11) << errors.max_error_frames
+            << std::fixed << std::setprecision(2)
+            << std::setw(12) << mean_error
+            << std::setprecision(1)
+            << std::setw(8) << result.mean_dsp_load
+            << std::setw(8) << result.max_dsp_load
+            << std::setw(8) << result.mean_cpu_percent
+            << std::setw(8) << result.max_cpu_percent << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("instances", po::value<std::string>()->default_value(
+           "1,2,4,8,16,32,64"),
+       "comma separated list of instance counts to play the file with")
+      ("jackd", po::value<std::string>()->default_value("jackd"),
+       "Jack server to start with the dummy driver")
+      ("midiaud", po::value<std::string>(),
+       "midiaud to play the file with, by default the one next to this "
+       "program")
+      ("midiaud-option", po::value<std::vector<std::string>>(),
+       "pass an option to every instance, can be repeated")
+      ("server-name", po::value<std::string>()->default_value(
+           "midiaud-sync-bench"),
+       "name of the started Jack server")
+      ("sample-rate", po::value<jack_nframes_t>()->default_value(48000),
+       "sample rate of the started Jack server")
+      ("buffer-size", po::value<jack_nframes_t>()->default_value(256),
+       "buffer size of the started Jack server")
+      ("seconds", po::value<double>()->default_value(30),
+       "length of the generated file played without an input file")
+      ;
+
+  po::options_description hidden_options_desc;
+  hidden_options_desc.add_options()
+      ("input-file", po::value<std::string>(), "input file")
+      ;
+
+  po::options_description options_desc;
+  options_desc.add(generic_options_desc).add(hidden_options_desc);
+
+  po::positional_options_description positional_options_desc;
+  positional_options_desc.add("input-file", 1);
+
+  po::variables_map vm;
+  midiaud::SyncBenchmarkSettings settings;
+  double seconds;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(options_desc)
+              .positional(positional_options_desc)
+              .run(), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+    settings.jackd = vm["jackd"].as<std::string>();
+    settings.midiaud = vm.count("midiaud") > 0
+        ? vm["midiaud"].as<std::string>() : default_midiaud(argv[0]);
+    if (vm.count("midiaud-option") > 0)
+      settings.midiaud_options =
+          vm["midiaud-option"].as<std::vector<std::string>>();
+    settings.server_name = vm["server-name"].as<std::string>();
+    settings.sample_rate = vm["sample-rate"].as<jack_nframes_t>();
+    settings.buffer_size = vm["buffer-size"].as<jack_nframes_t>();
+    settings.instance_counts =
+        parse_instance_counts(vm["instances"].as<std::string>());
+    seconds = vm["seconds"].as<double>();
+    if (settings.sample_rate == 0 || settings.buffer_size == 0
+        || seconds <= 0)
+      throw std::invalid_argument("sample rate, buffer size and seconds "
+                                  "must be positive");
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  std::string input_file;
+  bool generated = vm.count("input-file") == 0;
+  std::vector<midiaud::SyncBenchmarkResult> results;
+  try {
+    if (generated) {
+      char filename[] = "/tmp/midiaud-sync-bench-XXXXXX.mid";
+      int fd = mkstemps(filename, 4);
+      if (fd < 0)
+        throw std::runtime_error("cannot create a temporary file");
+      close(fd);
+      input_file = filename;
+      midiaud::WriteSyncTestFile(input_file, seconds);
+    } else {
+      input_file = vm["input-file"].as<std::string>();
+    }
+    results = midiaud::RunSyncBenchmark(input_file, settings);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    if (generated && !input_file.empty()) std::remove(input_file.c_str());
+    return 1;
+  }
+  if (generated) std::remove(input_file.c_str());
+
+  std::cout << std::setw(9) << "INSTANCES" << std::setw(10) << "MATCHED"
+            << std::setw(9) << "MISSING" << std::setw(7) << "EXTRA"
+            << std::setw(11) << "MAXERR/FR" << std::setw(12) << "MEANERR/FR"
+            << std::setw(8) << "DSP%" << std::setw(8) << "MAXDSP%"
+            << std::setw(8) << "CPU%" << std::setw(8) << "MAXCPU%" << "\n";
+  int status = 0;
+  for (const midiaud::SyncBenchmarkResult &result : results) {
+    print_result(result);
+    const midiaud::SyncErrors &errors = result.errors;
+    if (errors.missing != 0 || errors.extra != 0
+        || errors.max_error_frames != 0)
+      status = 1;
+  }
+  return status;
+}
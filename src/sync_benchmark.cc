@@ -0,0 +1,518 @@
+
+#include "sync_benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <jack/midiport.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "smf_reader-inl.h"
+#include "timebase/tempo_map.h"
+
+extern char **environ;
+
+namespace midiaud {
+
+namespace {
+
+constexpr int kPpqn = 960;
+constexpr int kBarTicks = 4 * kPpqn;
+/**
+ * Odd tempos, so that beats seldom fall on whole frames.
+ */
+constexpr double kTempos[] = {120, 97.3, 133.7, 71.9, 151.1, 88.8};
+
+void AppendVariableLength(uint32_t value, std::string &bytes) {
+  char groups[5];
+  int count = 0;
+  do {
+    groups[count++] = static_cast<char>(value & 0x7f);
+    value >>= 7;
+  } while (value != 0);
+  while (count > 1) bytes += static_cast<char>(groups[--count] | 0x80);
+  bytes += groups[0];
+}
+
+void AppendBigEndian(uint32_t value, int size, std::string &bytes) {
+  for (int i = size - 1; i >= 0; --i)
+    bytes += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+struct TestEvent {
+  uint32_t ticks;
+  std::string bytes;
+};
+
+/**
+ * A process started from the arguments, stopped with `stop_signal`
+ * and waited for on destruction.
+ */
+class ChildProcess {
+ public:
+  ChildProcess(const std::vector<std::string> &arguments,
+               const std::vector<std::string> &environment,
+               int stop_signal)
+      : pid_(-1), stop_signal_(stop_signal) {
+    std::vector<char *> argv;
+    for (const std::string &argument : arguments)
+      argv.push_back(const_cast<char *>(argument.c_str()));
+    argv.push_back(nullptr);
+    std::vector<std::string> environment_strings(environment);
+    for (char **variable = environ; *variable != nullptr; ++variable)
+      environment_strings.push_back(*variable);
+    std::vector<char *> envp;
+    for (const std::string &variable : environment_strings)
+      envp.push_back(const_cast<char *>(variable.c_str()));
+    envp.push_back(nullptr);
+    // Dozens of instances would bury the results in their logs, their
+    // failures show in the exit status and the captured messages.
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_addopen(&file_actions, STDOUT_FILENO,
+                                     "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&file_actions, STDOUT_FILENO,
+                                     STDERR_FILENO);
+    int error = posix_spawnp(&pid_, argv[0], &file_actions, nullptr,
+                             argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&file_actions);
+    if (error != 0)
+      throw std::runtime_error("cannot start " + arguments[0] + ": "
+                               + std::strerror(error));
+  }
+  ChildProcess(const ChildProcess &) = delete;
+  ~ChildProcess() {
+    Stop();
+  }
+
+  ChildProcess &operator=(const ChildProcess &) = delete;
+
+  bool running() {
+    if (pid_ < 0) return false;
+    int status;
+    if (waitpid(pid_, &status, WNOHANG) == 0) return true;
+    pid_ = -1;
+    return false;
+  }
+
+  /**
+   * User and system CPU time used so far.
+   */
+  double cpu_seconds() const {
+    std::ifstream stat("/proc/" + std::to_string(pid_) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) return 0;
+    // The command name may contain spaces, the fields after it not.
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long long user_ticks = 0;
+    unsigned long long system_ticks = 0;
+    for (int i = 0; i < 11; ++i) fields >> field;
+    fields >> user_ticks >> system_ticks;
+    return static_cast<double>(user_ticks + system_ticks)
+        / sysconf(_SC_CLK_TCK);
+  }
+
+  void Stop() {
+    if (pid_ < 0) return;
+    kill(pid_, stop_signal_);
+    int status;
+    while (waitpid(pid_, &status, 0) < 0 && errno == EINTR) {}
+    pid_ = -1;
+  }
+
+ private:
+  pid_t pid_;
+  int stop_signal_;
+};
+
+/**
+ * Jack client with an input port for every instance. The messages
+ * arriving while the transport rolls are stored with their transport
+ * frame into buffers allocated up front.
+ */
+class CaptureClient {
+ public:
+  static constexpr size_t kMaxMessageSize = 8;
+
+  CaptureClient(const std::string &server_name, int ports,
+                size_t capacity)
+      : client_(nullptr), captures_(ports), counts_(ports),
+        active_ports_(0), dropped_(0) {
+    auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::seconds(10);
+    while (client_ == nullptr) {
+      jack_status_t status;
+      client_ = jack_client_open(
+          "midiaud-sync-bench",
+          static_cast<jack_options_t>(JackNoStartServer | JackServerName),
+          &status, server_name.c_str());
+      if (client_ != nullptr) break;
+      if (std::chrono::steady_clock::now() > deadline)
+        throw std::runtime_error("cannot connect to jackd");
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (int i = 0; i < ports; ++i) {
+      std::string name = "in_" + std::to_string(i + 1);
+      jack_port_t *port = jack_port_register(client_, name.c_str(),
+                                             JACK_DEFAULT_MIDI_TYPE,
+                                             JackPortIsInput, 0);
+      if (port == nullptr) {
+        jack_client_close(client_);
+        throw std::runtime_error("cannot register capture port");
+      }
+      ports_.push_back(port);
+      captures_[i].resize(capacity);
+    }
+    jack_set_process_callback(client_, &CaptureClient::ProcessCallback,
+                              this);
+    if (jack_activate(client_) != 0) {
+      jack_client_close(client_);
+      throw std::runtime_error("cannot activate capture client");
+    }
+  }
+  CaptureClient(const CaptureClient &) = delete;
+  ~CaptureClient() {
+    jack_deactivate(client_);
+    jack_client_close(client_);
+  }
+
+  CaptureClient &operator=(const CaptureClient &) = delete;
+
+  jack_client_t *client() const { return client_; }
+  std::string port_name(int port) const {
+    return jack_port_name(ports_[port]);
+  }
+  bool connected(int port) const {
+    return jack_port_connected(ports_[port]) > 0;
+  }
+  size_t dropped() const { return dropped_.load(); }
+
+  /**
+   * Starts capturing on the first `ports` ports, discarding what was
+   * captured before. The transport must be stopped.
+   */
+  void Reset(int ports) {
+    for (std::atomic<size_t> &count : counts_) count.store(0);
+    active_ports_.store(ports, std::memory_order_release);
+  }
+
+  std::vector<TimedMessage> Captured(int port) const {
+    std::vector<TimedMessage> messages;
+    size_t count = counts_[port].load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+      const CapturedMessage &message = captures_[port][i];
+      messages.push_back({message.frame,
+                          MidiBuffer(message.data,
+                                     message.data + message.size)});
+    }
+    return messages;
+  }
+
+ private:
+  struct CapturedMessage {
+    jack_nframes_t frame;
+    uint8_t size;
+    uint8_t data[kMaxMessageSize];
+  };
+
+  static int ProcessCallback(jack_nframes_t nframes, void *arg) {
+    static_cast<CaptureClient *>(arg)->Process(nframes);
+    return 0;
+  }
+
+  void Process(jack_nframes_t nframes) noexcept {
+    jack_position_t position;
+    bool rolling = jack_transport_query(client_, &position)
+        == JackTransportRolling;
+    int active_ports = active_ports_.load(std::memory_order_acquire);
+    for (int i = 0; i < active_ports; ++i) {
+      void *buffer = jack_port_get_buffer(ports_[i], nframes);
+      if (!rolling || buffer == nullptr) continue;
+      std::vector<CapturedMessage> &capture = captures_[i];
+      size_t count = counts_[i].load(std::memory_order_relaxed);
+      uint32_t event_count = jack_midi_get_event_count(buffer);
+      for (uint32_t j = 0; j < event_count; ++j) {
+        jack_midi_event_t event;
+        if (jack_midi_event_get(&event, buffer, j) != 0) continue;
+        if (count == capture.size() || event.size > kMaxMessageSize) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        CapturedMessage &message = capture[count++];
+        message.frame = position.frame + event.time;
+        message.size = static_cast<uint8_t>(event.size);
+        std::copy(event.buffer, event.buffer + event.size, message.data);
+      }
+      counts_[i].store(count, std::memory_order_release);
+    }
+  }
+
+  jack_client_t *client_;
+  std::vector<jack_port_t *> ports_;
+  std::vector<std::vector<CapturedMessage>> captures_;
+  std::vector<std::atomic<size_t>> counts_;
+  std::atomic<int> active_ports_;
+  std::atomic<size_t> dropped_;
+};
+
+template <typename Predicate>
+void WaitFor(Predicate predicate, double seconds, const char *what) {
+  auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(seconds));
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      throw std::runtime_error(std::string("timed out waiting for ") + what);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+SyncBenchmarkResult RunInstances(const std::string &input_file,
+                                 const SyncBenchmarkSettings &settings,
+                                 int instances,
+                                 const std::vector<TimedMessage> &due,
+                                 CaptureClient &capture) {
+  SyncBenchmarkResult result{instances, {0, 0, 0, 0, 0}, 0, 0, 0, 0};
+  capture.Reset(instances);
+  std::vector<std::unique_ptr<ChildProcess>> players;
+  for (int i = 0; i < instances; ++i) {
+    std::vector<std::string> arguments{
+      settings.midiaud, "--client", "sync-" + std::to_string(i + 1),
+      "--destination-port", capture.port_name(i), "--no-stats"};
+    arguments.insert(arguments.end(), settings.midiaud_options.begin(),
+                     settings.midiaud_options.end());
+    arguments.push_back(input_file);
+    players.emplace_back(new ChildProcess(
+        arguments, {"JACK_DEFAULT_SERVER=" + settings.server_name},
+        SIGINT));
+  }
+  WaitFor([&]() {
+    for (int i = 0; i < instances; ++i) {
+      if (!players[i]->running())
+        throw std::runtime_error("a midiaud instance exited");
+      if (!capture.connected(i)) return false;
+    }
+    return true;
+  }, 30, "the instances to connect");
+  // The ports are connected before the file is parsed, and an
+  // instance only holds the transport for a reposition it was asked
+  // for.
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  jack_client_t *client = capture.client();
+  jack_transport_locate(client, 0);
+  jack_transport_start(client);
+  WaitFor([&]() {
+    return jack_transport_query(client, nullptr) == JackTransportRolling;
+  }, 30, "the transport to roll");
+  auto start = std::chrono::steady_clock::now();
+  std::vector<double> start_cpu_seconds;
+  for (const auto &player : players)
+    start_cpu_seconds.push_back(player->cpu_seconds());
+
+  long long end_frame = (due.empty() ? 0 : due.back().frame)
+      + settings.sample_rate / 2;
+  size_t load_samples = 0;
+  double load_sum = 0;
+  for (;;) {
+    jack_position_t position;
+    if (jack_transport_query(client, &position) != JackTransportRolling)
+      throw std::runtime_error("the transport stopped while playing");
+    if (position.frame > end_frame) break;
+    double load = jack_cpu_load(client);
+    load_sum += load;
+    ++load_samples;
+    result.max_dsp_load = std::max(result.max_dsp_load, load);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start;
+  double cpu_percent_sum = 0;
+  for (size_t i = 0; i < players.size(); ++i) {
+    double cpu_percent = (players[i]->cpu_seconds() - start_cpu_seconds[i])
+        / duration.count() * 100;
+    cpu_percent_sum += cpu_percent;
+    result.max_cpu_percent = std::max(result.max_cpu_percent, cpu_percent);
+  }
+  jack_transport_stop(client);
+  WaitFor([&]() {
+    return jack_transport_query(client, nullptr) == JackTransportStopped;
+  }, 10, "the transport to stop");
+  players.clear();
+
+  result.mean_dsp_load = load_samples > 0 ? load_sum / load_samples : 0;
+  result.mean_cpu_percent = cpu_percent_sum / instances;
+  for (int i = 0; i < instances; ++i) {
+    SyncErrors errors = CompareMessages(due, capture.Captured(i));
+    result.errors.matched += errors.matched;
+    result.errors.missing += errors.missing;
+    result.errors.extra += errors.extra;
+    result.errors.max_error_frames = std::max(result.errors.max_error_frames,
+                                              errors.max_error_frames);
+    result.errors.error_sum_frames += errors.error_sum_frames;
+  }
+  return result;
+}
+
+}
+
+void WriteSyncTestFile(const std::string &filename, double seconds) {
+  std::vector<TestEvent> events;
+  std::string time_signature("\xff\x58\x04\x04\x02\x18\x08", 7);
+  events.push_back({0, time_signature});
+  double elapsed = 0;
+  uint32_t ticks = 0;
+  for (int bar = 0; elapsed < seconds; ++bar) {
+    // A new tempo every other bar, the first bar is left silent.
+    if (bar % 2 == 0) {
+      double tempo = kTempos[(bar / 2) % (sizeof(kTempos)
+                                          / sizeof(kTempos[0]))];
+      uint32_t quarter_microseconds =
+          static_cast<uint32_t>(std::lround(60e6 / tempo));
+      std::string set_tempo("\xff\x51\x03", 3);
+      AppendBigEndian(quarter_microseconds, 3, set_tempo);
+      events.push_back({ticks, set_tempo});
+    }
+    if (bar > 0) {
+      // Sixteenth note triplets on a pattern of keys and channels, and
+      // a controller every eighth note.
+      for (uint32_t offset = 0; offset < kBarTicks; offset += kPpqn / 6) {
+        uint32_t step = (ticks + offset) / (kPpqn / 6);
+        uint8_t channel = step % 4;
+        uint8_t key = static_cast<uint8_t>(48 + (step * 7) % 36);
+        events.push_back({ticks + offset,
+                          {static_cast<char>(0x90 | channel),
+                           static_cast<char>(key), 100}});
+        events.push_back({ticks + offset + kPpqn / 6 - 10,
+                          {static_cast<char>(0x80 | channel),
+                           static_cast<char>(key), 0}});
+        if (offset % (kPpqn / 2) == 0) {
+          events.push_back({ticks + offset,
+                            {static_cast<char>(0xb0 | channel), 1,
+                             static_cast<char>(step % 128)}});
+        }
+      }
+    }
+    elapsed += 4 * 60 / kTempos[(bar / 2) % (sizeof(kTempos)
+                                             / sizeof(kTempos[0]))];
+    ticks += kBarTicks;
+  }
+  events.push_back({ticks, std::string("\xff\x2f\x00", 3)});
+  std::stable_sort(events.begin(), events.end(),
+                   [](const TestEvent &lhs, const TestEvent &rhs) {
+                     return lhs.ticks < rhs.ticks;
+                   });
+
+  std::string track;
+  uint32_t previous_ticks = 0;
+  for (const TestEvent &event : events) {
+    AppendVariableLength(event.ticks - previous_ticks, track);
+    track += event.bytes;
+    previous_ticks = event.ticks;
+  }
+  std::string file("MThd", 4);
+  AppendBigEndian(6, 4, file);
+  AppendBigEndian(0, 2, file);
+  AppendBigEndian(1, 2, file);
+  AppendBigEndian(kPpqn, 2, file);
+  file.append("MTrk", 4);
+  AppendBigEndian(static_cast<uint32_t>(track.size()), 4, file);
+  file += track;
+
+  std::ofstream output(filename, std::ios::binary);
+  output.write(file.data(), file.size());
+  if (!output)
+    throw std::runtime_error("cannot write " + filename);
+}
+
+std::vector<TimedMessage> ComputeDueMessages(const std::string &filename,
+                                             jack_nframes_t sample_rate) {
+  timebase::TimeDivision division;
+  std::vector<Event> events;
+  ReadStandardMidiFile(filename, std::back_inserter(events), division);
+  timebase::TempoMap tempo_map(division);
+  for (const Event &event : events) {
+    if (timebase::TempoMap::IsTempoEvent(event))
+      tempo_map.AcknowledgeEvent(event);
+  }
+  std::vector<TimedMessage> due;
+  for (const Event &event : events) {
+    if (event.is_metadata()) continue;
+    double seconds = tempo_map.GetTicks(event.ticks()).seconds();
+    due.push_back({std::llround(seconds * sample_rate), event.midi()});
+  }
+  return due;
+}
+
+SyncErrors CompareMessages(const std::vector<TimedMessage> &due,
+                           const std::vector<TimedMessage> &captured) {
+  SyncErrors errors{0, 0, 0, 0, 0};
+  auto due_message = due.cbegin();
+  auto captured_message = captured.cbegin();
+  while (due_message != due.cend() && captured_message != captured.cend()) {
+    if (due_message->midi == captured_message->midi) {
+      long long error = captured_message->frame - due_message->frame;
+      errors.max_error_frames = std::max(errors.max_error_frames,
+                                         std::llabs(error));
+      errors.error_sum_frames += error;
+      ++errors.matched;
+      ++due_message;
+      ++captured_message;
+    } else if (captured_message->frame < due_message->frame) {
+      ++errors.extra;
+      ++captured_message;
+    } else {
+      ++errors.missing;
+      ++due_message;
+    }
+  }
+  errors.missing += due.cend() - due_message;
+  errors.extra += captured.cend() - captured_message;
+  return errors;
+}
+
+std::vector<SyncBenchmarkResult> RunSyncBenchmark(
+    const std::string &input_file, const SyncBenchmarkSettings &settings) {
+  std::vector<TimedMessage> due = ComputeDueMessages(input_file,
+                                                     settings.sample_rate);
+  int max_instances = *std::max_element(settings.instance_counts.begin(),
+                                        settings.instance_counts.end());
+
+  ChildProcess server({settings.jackd, "--name", settings.server_name,
+                       "-d", "dummy",
+                       "-r", std::to_string(settings.sample_rate),
+                       "-p", std::to_string(settings.buffer_size)},
+                      {}, SIGTERM);
+  CaptureClient capture(settings.server_name, max_instances,
+                        due.size() + 1024);
+  if (jack_get_sample_rate(capture.client()) != settings.sample_rate)
+    throw std::runtime_error("jackd runs at another sample rate");
+
+  std::vector<SyncBenchmarkResult> results;
+  for (int instances : settings.instance_counts) {
+    if (!server.running())
+      throw std::runtime_error("jackd exited");
+    results.push_back(RunInstances(input_file, settings, instances, due,
+                                   capture));
+  }
+  return results;
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef SYNC_BENCHMARK_H_
+#define SYNC_BENCHMARK_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+
+#include "event.h"
+
+namespace midiaud {
+
+/**
+ * Servers, players and instance counts to check the sync with.
+ */
+struct SyncBenchmarkSettings {
+  std::string jackd;
+  std::string midiaud;
+  /**
+   * Extra options for every midiaud instance, e.g. "--prerender".
+   */
+  std::vector<std::string> midiaud_options;
+  /**
+   * Name of the Jack server to start, so that a running server is not
+   * disturbed.
+   */
+  std::string server_name;
+  jack_nframes_t sample_rate;
+  jack_nframes_t buffer_size;
+  std::vector<int> instance_counts;
+};
+
+/**
+ * A MIDI message at a transport frame.
+ */
+struct TimedMessage {
+  long long frame;
+  MidiBuffer midi;
+};
+
+/**
+ * How far the captured messages of an instance are from where they
+ * are due.
+ */
+struct SyncErrors {
+  size_t matched;
+  /**
+   * Due messages that were not captured, or captured with other
+   * bytes.
+   */
+  size_t missing;
+  /**
+   * Captured messages that were not due.
+   */
+  size_t extra;
+  /**
+   * Largest distance of a matched message from its frame.
+   */
+  long long max_error_frames;
+  /**
+   * Sum of the signed distances of the matched messages, positive
+   * when they came late.
+   */
+  long long error_sum_frames;
+};
+
+/**
+ * Outcome of playing the file with one number of instances at once.
+ */
+struct SyncBenchmarkResult {
+  int instances;
+  /**
+   * Of all instances together.
+   */
+  SyncErrors errors;
+  /**
+   * DSP load reported by the server while the transport was rolling,
+   * in percent.
+   */
+  double mean_dsp_load;
+  double max_dsp_load;
+  /**
+   * CPU time of an instance per second of playback, in percent of a
+   * core, averaged over the instances, and of the busiest one.
+   */
+  double mean_cpu_percent;
+  double max_cpu_percent;
+};
+
+/**
+ * Writes a format 0 file of about `seconds` of dense notes and
+ * controllers over frequent tempo changes at odd tempos, so that drift
+ * in the conversion from seconds to frames shows up.
+ */
+void WriteSyncTestFile(const std::string &filename, double seconds);
+
+/**
+ * Returns the messages of `filename` that are sent to the port, at the
+ * frames the tempo map puts them on at `sample_rate`.
+ *
+ * @throws std::runtime_error if the file cannot be read.
+ */
+std::vector<TimedMessage> ComputeDueMessages(const std::string &filename,
+                                             jack_nframes_t sample_rate);
+
+/**
+ * Matches `captured` against `due`, both in the order they were sent.
+ * Messages with the same bytes are paired in order, others are counted
+ * as missing or extra.
+ */
+SyncErrors CompareMessages(const std::vector<TimedMessage> &due,
+                           const std::vector<TimedMessage> &captured);
+
+/**
+ * Starts `jackd -d dummy`, then for every instance count plays
+ * `input_file` with that many midiaud instances from the start of the
+ * transport to the end of the file. The output of every instance is
+ * captured by a client of this process and compared with the frames
+ * the tempo map puts the messages on, while the DSP load and the CPU
+ * time of the instances are sampled.
+ *
+ * @throws std::runtime_error if the server or the instances cannot be
+ *         started.
+ */
+std::vector<SyncBenchmarkResult> RunSyncBenchmark(
+    const std::string &input_file, const SyncBenchmarkSettings &settings);
+
+}
+
+#endif // SYNC_BENCHMARK_H_
@@ -0,0 +1,64 @@
+
+#include "timebase/bbt_follower.h"
+
+#include <algorithm>
+
+namespace midiaud {
+namespace timebase {
+
+BBTFollower::BBTFollower()
+    : cursor_(0) {
+}
+
+bool BBTFollower::Follow(const jack_position_t &pos,
+                         jack_nframes_t window_frames,
+                         const TempoMap &tempo_map,
+                         TimeScale *time_scale) noexcept {
+  if ((pos.valid & JackPositionBBT) == 0 || pos.frame_rate == 0
+      || pos.ticks_per_beat <= 0 || pos.beats_per_minute <= 0
+      || window_frames == 0)
+    return false;
+
+  BBT bbt{pos.bar, pos.beat, 0};
+  SeekBBT(tempo_map, bbt);
+  Position start(*(tempo_map.begin() + cursor_));
+  // Ticks of the master are fractions of its beat, just like ours.
+  bbt.tick = pos.tick / pos.ticks_per_beat * start.ticks_per_beat();
+  start.SetToBBT(bbt);
+
+  // The BBT fields may refer to a frame before the cycle.
+  double bbt_frame = pos.frame;
+  if ((pos.valid & JackBBTFrameOffset) != 0) bbt_frame -= pos.bbt_offset;
+  double window_seconds =
+      (pos.frame + window_frames - bbt_frame) / pos.frame_rate;
+  double beats = window_seconds * pos.beats_per_minute / 60;
+  double end_ticks = start.ticks() + beats * start.ticks_per_beat();
+  Position end(*(tempo_map.begin()
+                 + FindTicksFrom(tempo_map, cursor_, end_ticks)));
+  end.SetToTicks(std::max(end_ticks, start.ticks()));
+
+  double scale = (end.seconds() - start.seconds()) / window_seconds;
+  time_scale->Anchor(bbt_frame / pos.frame_rate, start.seconds(), scale);
+  return true;
+}
+
+void BBTFollower::SeekBBT(const TempoMap &tempo_map,
+                          const BBT &bbt) noexcept {
+  auto positions = tempo_map.begin();
+  size_t size = tempo_map.size();
+  cursor_ = std::min(cursor_, size - 1);
+  while (cursor_ > 0 && bbt < positions[cursor_].bbt()) --cursor_;
+  while (cursor_ + 1 < size && !(bbt < positions[cursor_ + 1].bbt()))
+    ++cursor_;
+}
+
+size_t BBTFollower::FindTicksFrom(const TempoMap &tempo_map, size_t index,
+                                  double ticks) const noexcept {
+  auto positions = tempo_map.begin();
+  while (index + 1 < tempo_map.size() && positions[index + 1].ticks() <= ticks)
+    ++index;
+  return index;
+}
+
+} // timebase
+} // midiaud
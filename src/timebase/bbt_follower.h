@@ -0,0 +1,67 @@
+#ifndef TIMEBASE_BBT_FOLLOWER_H_
+#define TIMEBASE_BBT_FOLLOWER_H_
+
+#include <cstddef>
+
+#include <jack/jack.h>
+
+#include "timebase/position.h"
+#include "timebase/tempo_map.h"
+#include "timebase/time_scale.h"
+
+namespace midiaud {
+namespace timebase {
+
+/**
+ * Plays the file in the bars and beats published by another timebase
+ * master instead of by its own tempo.
+ *
+ * Every cycle, the bar, beat and tick of the master are looked up in
+ * the bars and beats of the file, and the window of the cycle is
+ * advanced by as many beats of the file as the master plays at its
+ * tempo. The result is expressed as a time scale from transport time
+ * to file time, valid for that cycle only.
+ *
+ * The positions of the tempo map are found by walking from those of
+ * the previous cycle, so the cost of a cycle does not depend on the
+ * length of the file while the transport rolls.
+ */
+class BBTFollower {
+ public:
+  BBTFollower();
+
+  /**
+   * Sets `time_scale` to map the window of `window_frames` frames
+   * starting at the frame of `pos` onto the file. For RT thread.
+   *
+   * @returns false, leaving `time_scale` alone, if `pos` carries no
+   *          BBT information.
+   */
+  bool Follow(const jack_position_t &pos, jack_nframes_t window_frames,
+              const TempoMap &tempo_map, TimeScale *time_scale) noexcept;
+
+ private:
+  /**
+   * Moves `cursor_` to the last position of the tempo map at or before
+   * `bbt`.
+   */
+  void SeekBBT(const TempoMap &tempo_map, const BBT &bbt) noexcept;
+  /**
+   * Returns the index of the last position of the tempo map at or
+   * before `ticks`, searching forwards from `index`.
+   */
+  size_t FindTicksFrom(const TempoMap &tempo_map, size_t index,
+                       double ticks) const noexcept;
+
+  /**
+   * Index of the position of the tempo map the last cycle started in.
+   * It is only a hint: it stays valid across relocations and reloads,
+   * the walk just gets longer.
+   */
+  size_t cursor_;
+};
+
+} // timebase
+} // midiaud
+
+#endif // TIMEBASE_BBT_FOLLOWER_H_
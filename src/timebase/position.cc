@@ -11,7 +11,7 @@ static constexpr double kMicrosecondsPerMinute = 6.e7;
 namespace midiaud {
 namespace timebase {
 
-Position::Position()
+Position::Position() noexcept
     : seconds_(0), ticks_(0),
       bbt_{BBT::kInitialBar, BBT::kInitialBeat, 0},
       beats_per_bar_(4), beat_type_(4),
@@ -24,19 +24,19 @@ Position::Position()
       ppqn_(Position::kDefaultTicksPerBeat) {
 }
 
-Position::Position(ConstructFromSeconds, double seconds)
+Position::Position(ConstructFromSeconds, double seconds) noexcept
     : seconds_(seconds) {
 }
 
-Position::Position(ConstructFromTicks, double ticks)
+Position::Position(ConstructFromTicks, double ticks) noexcept
     : ticks_(ticks) {
 }
 
-Position::Position(const BBT &bbt)
+Position::Position(const BBT &bbt) noexcept
     : bbt_(bbt) {
 }
 
-void Position::StartNewBar() {
+void Position::StartNewBar() noexcept {
   if (bbt_.beat != 1 || bbt_.tick > kEps) {
     bbt_.bar += 1;
     bbt_.beat = 1;
@@ -44,7 +44,7 @@ void Position::StartNewBar() {
   bbt_.tick = 0;
 }
 
-void Position::SetToSeconds(double seconds) {
+void Position::SetToSeconds(double seconds) noexcept {
   if (seconds < seconds_) {
     // We cannot deal with this issue here. Throwing is unacceptable,
     // since we might end up in this branch due to a mere
@@ -55,7 +55,7 @@ void Position::SetToSeconds(double seconds) {
   IncrementBySeconds(seconds - seconds_);
 }
 
-void Position::SetToTicks(double ticks) {
+void Position::SetToTicks(double ticks) noexcept {
   if (ticks < ticks_) {
     // See SetToSeconds for explanation.
     return;
@@ -63,7 +63,7 @@ void Position::SetToTicks(double ticks) {
   IncrementByTicks(ticks - ticks_);
 }
 
-void Position::SetToBBT(const BBT &bbt) {
+void Position::SetToBBT(const BBT &bbt) noexcept {
   double bar_diff = bbt.bar - bbt_.bar;
   double beat_diff = bbt.beat - bbt_.beat + bar_diff * beats_per_bar_;
   double tick_diff = bbt.tick - bbt_.tick + beat_diff * ticks_per_beat_;
@@ -74,14 +74,14 @@ void Position::SetToBBT(const BBT &bbt) {
   IncrementByTicks(tick_diff);
 }
 
-void Position::IncrementBySeconds(double seconds) {
+void Position::IncrementBySeconds(double seconds) noexcept {
   BOOST_ASSERT(seconds >= 0);
 
   double ticks = SecondsToTicks(seconds);
   IncrementByTicks(ticks);
 }
 
-void Position::IncrementByTicks(double ticks) {
+void Position::IncrementByTicks(double ticks) noexcept {
   BOOST_ASSERT(ticks >= 0);
 
   seconds_ += TicksToSeconds(ticks);
@@ -104,18 +104,18 @@ void Position::IncrementByTicks(double ticks) {
       + BBT::kInitialBeat;
 }
 
-void Position::RoundUp() {
+void Position::RoundUp() noexcept {
   double ticks_ceil = std::ceil(bbt_.tick);
   double tick_difference = ticks_ceil - bbt_.tick;
   IncrementByTicks(tick_difference);
 }
 
-double Position::SecondsToTicks(double seconds) const {
+double Position::SecondsToTicks(double seconds) const noexcept {
   double beats = seconds * beats_per_minute_ / 60;
   return beats * ticks_per_beat_;
 }
 
-double Position::TicksToSeconds(double ticks) const {
+double Position::TicksToSeconds(double ticks) const noexcept {
   double beats = ticks / ticks_per_beat_;
   return beats * 60 / beats_per_minute_;
 }
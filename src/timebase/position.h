@@ -35,32 +35,32 @@ class Position {
 
   static constexpr double kDefaultTicksPerBeat = 768;
 
-  Position();
-  Position(ConstructFromSeconds, double seconds);
-  Position(ConstructFromTicks, double ticks);
-  explicit Position(const BBT &bbt);
-
-  void StartNewBar();
-  void SetToSeconds(double seconds);
-  void SetToTicks(double ticks);
-  void SetToBBT(const BBT &bbt);
+  Position() noexcept;
+  Position(ConstructFromSeconds, double seconds) noexcept;
+  Position(ConstructFromTicks, double ticks) noexcept;
+  explicit Position(const BBT &bbt) noexcept;
+
+  void StartNewBar() noexcept;
+  void SetToSeconds(double seconds) noexcept;
+  void SetToTicks(double ticks) noexcept;
+  void SetToBBT(const BBT &bbt) noexcept;
   /**
    * It is a programming error to call this method with negative
    * `seconds`.
    */
-  void IncrementBySeconds(double seconds);
+  void IncrementBySeconds(double seconds) noexcept;
   /**
    * It is a programming error to call this method with negative
    * `seconds`.
    */
-  void IncrementByTicks(double ticks);
+  void IncrementByTicks(double ticks) noexcept;
   /**
    * Rounds up to the nearest whole tick in the bar.
    */
-  void RoundUp();
+  void RoundUp() noexcept;
 
-  double SecondsToTicks(double seconds) const;
-  double TicksToSeconds(double ticks) const;
+  double SecondsToTicks(double seconds) const noexcept;
+  double TicksToSeconds(double ticks) const noexcept;
 
   void PpqnChange(double ppqn);
   void TimeSignatureChange(double beats_per_bar, double beat_type,
@@ -101,7 +101,7 @@ class Position {
  */
 template <typename FieldType, FieldType (Position::*Member)() const>
 struct ComparePosition {
-  bool operator()(const Position &lhs, const Position &rhs) {
+  bool operator()(const Position &lhs, const Position &rhs) noexcept {
     return (lhs.*Member)() < (rhs.*Member)();
   }
 };
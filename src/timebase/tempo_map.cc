@@ -3,7 +3,7 @@
 
 #include <cmath>
 #include <algorithm>
-#include <iostream>
+#include <stdexcept>
 
 #include <boost/assert.hpp>
 
@@ -12,13 +12,28 @@ static constexpr double kEps = 1e-9;
 namespace midiaud {
 namespace timebase {
 
-TempoMap::TempoMap() {
+TempoMap::TempoMap()
+    : division_{Position::kDefaultTicksPerBeat, 0, 0} {
   positions_.push_back(Position());
 }
 
-TempoMap::TempoMap(double ppqn)
+TempoMap::TempoMap(const TimeDivision &division)
     : TempoMap() {
-  positions_.back().PpqnChange(ppqn);
+  division_ = division;
+  if (!division.smpte()) {
+    positions_.back().PpqnChange(division.ppqn);
+    return;
+  }
+  // Drop frame timecode counts 30 frames per 1.001 seconds.
+  bool drop_frame = division.frames_per_second == TimeDivision::kDropFrame;
+  int frames_per_second = drop_frame ? 30 : division.frames_per_second;
+  positions_.back().PpqnChange(frames_per_second * division.ticks_per_frame);
+  positions_.back().TempoChange(drop_frame ? 1001000 : 1000000);
+}
+
+bool TempoMap::IsTempoEvent(const Event &event) {
+  return event.is_metadata() && event.midi().size() > 1
+      && (event.midi()[1] == 0x51 || event.midi()[1] == 0x58);
 }
 
 void TempoMap::AcknowledgeEvent(const Event &event) {
@@ -42,26 +57,41 @@ void TempoMap::AcknowledgeEvent(const Event &event) {
                                      thirty_seconds_per_midi_quarter);
         AppendOrReplace(position);
       } else {
-        std::cerr << "Warning: ignoring invalid time signature metaevent"
-                  << " at tick " << position.ticks() << "\n";
+        diagnostics_.push_back({position.ticks(),
+                                "ignoring invalid time signature metaevent"});
       }
       break;
 
     case 0x51:
+      if (division_.smpte()) break;
       if (event.midi().size() == 6) {
         uint32_t microseconds_per_midi_quarter =
             (event.midi()[3] << 16) | (event.midi()[4] << 8) | event.midi()[5];
         position.TempoChange(microseconds_per_midi_quarter);
         AppendOrReplace(position);
       } else {
-        std::cerr << "Warning: ignoring invalid tempo metaevent"
-                  << " at tick " << position.ticks() << "\n";
+        diagnostics_.push_back({position.ticks(),
+                                "ignoring invalid tempo metaevent"});
       }
       break;
   }
 }
 
-Position TempoMap::GetSeconds(double seconds) const {
+void TempoMap::TruncateAt(double ticks) {
+  auto first_to_drop = std::lower_bound(
+      positions_.begin() + 1, positions_.end(),
+      Position((Position::ConstructFromTicks()), ticks),
+      ComparePositionByTicks());
+  positions_.erase(first_to_drop, positions_.end());
+  diagnostics_.erase(
+      std::find_if(diagnostics_.begin(), diagnostics_.end(),
+                   [ticks](const TempoMapDiagnostic &diagnostic) {
+                     return diagnostic.ticks >= ticks;
+                   }),
+      diagnostics_.end());
+}
+
+Position TempoMap::GetSeconds(double seconds) const noexcept {
   Position pos_to_find((Position::ConstructFromSeconds()), seconds);
   auto upper_bound = std::upper_bound(positions_.cbegin(),
                                       positions_.cend(), pos_to_find,
@@ -75,7 +105,7 @@ Position TempoMap::GetSeconds(double seconds) const {
   return position;
 }
 
-Position TempoMap::GetTicks(double ticks) const {
+Position TempoMap::GetTicks(double ticks) const noexcept {
   Position pos_to_find((Position::ConstructFromTicks()), ticks);
   auto upper_bound = std::upper_bound(positions_.cbegin(),
                                       positions_.cend(), pos_to_find,
@@ -88,7 +118,7 @@ Position TempoMap::GetTicks(double ticks) const {
   return position;
 }
 
-Position TempoMap::GetBBT(const BBT &bbt) const {
+Position TempoMap::GetBBT(const BBT &bbt) const noexcept {
   Position pos_to_find(bbt);
   auto upper_bound = std::upper_bound(positions_.cbegin(),
                                       positions_.cend(), pos_to_find,
@@ -101,9 +131,10 @@ Position TempoMap::GetBBT(const BBT &bbt) const {
   return position;
 }
 
-void TempoMap::FillBBT(jack_position_t *pos) const {
+void TempoMap::FillBBT(jack_position_t *pos,
+                       const TimeScale &time_scale) const noexcept {
   double seconds = static_cast<double>(pos->frame) / pos->frame_rate;
-  Position position(GetSeconds(seconds));
+  Position position(GetSeconds(time_scale.ToFileSeconds(seconds)));
   position.RoundUp();
   pos->bar = position.bbt().bar;
   pos->beat = position.bbt().beat;
@@ -114,8 +145,9 @@ void TempoMap::FillBBT(jack_position_t *pos) const {
   pos->beats_per_bar = position.beats_per_bar();
   pos->beat_type = position.beat_type();
   pos->ticks_per_beat = position.ticks_per_beat();
-  pos->beats_per_minute = position.beats_per_minute();
-  double offset_seconds = position.seconds() - seconds;
+  pos->beats_per_minute = position.beats_per_minute() * time_scale.scale();
+  double offset_seconds =
+      time_scale.ToTransportSeconds(position.seconds()) - seconds;
   pos->bbt_offset = offset_seconds * pos->frame_rate;
   pos->valid = static_cast<jack_position_bits_t>(
       pos->valid | JackPositionBBT | JackBBTFrameOffset);
@@ -1,16 +1,27 @@
 #ifndef TIMEBASE_TEMPO_MAP_H_
 #define TIMEBASE_TEMPO_MAP_H_
 
+#include <string>
 #include <vector>
 
 #include <jack/jack.h>
 
 #include "event.h"
 #include "timebase/position.h"
+#include "timebase/time_division.h"
+#include "timebase/time_scale.h"
 
 namespace midiaud {
 namespace timebase {
 
+/**
+ * A problem with the file found while building the tempo map.
+ */
+struct TempoMapDiagnostic {
+  double ticks;
+  std::string message;
+};
+
 class TempoMap {
  public:
   /**
@@ -21,26 +32,65 @@ class TempoMap {
    * Builds tempo map based on libsmf's internal tempo map, extending
    * it to produce Jack position information fast.
    *
-   * @param smf the smf object to copy tempo from.
+   * Files with SMPTE division get a fixed tempo of one quarter note
+   * per SMPTE second, which maps ticks to seconds by a constant
+   * factor. Their tempo metaevents are ignored, so only meter changes
+   * are ever added to the map.
    */
-  explicit TempoMap(double ppqn);
+  explicit TempoMap(const TimeDivision &division);
+
+  /**
+   * Returns whether `event` is a metaevent the tempo map cares about.
+   */
+  static bool IsTempoEvent(const Event &event);
 
   /**
    * Must be called with a monotone sequence of events.
    */
   void AcknowledgeEvent(const Event &event);
+  /**
+   * Forgets every position and diagnostic at or after `ticks`, except
+   * the initial position, so that the map can be rebuilt from there
+   * by AcknowledgeEvent().
+   */
+  void TruncateAt(double ticks);
 
-  Position GetSeconds(double seconds) const;
-  Position GetTicks(double ticks) const;
-  Position GetBBT(const BBT &bbt) const;
+  Position GetSeconds(double seconds) const noexcept;
+  Position GetTicks(double ticks) const noexcept;
+  Position GetBBT(const BBT &bbt) const noexcept;
 
-  void FillBBT(jack_position_t *pos) const;
+  /**
+   * Fills the BBT fields of `pos` for playback at the speed of
+   * `time_scale`.
+   */
+  void FillBBT(jack_position_t *pos,
+               const TimeScale &time_scale) const noexcept;
   jack_nframes_t BBTToFrame(jack_position_t *pos) const;
 
+  /**
+   * Malformed metaevents ignored by AcknowledgeEvent(), in the order
+   * they were found.
+   */
+  const std::vector<TempoMapDiagnostic> &diagnostics() const {
+    return diagnostics_;
+  }
+
+  const TimeDivision &division() const { return division_; }
+  double ppqn() const { return positions_.front().ppqn(); }
+  size_t size() const { return positions_.size(); }
+  std::vector<Position>::const_iterator begin() const {
+    return positions_.cbegin();
+  }
+  std::vector<Position>::const_iterator end() const {
+    return positions_.cend();
+  }
+
  private:
   void AppendOrReplace(const Position &position);
 
+  TimeDivision division_;
   std::vector<Position> positions_;
+  std::vector<TempoMapDiagnostic> diagnostics_;
 };
 
 } // timebase
@@ -0,0 +1,58 @@
+#ifndef TIMEBASE_TIME_DIVISION_H_
+#define TIMEBASE_TIME_DIVISION_H_
+
+#include <cstdint>
+
+namespace midiaud {
+namespace timebase {
+
+/**
+ * Meaning of the ticks of a Standard MIDI File.
+ *
+ * With metrical division, ticks are fractions of a quarter note whose
+ * length is set by tempo metaevents. With SMPTE division, ticks are
+ * fractions of a timecode frame, thus time is linear in ticks and
+ * tempo metaevents do not matter.
+ */
+struct TimeDivision {
+  /**
+   * Frame rate standing for 30 drop frame, which runs at 29.97 frames
+   * per second.
+   */
+  static constexpr int kDropFrame = 29;
+
+  /**
+   * Decodes the division word of an MThd chunk.
+   */
+  static TimeDivision FromWord(uint16_t word) noexcept {
+    if ((word & 0x8000) == 0) return {static_cast<double>(word), 0, 0};
+    // The upper byte is the negated frame rate in two's complement.
+    int frames_per_second = 0x100 - (word >> 8);
+    return {0, frames_per_second, word & 0xff};
+  }
+
+  bool smpte() const noexcept { return frames_per_second != 0; }
+
+  bool operator==(const TimeDivision &other) const noexcept {
+    return ppqn == other.ppqn && frames_per_second == other.frames_per_second
+        && ticks_per_frame == other.ticks_per_frame;
+  }
+  bool operator!=(const TimeDivision &other) const noexcept {
+    return !(*this == other);
+  }
+
+  /**
+   * Ticks per quarter note of metrical division, 0 for SMPTE.
+   */
+  double ppqn;
+  /**
+   * 24, 25, kDropFrame or 30 for SMPTE division, 0 for metrical.
+   */
+  int frames_per_second;
+  int ticks_per_frame;
+};
+
+} // timebase
+} // midiaud
+
+#endif // TIMEBASE_TIME_DIVISION_H_
@@ -0,0 +1,34 @@
+
+#include "timebase/time_scale.h"
+
+#include <algorithm>
+
+namespace midiaud {
+namespace timebase {
+
+constexpr double TimeScale::kMinScale;
+
+TimeScale::TimeScale()
+    : scale_(1), transport_anchor_(0), file_anchor_(0) {
+}
+
+void TimeScale::SetScale(double scale, double transport_seconds) noexcept {
+  file_anchor_ = ToFileSeconds(transport_seconds);
+  transport_anchor_ = transport_seconds;
+  scale_ = std::max(kMinScale, scale);
+}
+
+void TimeScale::ResetAnchor() noexcept {
+  transport_anchor_ = 0;
+  file_anchor_ = 0;
+}
+
+void TimeScale::Anchor(double transport_seconds, double file_seconds,
+                       double scale) noexcept {
+  transport_anchor_ = transport_seconds;
+  file_anchor_ = file_seconds;
+  scale_ = std::max(kMinScale, scale);
+}
+
+} // timebase
+} // midiaud
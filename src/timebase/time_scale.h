@@ -0,0 +1,63 @@
+#ifndef TIMEBASE_TIME_SCALE_H_
+#define TIMEBASE_TIME_SCALE_H_
+
+namespace midiaud {
+namespace timebase {
+
+/**
+ * Maps transport time to file time when playing at a different speed
+ * than notated.
+ *
+ * The mapping is linear, with a slope of `scale` file seconds per
+ * transport second. Changing the scale moves the anchor of the
+ * mapping to the current position, so that the musical position stays
+ * continuous.
+ */
+class TimeScale {
+ public:
+  static constexpr double kMinScale = 0.01;
+
+  TimeScale();
+
+  /**
+   * Changes the speed without jumping at `transport_seconds`.
+   */
+  void SetScale(double scale, double transport_seconds) noexcept;
+  /**
+   * Forgets the anchor left by previous scale changes, so that
+   * transport time zero is the start of the file again. Called upon
+   * relocation.
+   */
+  void ResetAnchor() noexcept;
+  /**
+   * Replaces the mapping by one that maps `transport_seconds` to
+   * `file_seconds` with a slope of `scale`.
+   */
+  void Anchor(double transport_seconds, double file_seconds,
+              double scale) noexcept;
+
+  double ToFileSeconds(double transport_seconds) const noexcept {
+    return file_anchor_ + (transport_seconds - transport_anchor_) * scale_;
+  }
+  double ToTransportSeconds(double file_seconds) const noexcept {
+    return transport_anchor_ + (file_seconds - file_anchor_) / scale_;
+  }
+
+  double scale() const { return scale_; }
+  /**
+   * Whether file time is transport time.
+   */
+  bool identity() const {
+    return scale_ == 1 && transport_anchor_ == file_anchor_;
+  }
+
+ private:
+  double scale_;
+  double transport_anchor_;
+  double file_anchor_;
+};
+
+} // timebase
+} // midiaud
+
+#endif // TIMEBASE_TIME_SCALE_H_
@@ -0,0 +1,169 @@
+
+#include <chrono>
+#include <cerrno>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include "stats_page.h"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+/**
+ * Where Linux exposes the POSIX shared memory segments.
+ */
+const char kShmDirectory[] = "/dev/shm";
+
+void print_usage(char *argv0) {
+  std::cout << "Usage: " << argv0 << " [options]\n";
+}
+
+const char *transport_state_name(jack_transport_state_t state) {
+  switch (state) {
+    case JackTransportStopped: return "stopped";
+    case JackTransportRolling: return "rolling";
+    case JackTransportStarting: return "starting";
+    default: return "unknown";
+  }
+}
+
+/**
+ * Reads the segments of every running midiaud instance. Segments
+ * left behind by crashed instances are skipped.
+ */
+std::vector<midiaud::StatsSnapshot> read_all_pages() {
+  // Segment names start with a slash that is not part of the file
+  // name.
+  std::string prefix(midiaud::StatsPage::kNamePrefix + 1);
+  std::vector<midiaud::StatsSnapshot> snapshots;
+  for (fs::directory_iterator it(kShmDirectory);
+       it != fs::directory_iterator(); ++it) {
+    std::string filename = it->path().filename().string();
+    if (filename.compare(0, prefix.size(), prefix) != 0) continue;
+    midiaud::StatsSnapshot snapshot;
+    if (!midiaud::ReadStatsPage("/" + filename, &snapshot)) continue;
+    if (kill(snapshot.pid, 0) != 0 && errno == ESRCH) continue;
+    snapshots.push_back(snapshot);
+  }
+  return snapshots;
+}
+
+/**
+ * Prints a line per instance. Rates are computed against `previous`,
+ * the snapshots of the last refresh `interval` seconds ago.
+ */
+void print_table(const std::vector<midiaud::StatsSnapshot> &snapshots,
+                 const std::map<int, midiaud::StatsSnapshot> &previous,
+                 double interval) {
+  std::cout << std::left << std::setw(16) << "CLIENT" << std::right
+            << std::setw(8) << "PID" << std::setw(9) << "STATE"
+            << std::setw(10) << "TIME" << std::setw(8) << "EV/S"
+            << std::setw(9) << "B/S" << std::setw(7) << "P50"
+            << std::setw(7) << "P99" << std::setw(7) << "MAX"
+            << std::setw(6) << "DSP%" << std::setw(6) << "FULL"
+            << std::setw(6) << "UNDR" << std::setw(6) << "LOST"
+            << std::setw(5) << "REL" << std::setw(8) << "REL-MS"
+            << "  FILE\n";
+  std::cout << std::fixed;
+  for (const midiaud::StatsSnapshot &snapshot : snapshots) {
+    double seconds = snapshot.frame_rate == 0
+        ? 0 : static_cast<double>(snapshot.frame) / snapshot.frame_rate;
+    double period_microseconds = snapshot.frame_rate == 0
+        ? 0 : 1e6 * snapshot.nframes / snapshot.frame_rate;
+    uint32_t p99 = snapshot.CyclePercentile(0.99);
+    std::cout << std::left << std::setw(16) << snapshot.client_name
+              << std::right << std::setw(8) << snapshot.pid
+              << std::setw(9) << transport_state_name(snapshot.transport_state)
+              << std::setw(10) << std::setprecision(1) << seconds;
+    auto last = previous.find(snapshot.pid);
+    if (last != previous.end() && interval > 0) {
+      std::cout << std::setw(8) << std::setprecision(0)
+                << (snapshot.events_written - last->second.events_written)
+                   / interval
+                << std::setw(9)
+                << (snapshot.bytes_written - last->second.bytes_written)
+                   / interval;
+    } else {
+      std::cout << std::setw(8) << "-" << std::setw(9) << "-";
+    }
+    std::cout << std::setw(7) << snapshot.CyclePercentile(0.5)
+              << std::setw(7) << p99
+              << std::setw(7) << snapshot.max_cycle_microseconds
+              << std::setw(6) << std::setprecision(0)
+              << (period_microseconds > 0 ? 100 * p99 / period_microseconds
+                                          : 0)
+              << std::setw(6) << snapshot.errors[static_cast<size_t>(
+                     midiaud::RtStatus::kPortBufferFull)]
+              << std::setw(6) << snapshot.errors[static_cast<size_t>(
+                     midiaud::RtStatus::kPrefetchUnderrun)]
+              << std::setw(6) << snapshot.errors[static_cast<size_t>(
+                     midiaud::RtStatus::kErrorQueueOverflow)]
+              << std::setw(5) << snapshot.reloads
+              << std::setw(8) << std::setprecision(1)
+              << snapshot.last_reload_microseconds / 1000.0
+              << "  " << snapshot.input_file << "\n";
+  }
+  if (snapshots.empty()) std::cout << "No running midiaud instances\n";
+  std::cout.flush();
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description generic_options_desc{"Allowed options"};
+  generic_options_desc.add_options()
+      ("help", "produce help message")
+      ("interval,n", po::value<double>()->default_value(1),
+       "seconds between refreshes")
+      ("once,1", "print the table once and exit")
+      ;
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, generic_options_desc), vm);
+    if (vm.count("help") > 0) {
+      print_usage(argv[0]);
+      std::cerr << generic_options_desc << "\n";
+      return 0;
+    }
+    po::notify(vm);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n\n";
+    print_usage(argv[0]);
+    std::cerr << generic_options_desc << "\n";
+    return -1;
+  }
+
+  double interval = vm["interval"].as<double>();
+  if (interval <= 0) {
+    std::cerr << "interval must be positive\n";
+    return -1;
+  }
+  bool clear_screen = isatty(STDOUT_FILENO);
+
+  try {
+    std::map<int, midiaud::StatsSnapshot> previous;
+    while (true) {
+      std::vector<midiaud::StatsSnapshot> snapshots = read_all_pages();
+      if (clear_screen && vm.count("once") == 0) std::cout << "\033[H\033[2J";
+      print_table(snapshots, previous, interval);
+      if (vm.count("once") > 0) return 0;
+      previous.clear();
+      for (const midiaud::StatsSnapshot &snapshot : snapshots)
+        previous[snapshot.pid] = snapshot;
+      std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return -1;
+  }
+}
@@ -0,0 +1,277 @@
+
+#include "trace_replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "active_notes.h"
+#include "midi_sink.h"
+#include "playback_control.h"
+#include "smf_streamer.h"
+#include "timebase/time_scale.h"
+
+namespace midiaud {
+
+namespace {
+
+constexpr size_t kMaxLoggedMismatches = 10;
+
+/**
+ * A MIDI event in the form it is captured in.
+ */
+struct TracedEvent {
+  jack_nframes_t offset;
+  uint16_t size;
+  uint64_t prefix;
+
+  bool operator==(const TracedEvent &other) const {
+    return offset == other.offset && size == other.size
+        && prefix == other.prefix;
+  }
+};
+
+class ReplaySink : public MidiSink {
+ public:
+  ReplaySink(std::vector<TracedEvent> &events, jack_nframes_t framerate,
+             ActiveNotes &active_notes) noexcept
+      : MidiSink(framerate, active_notes), events_(events) {
+  }
+
+ protected:
+  RtStatus WriteEvent(jack_nframes_t offset, const uint8_t *data,
+                      size_t size) noexcept override {
+    uint64_t prefix = 0;
+    std::memcpy(&prefix, data, std::min(size, sizeof(prefix)));
+    events_.push_back({offset,
+                       static_cast<uint16_t>(std::min<size_t>(size,
+                                                              UINT16_MAX)),
+                       prefix});
+    return RtStatus::kOk;
+  }
+
+ private:
+  std::vector<TracedEvent> &events_;
+};
+
+/**
+ * The records of one sync or process callback call.
+ */
+struct TracedCall {
+  TraceRecord call;
+  std::vector<PlaybackCommand> commands;
+  bool reloaded;
+  uint32_t load_id;
+  std::vector<TracedEvent> events;
+};
+
+/**
+ * Mirrors the state JackMidiPlayer keeps for the RT thread.
+ */
+class Replayer {
+ public:
+  Replayer(const CycleTrace &trace, std::ostream &log)
+      : log_(log), expected_frame_(0), has_pending_(false),
+        result_{0, 0, 0, 0, 0, 0, 0} {
+    for (const auto &load : trace.loads)
+      loads_[load.load_id] = load;
+  }
+
+  void Feed(const TraceRecord &record) {
+    switch (record.type) {
+      case TraceRecordType::kProcess:
+      case TraceRecordType::kSync:
+        Finish();
+        pending_.call = record;
+        pending_.commands.clear();
+        pending_.reloaded = false;
+        pending_.events.clear();
+        has_pending_ = true;
+        break;
+      case TraceRecordType::kReload:
+        pending_.reloaded = true;
+        pending_.load_id = static_cast<uint32_t>(record.data);
+        break;
+      case TraceRecordType::kCommand: {
+        PlaybackCommand command;
+        command.type = static_cast<PlaybackCommand::Type>(record.state);
+        command.channels = record.size;
+        std::memcpy(&command.value, &record.data, sizeof(command.value));
+        pending_.commands.push_back(command);
+        break;
+      }
+      case TraceRecordType::kEvent:
+        pending_.events.push_back({record.frame, record.size, record.data});
+        break;
+      default:
+        break;
+    }
+  }
+
+  /**
+   * Executes the pending call, if any.
+   */
+  void Finish() {
+    if (!has_pending_) return;
+    has_pending_ = false;
+    // Files are parsed before the clock starts, the RT thread only
+    // ever gets ready streamers either, and takes them over by pointer.
+    if (pending_.reloaded) smf_streamer_ = Load(pending_.load_id);
+
+    emitted_.clear();
+    if (pending_.call.type == TraceRecordType::kSync) {
+      RunSync();
+      return;
+    }
+    double cycle_seconds = RunProcess();
+
+    ++result_.cycles;
+    result_.events += emitted_.size();
+    result_.total_seconds += cycle_seconds;
+    if (cycle_seconds > result_.max_cycle_seconds) {
+      result_.max_cycle_seconds = cycle_seconds;
+      result_.slowest_cycle_frame = pending_.call.frame;
+    }
+    if (emitted_ != pending_.events) {
+      if (result_.mismatched_cycles++ < kMaxLoggedMismatches) {
+        log_ << "Cycle at frame " << pending_.call.frame << ": captured "
+             << pending_.events.size() << " events, replayed "
+             << emitted_.size() << "\n";
+      }
+    }
+  }
+
+  const ReplayResult &result() const { return result_; }
+
+ private:
+  const SmfStreamer &Load(uint32_t load_id) {
+    auto loaded = loaded_.find(load_id);
+    if (loaded != loaded_.end()) return loaded->second;
+    SmfStreamer smf_streamer;
+    if (load_id != 0) {
+      auto load = loads_.find(load_id);
+      if (load == loads_.end())
+        throw std::runtime_error("trace has no file for load "
+                                 + std::to_string(load_id));
+      // Streamed files are replayed streamed, because only loaded
+      // files have their setup data written ahead.
+      if (load->second.streaming) {
+        smf_streamer = SmfStreamer::OpenStreaming(load->second.filename);
+      } else if (!load->second.filename.empty()) {
+        smf_streamer = SmfStreamer(load->second.filename);
+        if (load->second.prerendered_rate != 0)
+          smf_streamer.Prerender(load->second.prerendered_rate);
+      }
+    }
+    return loaded_.emplace(load_id, smf_streamer).first->second;
+  }
+
+  void RunSync() {
+    const TraceRecord &call = pending_.call;
+    if (call.state == JackTransportStarting) {
+      if (call.frame != expected_frame_) time_scale_.ResetAnchor();
+      smf_streamer_.RequestReposition(
+          static_cast<double>(call.frame) / call.frame_rate, time_scale_);
+      // Where the client was ready, wait for the background thread
+      // just as long as it took to get there. Polling earlier could
+      // pick up the result cycles before the capture did.
+      if (call.size != 0) WaitUntilReady();
+    }
+  }
+
+  /**
+   * Waits for the reposition. Setup data is written by the replayed
+   * process calls, not by waiting.
+   */
+  void WaitUntilReady() {
+    while (!smf_streamer_.ready()
+           && (smf_streamer_.streaming() || smf_streamer_.repositioning()))
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+
+  /**
+   * Replays a process call and returns the time spent in the calls
+   * the RT thread makes into the streamer. Waiting for the background
+   * threads of the streamer is left out, as is the bookkeeping of the
+   * replay.
+   */
+  double RunProcess() {
+    const TraceRecord &call = pending_.call;
+    ReplaySink sink(emitted_, call.frame_rate, active_notes_);
+    bool now_playing = (call.state == JackTransportRolling);
+    jack_nframes_t latency = static_cast<jack_nframes_t>(call.data);
+    double start_seconds = static_cast<double>(call.frame + latency)
+        / call.frame_rate;
+    double end_seconds =
+        static_cast<double>(call.frame + latency + call.nframes)
+        / call.frame_rate;
+    expected_frame_ = now_playing ? call.frame + call.nframes : call.frame;
+
+    for (const PlaybackCommand &command : pending_.commands) {
+      if (command.type == PlaybackCommand::kPanic) {
+        RtStatus status = sink.WriteGlobalSoundOff(0);
+        if (status == RtStatus::kOk)
+          status = sink.WriteGlobalResetControllers(0);
+        CountError(status);
+        active_notes_.Clear();
+      } else if (command.type == PlaybackCommand::kSetTempoScale) {
+        time_scale_.SetScale(command.value, start_seconds);
+      } else {
+        controls_.Apply(command);
+      }
+    }
+
+    if (!smf_streamer_.initialized())
+      smf_streamer_.RequestReposition(start_seconds, time_scale_);
+    auto start = std::chrono::steady_clock::now();
+    CountError(smf_streamer_.StopIfNeeded(now_playing, sink));
+    CountError(smf_streamer_.WriteSetup(call.size, sink));
+    std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start;
+    if (now_playing) {
+      // Replays what would have happened if the reposition was
+      // prepared in time, a late one shows up as a mismatch. The wait
+      // stays between the calls, so that the same events come out.
+      WaitUntilReady();
+      start = std::chrono::steady_clock::now();
+      CountError(smf_streamer_.CopyToSink(start_seconds, end_seconds,
+                                          time_scale_, controls_, sink));
+      duration += std::chrono::steady_clock::now() - start;
+    }
+    return duration.count();
+  }
+
+  void CountError(RtStatus status) {
+    if (status != RtStatus::kOk) ++result_.rt_errors;
+  }
+
+  std::ostream &log_;
+  std::map<uint32_t, TracedLoad> loads_;
+  std::map<uint32_t, SmfStreamer> loaded_;
+  SmfStreamer smf_streamer_;
+  PlaybackControls controls_;
+  ActiveNotes active_notes_;
+  timebase::TimeScale time_scale_;
+  jack_nframes_t expected_frame_;
+  TracedCall pending_;
+  bool has_pending_;
+  std::vector<TracedEvent> emitted_;
+  ReplayResult result_;
+};
+
+}
+
+ReplayResult ReplayCycleTrace(const CycleTrace &trace, std::ostream &log) {
+  Replayer replayer(trace, log);
+  for (const TraceRecord &record : trace.records)
+    replayer.Feed(record);
+  replayer.Finish();
+  return replayer.result();
+}
+
+}
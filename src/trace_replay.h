@@ -0,0 +1,51 @@
+#ifndef TRACE_REPLAY_H_
+#define TRACE_REPLAY_H_
+
+#include <cstddef>
+#include <ostream>
+
+#include <jack/jack.h>
+
+#include "cycle_trace.h"
+
+namespace midiaud {
+
+struct ReplayResult {
+  size_t cycles;
+  size_t events;
+  /**
+   * Cycles in which the replay emitted different events than the
+   * captured RT thread.
+   */
+  size_t mismatched_cycles;
+  /**
+   * Failures reported by the replayed sink writes, such as a full port
+   * buffer.
+   */
+  size_t rt_errors;
+  double total_seconds;
+  double max_cycle_seconds;
+  /**
+   * Transport frame of the slowest cycle.
+   */
+  jack_nframes_t slowest_cycle_frame;
+};
+
+/**
+ * Drives SmfStreamer and TempoMap through the exact sequence of
+ * transport states, sync calls, commands and reloads of a captured
+ * trace, timing every cycle and comparing the emitted events with
+ * the captured ones.
+ *
+ * Files are reloaded by path, thus they should not have been
+ * modified since the capture. Events from the MIDI input port are
+ * not part of the trace.
+ *
+ * @param log receives a line for each of the first mismatches.
+ * @throws std::runtime_error if a traced file cannot be loaded.
+ */
+ReplayResult ReplayCycleTrace(const CycleTrace &trace, std::ostream &log);
+
+}
+
+#endif // TRACE_REPLAY_H_